@@ -0,0 +1,77 @@
+/**
+ * @file checksum.h
+ *
+ * @brief Header file corresponding to the checksum.c source file.
+ *
+ * @details Checksum engines used by the middleware to verify the data packets. The algorithm
+ * is negotiated in the handshake, clients that do not negotiate use the zlib crc32.
+ *
+ * @author Robledo, Valentín
+ * @date Mayo 2023
+ * @version 1.0
+ *
+ * @copyright Copyright (c) 2023
+ */
+
+#ifndef __CHECKSUM_H__
+#define __CHECKSUM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Enumeration representing the checksum algorithms, used as a mask in the handshake. */
+typedef enum{
+    CHECKSUM_CRC32 = 0x01,
+    CHECKSUM_CRC32C = 0x02,
+    CHECKSUM_XXH3 = 0x04
+} checksum_algorithm;
+
+/* Checksum algorithms compiled in. */
+#ifdef HAVE_XXHASH
+#define CHECKSUMS_SUPPORTED (CHECKSUM_CRC32 | CHECKSUM_CRC32C | CHECKSUM_XXH3)
+#else
+#define CHECKSUMS_SUPPORTED (CHECKSUM_CRC32 | CHECKSUM_CRC32C)
+#endif
+
+/**
+ * @brief Function that computes the checksum of a block of data.
+ *
+ * CRC32C uses the SSE4.2 crc32 instruction when the CPU supports it, three streams at a time
+ * for large blocks. xxHash3 is truncated to its low 32 bits.
+ *
+ * @param algorithm Checksum algorithm.
+ * @param data Data.
+ * @param size Size of the data.
+ *
+ * @return uint32_t Checksum.
+ */
+uint32_t checksum_compute(checksum_algorithm algorithm, const void* data, size_t size);
+
+/**
+ * @brief Function that selects the fastest checksum algorithm of a mask.
+ *
+ * @param algorithms Mask of checksum algorithms.
+ *
+ * @return checksum_algorithm Algorithm selected, CHECKSUM_CRC32 if the mask has no supported algorithm.
+ */
+checksum_algorithm checksum_select(uint8_t algorithms);
+
+/**
+ * @brief Function that returns the name of a checksum algorithm.
+ *
+ * @param algorithm Checksum algorithm.
+ *
+ * @return const char* Name of the algorithm.
+ */
+const char* checksum_name(checksum_algorithm algorithm);
+
+/**
+ * @brief Function that parses the name of a checksum algorithm.
+ *
+ * @param name Name of the algorithm: crc32, crc32c or xxh3.
+ *
+ * @return int Algorithm, -1 if the name is not known or the algorithm is not compiled in.
+ */
+int checksum_parse(const char* name);
+
+#endif // __CHECKSUM_H__
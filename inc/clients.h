@@ -16,6 +16,7 @@
 #define __CLIENTS_H__
 
 #include <stdint.h>
+#include <sys/eventfd.h>
 #include "middle.h"
 
 /* Keyboard input was successful */
@@ -46,17 +47,65 @@ struct thread_args
     pthread_t main_tid;
 };
 
+/**
+ * @struct request
+ *
+ * @brief Structure representing a request of a pipelined connection waiting for its response.
+ *
+ * @param id Identifier of the request.
+ * @param command Command sent to the server, kept to send it again after a CHECKSUM_FAIL.
+ * @param next Pointer to the next request.
+ */
+struct request
+{
+    uint32_t id;
+    char* command;
+    struct request* next;
+};
+
+/**
+ * @struct response
+ *
+ * @brief Structure containing a response being received on a pipelined connection.
+ *
+ * @param id Identifier of the request answered.
+ * @param num_packets Number of packets of the response.
+ * @param delivered Number of packets stored in order.
+ * @param receiving Packets received out of order.
+ * @param message Message being received.
+ * @param next Pointer to the next response.
+ */
+struct response
+{
+    uint32_t id;
+    size_t num_packets;
+    size_t delivered;
+    receive_window receiving;
+    buffer message;
+    struct response* next;
+};
+
 volatile sig_atomic_t server_flag, client_flag, client_status_f;
+pthread_mutex_t status_lock;
+pthread_cond_t status_cond;
 int client_socket;
 char* unix_socket_path;
 struct sockaddr_un server_address;
-struct timeval timeout;
+int shutdown_fd;
+handshake options;
+compressor compression;
+int pipeline;
+pthread_mutex_t pipeline_lock;
+pthread_cond_t pipeline_cond;
+pthread_mutex_t send_lock;
+struct request* requests;
+size_t outstanding;
 
 /**
  * @brief Function that initializes the client.
  *
  * Creating the socket, connecting to the server and sending a first message indicating
- * the type of client it is. In addition, it configures the SIGINT and SIGUSR1 signals to be handled.
+ * the type of client it is, followed by the negotiation of the wire format. In addition, it configures the SIGINT and SIGUSR1 signals to be handled.
  *
  * @param client_type Type of client.
  * @param protocol_type Type of protocol.
@@ -98,7 +147,8 @@ int connect_ipv6_sockect(const char *socket_ipv6, const uint16_t socket_port);
 /**
  * @brief Function responsible for sending messages to the server.
  *
- * Waits for keyboard input from the user and then sends the message.
+ * Waits for keyboard input from the user and then sends the message. Then it sleeps on a condition
+ * variable until the receiving thread printed the response. Closes the client at the end of the input.
  *
  * @param client_socket File descriptor (fd) of the client socket.
  * @param client_type Client type.
@@ -107,6 +157,30 @@ int connect_ipv6_sockect(const char *socket_ipv6, const uint16_t socket_port);
  */
 void message_sender(int client_socket, client_t client_type);
 
+/**
+ * @brief Function responsible for sending messages to the server on a pipelined connection.
+ *
+ * Sends every command as soon as it is entered, tagged with a new identifier, without waiting for
+ * the previous responses. It only sleeps when MAX_PIPELINE_REQUESTS requests are waiting for their
+ * response. At the end of the input it waits for every response and closes the client.
+ *
+ * @param client_socket File descriptor (fd) of the client socket.
+ * @param client_type Client type.
+ *
+ * @return void
+ */
+void message_pipeline(int client_socket, client_t client_type);
+
+/**
+ * @brief Function that sends a request record with the command in a single frame.
+ *
+ * @param client_socket File descriptor (fd) of the client socket.
+ * @param request Pointer to the request.
+ *
+ * @return void
+ */
+void send_request(int client_socket, const struct request* request);
+
 /**
  * @brief Function that creates a thread.
  *
@@ -132,7 +206,7 @@ void *thread_function(void *arg);
  * @brief Function that is responsible for receiving messages.
  *
  * Waits for a message from the server and prints it on the screen. In addition, it terminates
- * the client in case the server has disconnected.
+ * the client in case the server has disconnected. Blocks until the socket or the shutdown eventfd is readable.
  *
  * @param client_tsocket File descriptor (fd) of the client socket.
  * @param client_type Client type.
@@ -142,6 +216,41 @@ void *thread_function(void *arg);
  */
 void receiving_logic(int client_tsocket, client_t client_type, fd_set read_fds);
 
+/**
+ * @brief Function that is responsible for receiving the records of a pipelined connection.
+ *
+ * Sends again the requests whose checksum failed, acknowledges every frame of the responses and
+ * prints each response with the identifier of its request once it is complete.
+ *
+ * @param client_tsocket File descriptor (fd) of the client socket.
+ * @param client_type Client type.
+ *
+ * @return void
+ */
+void receiving_records(int client_tsocket, client_t client_type);
+
+/**
+ * @brief Function that receives a record of a pipelined connection.
+ *
+ * @param client_tsocket File descriptor (fd) of the client socket.
+ * @param client_type Client type.
+ * @param responses Pointer to the list of responses being received.
+ * @param packet Data packet where the frames are received.
+ *
+ * @return Returns -1 if the server disconnected or sent an invalid record.
+ */
+int receive_record(int client_tsocket, client_t client_type, struct response** responses, data_packet* packet);
+
+/**
+ * @brief Function that prints a complete response, removes it from the list and removes its request.
+ *
+ * @param responses Pointer to the list of responses being received.
+ * @param response Pointer to the response.
+ *
+ * @return void
+ */
+void response_done(struct response** responses, struct response* response);
+
 /**
  * @brief Function that is responsible for disconnecting a client.
  *
@@ -0,0 +1,127 @@
+/**
+ * @file conn_registry.h
+ *
+ * @brief Header file corresponding to the conn_registry.c source file.
+ *
+ * @details Registry of the open connections of an event loop, an open addressed hash table keyed by
+ * the file descriptor of each connection. Adding and removing a connection is O(1), and a removed slot
+ * is left as a tombstone so the connections can be closed while they are iterated. Only the event loop
+ * adds and removes connections; the lock lets another thread iterate them to gather their metrics.
+ *
+ * @author Robledo, Valentín
+ * @date Mayo 2023
+ * @version 1.0
+ *
+ * @copyright Copyright (c) 2023
+ */
+
+#ifndef __CONN_REGISTRY_H__
+#define __CONN_REGISTRY_H__
+
+#include <stdint.h>
+#include "common.h"
+#include "metrics.h"
+
+/* Initial number of slots of the registry, always a power of two. */
+#define CONN_REGISTRY_SLOTS 64
+
+/* Descriptor of a slot never used. */
+#define REGISTRY_EMPTY -1
+
+/* Descriptor of a slot whose connection was removed, the lookups probe past it. */
+#define REGISTRY_TOMBSTONE -2
+
+struct connection;
+
+/**
+ * @struct registry_slot
+ *
+ * @brief Structure containing a slot of the registry.
+ *
+ * @param fd File descriptor (fd) of the connection, REGISTRY_EMPTY or REGISTRY_TOMBSTONE if there is none.
+ * @param conn Pointer to the connection, NULL if the slot is empty or a tombstone.
+ */
+typedef struct registry_slot
+{
+    int fd;
+    struct connection* conn;
+} registry_slot;
+
+/**
+ * @struct conn_registry
+ *
+ * @brief Structure containing the registry of the connections of an event loop.
+ *
+ * @param lock Mutex taken to change the slots, and by another thread to iterate them.
+ * @param slots Slots of the hash table.
+ * @param capacity Number of slots, a power of two.
+ * @param count Number of connections registered.
+ * @param used Number of slots used by a connection or a tombstone.
+ * @param closed Counters of the closed connections of each client type, added up when they are removed.
+ */
+typedef struct conn_registry
+{
+    pthread_mutex_t lock;
+    registry_slot* slots;
+    size_t capacity;
+    size_t count;
+    size_t used;
+    size_t closed[NUM_CLIENT_TYPES][NUM_COUNTERS];
+} conn_registry;
+
+/**
+ * @brief Function that initializes an empty registry.
+ *
+ * @param registry Pointer to the registry.
+ *
+ * @return void
+ */
+void conn_registry_init(conn_registry* registry);
+
+/**
+ * @brief Function that registers a connection, the table grows when three quarters of it are used.
+ *
+ * @param registry Pointer to the registry.
+ * @param fd File descriptor (fd) of the connection, not already registered.
+ * @param conn Pointer to the connection.
+ *
+ * @return void
+ */
+void conn_registry_add(conn_registry* registry, int fd, struct connection* conn);
+
+/**
+ * @brief Function that removes a connection, its slot is left as a tombstone.
+ *
+ * Its counters are added to the closed ones under the same lock, so a scrape counts them exactly once.
+ *
+ * @param registry Pointer to the registry.
+ * @param fd File descriptor (fd) of the connection.
+ * @param stats Pointer to the counters of the connection.
+ *
+ * @return void
+ */
+void conn_registry_remove(conn_registry* registry, int fd, conn_stats* stats);
+
+/**
+ * @brief Function that returns the next connection of an iteration.
+ *
+ * The current connection may be removed during the iteration, the others are not moved. The event loop
+ * iterates without the lock; another thread must hold it during the whole iteration.
+ *
+ * @param registry Pointer to the registry.
+ * @param index Pointer to the index of the iteration, 0 before the first call.
+ *
+ * @return struct connection* Pointer to the next connection, NULL once every one was returned.
+ */
+struct connection* conn_registry_next(conn_registry* registry, size_t* index);
+
+/**
+ * @brief Function that frees the slots of the registry, the connections must be already removed.
+ *
+ * @param registry Pointer to the registry.
+ *
+ * @return void
+ */
+void conn_registry_close(conn_registry* registry);
+
+#endif // __CONN_REGISTRY_H__
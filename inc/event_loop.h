@@ -0,0 +1,531 @@
+/**
+ * @file event_loop.h
+ *
+ * @brief Header file corresponding to the event_loop.c source file.
+ *
+ * @details Event loop built on epoll that owns the listening sockets and every client connection.
+ * The middleware protocol is driven for each connection as a non-blocking state machine, so an idle
+ * client costs no CPU time.
+ *
+ * @author Robledo, Valentín
+ * @date Mayo 2023
+ * @version 1.0
+ *
+ * @copyright Copyright (c) 2023
+ */
+
+#ifndef __EVENT_LOOP_H__
+#define __EVENT_LOOP_H__
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <limits.h>
+#include "middle.h"
+#include "thread_pool.h"
+#include "journal_cache.h"
+#include "sysinfo_sampler.h"
+#include "conn_registry.h"
+#ifdef HAVE_IO_URING
+#include "io_ring.h"
+#endif
+
+/* Maximum number of events returned by a single epoll_wait() call. */
+#define MAX_EVENTS 64
+
+/* Number of bytes read from a client socket on each recv() call. */
+#define READ_CHUNK_SIZE 16384
+
+/* Minimum milliseconds between two updates of a subscription. */
+#define SUBSCRIBE_MIN_INTERVAL 10
+
+/* Maximum number of subscriptions of a connection. */
+#define MAX_SUBSCRIPTIONS 16
+
+/* Size of the reply to a subscribe or unsubscribe request. */
+#define SUBSCRIBE_RESULT_SIZE 128
+
+/* Updates encoded on each round of the timer at most, one per metric and checksum algorithm. */
+#define MAX_PUSH_FRAMES (2 * 3)
+
+/* Maximum number of followed queries of a connection. */
+#define MAX_FOLLOWS 8
+
+/* Bytes of new entries pushed in each frame, the smallest packet size a client can negotiate. */
+#define FOLLOW_FRAME_SIZE PACKET_DATA_SIZE
+
+/* Bytes waiting to be sent to a follower above which the new entries are dropped for it. */
+#define FOLLOW_MAX_QUEUED (256 * 1024)
+
+/* Bytes of new entries read at a time, the next batch waits until some follower has room for it. */
+#define FOLLOW_BATCH_SIZE (64 * 1024)
+
+/* Data type representing what a file descriptor registered in epoll is. */
+typedef enum handle_t
+{
+    HANDLE_LISTENER,
+    HANDLE_CONNECTION,
+    HANDLE_NOTIFY,
+    HANDLE_SHUTDOWN,
+    HANDLE_JOURNAL,
+    HANDLE_TIMER,
+    HANDLE_FOLLOW
+} handle_t;
+
+/* Data type representing the metrics a client C can subscribe to. */
+typedef enum metric_t
+{
+    METRIC_FREERAM,
+    METRIC_LOADS
+} metric_t;
+
+/* Data type representing the state of a connection in the protocol. */
+typedef enum conn_state
+{
+    CONN_HANDSHAKE,
+    CONN_NEGOTIATE,
+    CONN_NUM_PACKETS,
+    CONN_PACKET_SIZE,
+    CONN_PACKET_BODY,
+    CONN_EXECUTING,
+    CONN_SENDING,
+    CONN_RECORD
+} conn_state;
+
+/**
+ * @struct handle
+ *
+ * @brief Structure stored in epoll for each registered file descriptor.
+ *
+ * @param type Type of file descriptor.
+ * @param fd File descriptor (fd).
+ */
+struct handle
+{
+    handle_t type;
+    int fd;
+};
+
+/**
+ * @struct response
+ *
+ * @brief Structure containing a response being sent, kept until every packet was acknowledged.
+ *
+ * The packet with sequence s uses the slot s % slots of packets, acked and chunks. A buffered response
+ * has a slot per packet, a streamed one only as many as the chunks its job may hand over at once.
+ *
+ * @param id Identifier of the request answered, on a pipelined connection.
+ * @param data Response, the encoded packets point into it. NULL for a streamed response.
+ * @param size Size of the response, or of the part handed over if it is streamed.
+ * @param packets Encoded packets of the response.
+ * @param packets_count Number of packets of the response, or handed over if it is streamed.
+ * @param packet_index Index of the first packet not yet acknowledged.
+ * @param next_packet Index of the next packet sent for the first time.
+ * @param acked Flags indicating which packets of the response were acknowledged.
+ * @param slots Number of slots.
+ * @param job Job streaming the response, NULL once it finished or if the response is buffered.
+ * @param chunks Chunks of a streamed response the encoded packets point into, NULL if it is buffered.
+ * @param complete Flag indicating that the last packet was handed over.
+ * @param frame_record Record sent before every frame, on a pipelined connection.
+ * @param started_ns Monotonic instant the response was started, in nanoseconds. Its send duration is measured from it.
+ * @param next Pointer to the next response.
+ */
+typedef struct response
+{
+    uint32_t id;
+    char* data;
+    size_t size;
+    encoded_packet* packets;
+    size_t packets_count;
+    size_t packet_index;
+    size_t next_packet;
+    u_int8_t* acked;
+    size_t slots;
+    struct job* job;
+    char** chunks;
+    int complete;
+    record_header frame_record;
+    uint64_t started_ns;
+    struct response* next;
+} response;
+
+/**
+ * @struct subscription
+ *
+ * @brief Structure containing a metric pushed to a client C on a timer, answering its subscribe request.
+ *
+ * @param conn Connection the updates are pushed to.
+ * @param id Identifier of the subscribe request, every update is pushed with it.
+ * @param metric Metric pushed.
+ * @param interval_ns Nanoseconds between two updates.
+ * @param due_ns Monotonic instant of the next update, in nanoseconds.
+ * @param next Pointer to the next subscription of the event loop.
+ */
+typedef struct subscription
+{
+    struct connection* conn;
+    uint32_t id;
+    metric_t metric;
+    uint64_t interval_ns;
+    uint64_t due_ns;
+    struct subscription* next;
+} subscription;
+
+/**
+ * @struct push_frame
+ *
+ * @brief Structure containing an update encoded once and pushed to every subscriber of the same metric and checksum.
+ *
+ * @param metric Metric of the update.
+ * @param checksum Checksum algorithm of the frame.
+ * @param size Size of the record and the frame.
+ * @param data Record header, rewritten for each subscriber, followed by the frame and its payload.
+ */
+typedef struct push_frame
+{
+    metric_t metric;
+    uint8_t checksum;
+    size_t size;
+    char data[sizeof(record_header) + sizeof(frame_header) + SYSINFO_RESULT_SIZE];
+} push_frame;
+
+/**
+ * @struct follower
+ *
+ * @brief Structure containing a connection that receives the new entries of a followed query, answering its follow request.
+ *
+ * @param conn Connection the entries are pushed to.
+ * @param id Identifier of the follow request, every push carries it.
+ * @param dropped Number of entries dropped since the last push, the follower is told before the next one.
+ * @param next Pointer to the next follower of the same query.
+ */
+typedef struct follower
+{
+    struct connection* conn;
+    uint32_t id;
+    size_t dropped;
+    struct follower* next;
+} follower;
+
+/**
+ * @struct follow_feed
+ *
+ * @brief Structure containing the journal reader of a followed query, shared by every follower with the same filters.
+ *
+ * @param handle Handle registered in epoll, its fd becomes readable when the journal changes.
+ * @param query Filters of the query, cleared before they were parsed so they are compared byte by byte.
+ * @param reader Reader positioned after the last entry pushed.
+ * @param backlog Flag indicating that there are new entries left to read once some follower has room.
+ * @param followers Pointer to the first follower.
+ * @param next Pointer to the next followed query.
+ */
+typedef struct follow_feed
+{
+    struct handle handle;
+    struct journal_query query;
+    journal_reader reader;
+    int backlog;
+    follower* followers;
+    struct follow_feed* next;
+} follow_feed;
+
+/**
+ * @struct follow_chunk
+ *
+ * @brief Structure containing a frame of new entries, encoded once per checksum algorithm for every follower.
+ *
+ * @param offset Offset of the frame in the new entries.
+ * @param length Length of the frame.
+ * @param entries Number of entries starting in the frame.
+ * @param encoded Record and frame encoded with each checksum algorithm, indexed by the algorithm, NULL until a follower uses it.
+ */
+typedef struct follow_chunk
+{
+    size_t offset;
+    size_t length;
+    size_t entries;
+    char* encoded[CHECKSUM_XXH3 + 1];
+} follow_chunk;
+
+/**
+ * @struct connection
+ *
+ * @brief Structure containing the state of a client connection.
+ *
+ * @param handle Handle registered in epoll.
+ * @param client_type Type of client.
+ * @param options Options negotiated with the client.
+ * @param compression Compression streams used with client B.
+ * @param state State of the connection in the protocol.
+ * @param in Bytes received and not yet processed.
+ * @param out Bytes waiting to be sent, they go out before the queue.
+ * @param queue Slices of the response waiting to be sent, sent without copying them.
+ * @param owned Memory owned by each slice of the queue, freed once it was sent, NULL if it is not owned.
+ * @param queue_head Index of the first slice not yet sent.
+ * @param queue_len Number of slices in the queue.
+ * @param queue_cap Capacity of the queue.
+ * @param events Events currently registered in epoll.
+ * @param num_packets Number of packets of the message being received.
+ * @param packets_received Number of packets of the message already received.
+ * @param json_size Size of the JSON packet or frame payload being received.
+ * @param frame Header of the binary frame being received.
+ * @param receiving Packets of the message received out of order, when a window is negotiated.
+ * @param command Message being received.
+ * @param responses Responses being sent, oldest first. Only a pipelined connection has more than one, the
+ * next one starts once every packet of the last one was sent for the first time.
+ * @param jobs Jobs executing the commands of the connection, NULL if there are none.
+ * @param ready Completed jobs of a pipelined connection waiting for the previous response to be sent.
+ * @param ready_last Pointer to the last job of ready.
+ * @param pending Number of requests of a pipelined connection not yet answered.
+ * @param subscriptions Number of subscriptions of the connection.
+ * @param follows Number of followed queries of the connection.
+ * @param flushing Flag indicating that the connection is in the list of connections sent at the end of the round.
+ * @param flush_next Pointer to the next connection sent at the end of the round.
+ * @param stats Counters of the connection.
+ */
+typedef struct connection
+{
+    struct handle handle;
+    client_t client_type;
+    handshake options;
+    compressor compression;
+    conn_state state;
+    buffer in;
+    buffer out;
+    struct iovec* queue;
+    void** owned;
+    size_t queue_head;
+    size_t queue_len;
+    size_t queue_cap;
+    uint32_t events;
+    size_t num_packets;
+    size_t packets_received;
+    size_t json_size;
+    frame_header frame;
+    receive_window receiving;
+    buffer command;
+    response* responses;
+    struct job* jobs;
+    struct job* ready;
+    struct job* ready_last;
+    size_t pending;
+    size_t subscriptions;
+    size_t follows;
+    int flushing;
+    struct connection* flush_next;
+    conn_stats stats;
+} connection;
+
+#ifdef HAVE_IO_URING
+/**
+ * @struct ring_send
+ *
+ * @brief Structure containing a send of a connection submitted to the io_uring instance of the event loop.
+ *
+ * @param conn Connection sending.
+ * @param size Bytes submitted.
+ * @param queue Flag indicating that the queued slices are sent, otherwise the out buffer.
+ * @param msg Message pointing to the queued slices.
+ */
+typedef struct ring_send
+{
+    connection* conn;
+    size_t size;
+    int queue;
+    struct msghdr msg;
+} ring_send;
+#endif
+
+/**
+ * @struct event_loop
+ *
+ * @brief Structure containing the event loop data.
+ *
+ * @param epoll_fd File descriptor (fd) of the epoll instance.
+ * @param listeners Handles of the listening sockets.
+ * @param num_listeners Number of listening sockets.
+ * @param listeners_paused Flag indicating that the listening sockets are not watched because the process ran out of file descriptors, they are watched again when a connection is closed.
+ * @param registry Registry of the open connections, keyed by their file descriptor.
+ * @param pool Thread pool that executes the commands.
+ * @param notify Handle of the eventfd written when a job is completed.
+ * @param shutdown Handle of the eventfd written when the server is closed.
+ * @param journal Handle of the file descriptor that becomes readable when the journal changes.
+ * @param cache Cache emptied when the journal advances, NULL if the journal is not watched.
+ * @param timer Handle of the timerfd armed for the next update of a subscription.
+ * @param sampler Sampler the subscriptions are read from, NULL if they are not served.
+ * @param subscriptions Pointer to the first subscription.
+ * @param pushes Number of updates pushed to the subscribers.
+ * @param push_encodes Number of updates encoded, each one is shared by the subscribers due at the same time.
+ * @param push_drops Number of updates dropped because the socket of the subscriber was full.
+ * @param feeds Pointer to the first followed query.
+ * @param closed_feeds Pointer to the first followed query closed during the round, they are freed at its end.
+ * @param follow_entries Number of new entries read by the followed queries.
+ * @param follow_pushes Number of frames of new entries pushed to the followers.
+ * @param follow_drops Number of entries dropped because a follower had too many bytes waiting to be sent.
+ * @param flushes Pointer to the first connection with bytes written during the round, they are sent at its end.
+ * @param send_calls Number of system calls made to send.
+ * @param ring io_uring instance the sends of a round are submitted through, its fd is -1 if it is not available.
+ * @param ring_sends Sends submitted to the io_uring instance, indexed by the user data of their entries.
+ * @param durations Histograms of the durations of each client type, indexed by duration_t.
+ * @param completed_lock Mutex protecting the list of completed jobs.
+ * @param completed Pointer to the first completed job.
+ * @param chunks Pointer to the first chunk of a streamed result handed over, protected by completed_lock.
+ * @param chunks_last Pointer to the last chunk handed over.
+ */
+typedef struct event_loop
+{
+    int epoll_fd;
+    struct handle listeners[3];
+    int num_listeners;
+    int listeners_paused;
+    conn_registry registry;
+    thread_pool* pool;
+    struct handle notify;
+    struct handle shutdown;
+    struct handle journal;
+    journal_cache* cache;
+    struct handle timer;
+    sysinfo_sampler* sampler;
+    subscription* subscriptions;
+    size_t pushes;
+    size_t push_encodes;
+    size_t push_drops;
+    follow_feed* feeds;
+    follow_feed* closed_feeds;
+    size_t follow_entries;
+    size_t follow_pushes;
+    size_t follow_drops;
+    connection* flushes;
+    size_t send_calls;
+#ifdef HAVE_IO_URING
+    io_ring ring;
+    ring_send ring_sends[IO_RING_ENTRIES];
+#endif
+    histogram durations[NUM_CLIENT_TYPES][NUM_DURATIONS];
+    pthread_mutex_t completed_lock;
+    struct job* completed;
+    struct chunk* chunks;
+    struct chunk* chunks_last;
+} event_loop;
+
+/**
+ * @brief Function that initializes the event loop.
+ *
+ * Creates the epoll instance and registers the listening sockets, the completion eventfd and the shutdown eventfd in it.
+ *
+ * @param loop Pointer to the event loop.
+ * @param listen_fds Listening sockets.
+ * @param num_listeners Number of listening sockets.
+ * @param pool Thread pool that executes the commands.
+ *
+ * @return Returns -1 if the initialization failed.
+ */
+int event_loop_init(event_loop* loop, const int* listen_fds, int num_listeners, thread_pool* pool);
+
+/**
+ * @brief Function that registers the journal watched by a cache in the event loop.
+ *
+ * Every time the journal changes, journal_cache_process() is called from the event loop.
+ *
+ * @param loop Pointer to the event loop.
+ * @param cache Pointer to the cache.
+ *
+ * @return Returns -1 if the journal could not be registered.
+ */
+int event_loop_watch(event_loop* loop, journal_cache* cache);
+
+/**
+ * @brief Function that serves the subscriptions of the clients C from a sampler.
+ *
+ * Registers a timerfd in the event loop. When it expires, the sampler is read once and the update is
+ * pushed to every subscriber that is due, encoded once for all of them.
+ *
+ * @param loop Pointer to the event loop.
+ * @param sampler Pointer to the sampler.
+ *
+ * @return Returns -1 if the timer could not be registered.
+ */
+int event_loop_publish(event_loop* loop, sysinfo_sampler* sampler);
+
+/**
+ * @brief Function that runs the event loop.
+ *
+ * Blocks in epoll_wait() until there is I/O on some socket. Accepts new clients and
+ * advances the state machine of every ready connection. Returns when event_loop_stop() is called.
+ *
+ * @param loop Pointer to the event loop.
+ *
+ * @return void
+ */
+void event_loop_run(event_loop* loop);
+
+/**
+ * @brief Function that hands a completed job back to its event loop.
+ *
+ * Called by the worker threads. The event loop is woken up through its eventfd.
+ *
+ * @param loop Pointer to the event loop.
+ * @param job Pointer to the job.
+ *
+ * @return void
+ */
+void event_loop_complete(event_loop* loop, struct job* job);
+
+/**
+ * @brief Function that hands a chunk of a streamed result to its event loop.
+ *
+ * Called by the worker threads, the chunks of a job are sent in the order they are handed over.
+ *
+ * @param loop Pointer to the event loop.
+ * @param chunk Pointer to the chunk.
+ *
+ * @return void
+ */
+void event_loop_stream(event_loop* loop, struct chunk* chunk);
+
+/**
+ * @brief Function that cancels the streamed jobs of every connection.
+ *
+ * Called before the thread pool is closed, so no worker keeps waiting for acknowledgements that will not arrive.
+ *
+ * @param loop Pointer to the event loop.
+ *
+ * @return void
+ */
+void event_loop_cancel(event_loop* loop);
+
+/**
+ * @brief Function that wakes the event loop up so that it returns.
+ *
+ * Only writes to the shutdown eventfd, so it can be called from a signal handler.
+ *
+ * @param loop Pointer to the event loop.
+ *
+ * @return void
+ */
+void event_loop_stop(event_loop* loop);
+
+/**
+ * @brief Function that adds the metrics of the event loop to a report.
+ *
+ * Called from another thread, the registry is locked while its connections are read.
+ *
+ * @param loop Pointer to the event loop.
+ * @param report Pointer to the report.
+ *
+ * @return void
+ */
+void event_loop_metrics(event_loop* loop, metrics_report* report);
+
+/**
+ * @brief Function that closes the event loop.
+ *
+ * Frees the completed jobs, closes every open connection and the epoll instance.
+ *
+ * @param loop Pointer to the event loop.
+ *
+ * @return void
+ */
+void event_loop_close(event_loop* loop);
+
+#endif // __EVENT_LOOP_H__
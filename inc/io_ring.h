@@ -0,0 +1,127 @@
+/**
+ * @file io_ring.h
+ *
+ * @brief Header file corresponding to the io_ring.c source file.
+ *
+ * @details Minimal io_uring instance built on the raw system calls, so the server does not depend on
+ * liburing. The event loop uses it to hand the sends of every connection over to the kernel in a
+ * single system call. Only built when the USE_IO_URING option of CMake is enabled.
+ *
+ * @author Robledo, Valentín
+ * @date Mayo 2023
+ * @version 1.0
+ *
+ * @copyright Copyright (c) 2023
+ */
+
+#ifndef __IO_RING_H__
+#define __IO_RING_H__
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <stdatomic.h>
+#include "common.h"
+
+/* Number of submission queue entries of each ring, the sends of a round are submitted in batches of this size. */
+#define IO_RING_ENTRIES 256
+
+/**
+ * @struct io_ring
+ *
+ * @brief Structure containing an io_uring instance and its mapped queues.
+ *
+ * @param fd File descriptor (fd) of the instance.
+ * @param sq_ring Mapping of the submission queue ring.
+ * @param sq_ring_size Size of the mapping of the submission queue ring.
+ * @param cq_ring Mapping of the completion queue ring, the same as sq_ring if the kernel maps both at once.
+ * @param cq_ring_size Size of the mapping of the completion queue ring.
+ * @param sqes Mapping of the submission queue entries.
+ * @param sq_tail Pointer to the tail of the submission queue, written by the server.
+ * @param sq_mask Mask of the indexes of the submission queue.
+ * @param sq_array Array of indexes of the submission queue entries.
+ * @param cq_head Pointer to the head of the completion queue, written by the server.
+ * @param cq_tail Pointer to the tail of the completion queue, written by the kernel.
+ * @param cq_mask Mask of the indexes of the completion queue.
+ * @param cqes Completion queue entries.
+ * @param entries Number of submission queue entries.
+ * @param queued Number of entries prepared and not yet submitted.
+ */
+typedef struct io_ring
+{
+    int fd;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe* sqes;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+    unsigned entries;
+    unsigned queued;
+} io_ring;
+
+/**
+ * @brief Function that creates the io_uring instance and maps its queues.
+ *
+ * @param ring Pointer to the ring.
+ * @param entries Number of submission queue entries.
+ *
+ * @return Returns -1 if io_uring is not available, errno tells why.
+ */
+int io_ring_init(io_ring* ring, unsigned entries);
+
+/**
+ * @brief Function that returns the next free submission queue entry, cleared.
+ *
+ * @param ring Pointer to the ring.
+ *
+ * @return struct io_uring_sqe* Entry to prepare, NULL if every entry is already prepared.
+ */
+struct io_uring_sqe* io_ring_get_sqe(io_ring* ring);
+
+/**
+ * @brief Function that submits the prepared entries and waits until all of them are completed.
+ *
+ * Only meant for requests that complete without waiting, such as sends with MSG_DONTWAIT, and the
+ * completion queue must be empty when it is called.
+ *
+ * @param ring Pointer to the ring.
+ *
+ * @return Returns the number of entries submitted, -1 if io_uring_enter() failed.
+ */
+int io_ring_submit(io_ring* ring);
+
+/**
+ * @brief Function that returns the next completion queue entry.
+ *
+ * @param ring Pointer to the ring.
+ *
+ * @return struct io_uring_cqe* Entry completed, NULL if there is none. It is valid until io_ring_seen() is called.
+ */
+struct io_uring_cqe* io_ring_peek(io_ring* ring);
+
+/**
+ * @brief Function that releases the completion queue entry returned by io_ring_peek().
+ *
+ * @param ring Pointer to the ring.
+ *
+ * @return void
+ */
+void io_ring_seen(io_ring* ring);
+
+/**
+ * @brief Function that unmaps the queues and closes the instance.
+ *
+ * @param ring Pointer to the ring.
+ *
+ * @return void
+ */
+void io_ring_close(io_ring* ring);
+
+#endif // __IO_RING_H__
@@ -0,0 +1,181 @@
+/**
+ * @file journal.h
+ *
+ * @brief Header file corresponding to the journal.c source file.
+ *
+ * @details In-process journal query engine built on sd-journal. Understands the most common journalctl
+ * options and formats the entries like "journalctl -o short", so the server does not need to spawn
+ * a shell and the journalctl binary for each query.
+ *
+ * @author Robledo, Valentín
+ * @date Mayo 2023
+ * @version 1.0
+ *
+ * @copyright Copyright (c) 2023
+ */
+
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include <time.h>
+#include <systemd/sd-journal.h>
+#include "middle.h"
+
+/* Maximum number of units accepted in a query. */
+#define JOURNAL_MAX_UNITS 8
+
+/* Maximum length of a unit name. */
+#define JOURNAL_UNIT_SIZE 256
+
+/* Maximum number of words in a command. */
+#define JOURNAL_MAX_TOKENS 64
+
+/* Value of since/until when the query has no time limit. */
+#define JOURNAL_NO_TIME 0
+
+/* Bytes of formatted entries gathered before they are handed to the sink of a streamed query. */
+#define JOURNAL_STREAM_BLOCK 65536
+
+/* Function that receives the formatted entries of a streamed query, it returns -1 to stop the query. */
+typedef int (*journal_sink)(void* arg, const char* data, size_t size);
+
+/**
+ * @struct journal_query
+ *
+ * @brief Structure containing the options of a journal query.
+ *
+ * @param units Units whose entries are shown (-u).
+ * @param num_units Number of units.
+ * @param priority_min Most important priority shown (-p FROM..TO), 0 by default.
+ * @param priority_max Least important priority shown (-p), -1 if there is no filter.
+ * @param lines Number of entries shown counting from the end (-n), -1 for all.
+ * @param since Realtime in microseconds of the first entry shown (--since), JOURNAL_NO_TIME for no limit.
+ * @param until Realtime in microseconds of the last entry shown (--until), JOURNAL_NO_TIME for no limit.
+ * @param boot_id Boot whose entries are shown (-b), empty for every boot.
+ * @param kernel Flag indicating that only kernel entries are shown (-k).
+ * @param reverse Flag indicating that the newest entries are shown first (-r).
+ */
+struct journal_query
+{
+    char units[JOURNAL_MAX_UNITS][JOURNAL_UNIT_SIZE];
+    int num_units;
+    int priority_min;
+    int priority_max;
+    long lines;
+    uint64_t since;
+    uint64_t until;
+    char boot_id[SD_ID128_STRING_MAX];
+    int kernel;
+    int reverse;
+};
+
+/**
+ * @struct journal_reader
+ *
+ * @brief Structure containing an open journal query.
+ *
+ * @param journal Journal handle.
+ * @param query Options of the query.
+ * @param remaining Number of entries left to read, -1 for no limit.
+ * @param positioned Flag indicating that the journal already points to the next entry to read.
+ */
+typedef struct journal_reader
+{
+    sd_journal* journal;
+    struct journal_query query;
+    long remaining;
+    int positioned;
+} journal_reader;
+
+/**
+ * @brief Function that parses a journalctl command line.
+ *
+ * Accepts -u, -p, -n, -S/--since, -U/--until, -b, -k, -r and ignores --no-pager and -q.
+ *
+ * @param command Options written by the client, without "journalctl".
+ * @param query Pointer where the options are written.
+ *
+ * @return Returns -1 if the command uses an option that is not supported.
+ */
+int journal_parse(const char* command, struct journal_query* query);
+
+/**
+ * @brief Function that splits a command in words, in place.
+ *
+ * Words are separated by spaces or tabs and can be quoted with single or double quotes.
+ *
+ * @param line Command to split, the words are written over it.
+ * @param tokens Array of JOURNAL_MAX_TOKENS pointers that receives the words.
+ *
+ * @return Returns the number of words, -1 if there are too many or a quote is not closed.
+ */
+int journal_split(char* line, char** tokens);
+
+/**
+ * @brief Function that opens the journal and positions it at the first entry of the query.
+ *
+ * @param reader Pointer to the reader.
+ * @param query Pointer to the options of the query.
+ *
+ * @return Returns a negative errno value if the journal could not be opened.
+ */
+int journal_reader_open(journal_reader* reader, const struct journal_query* query);
+
+/**
+ * @brief Function that opens the journal and positions it after its last entry, to read the entries written from now on.
+ *
+ * Only the filters of the query are used (-u, -p, -b, -k). The caller waits on the returned file descriptor,
+ * calls sd_journal_process() and reads the new entries with journal_reader_next().
+ *
+ * @param reader Pointer to the reader.
+ * @param query Pointer to the options of the query.
+ *
+ * @return Returns the file descriptor that becomes readable when the journal changes, a negative errno
+ * value if the journal could not be opened or watched.
+ */
+int journal_follow_open(journal_reader* reader, const struct journal_query* query);
+
+/**
+ * @brief Function that appends the next entry of the query to a buffer.
+ *
+ * @param reader Pointer to the reader.
+ * @param out Pointer to the buffer the formatted entry is appended to.
+ *
+ * @return Returns 1 if an entry was appended, 0 at the end of the query and a negative errno value on error.
+ */
+int journal_reader_next(journal_reader* reader, buffer* out);
+
+/**
+ * @brief Function that closes the journal of a reader.
+ *
+ * @param reader Pointer to the reader.
+ *
+ * @return void
+ */
+void journal_reader_close(journal_reader* reader);
+
+/**
+ * @brief Function that executes a journal query in process.
+ *
+ * @param command Options written by the client, without "journalctl".
+ *
+ * @return char* Formatted entries or an error message, NULL if the command is not supported
+ * and must be executed by journalctl.
+ */
+char* journal_query(const char* command);
+
+/**
+ * @brief Function that executes a journal query in process handing the entries over while they are read.
+ *
+ * The entries are handed in blocks of about JOURNAL_STREAM_BLOCK bytes, without the newline of the last
+ * one, so the concatenation is the same as the result of journal_query(). Errors are handed as a message.
+ *
+ * @param command Options written by the client, without "journalctl".
+ * @param sink Function that receives the entries.
+ * @param arg Argument passed to the sink.
+ *
+ * @return Returns -1 if the command is not supported and must be executed by journalctl.
+ */
+int journal_query_stream(const char* command, journal_sink sink, void* arg);
+
+#endif // __JOURNAL_H__
@@ -0,0 +1,219 @@
+/**
+ * @file journal_cache.h
+ *
+ * @brief Header file corresponding to the journal_cache.c source file.
+ *
+ * @details Cache of the results of the journal queries, keyed on the command split in words. It is
+ * bounded by bytes with LRU eviction, and every result is dropped when the journal advances or once
+ * it is older than JOURNAL_CACHE_TTL seconds. Identical queries executed at the same time are
+ * coalesced, only the first one is executed and the others wait for its result.
+ *
+ * @author Robledo, Valentín
+ * @date Mayo 2023
+ * @version 1.0
+ *
+ * @copyright Copyright (c) 2023
+ */
+
+#ifndef __JOURNAL_CACHE_H__
+#define __JOURNAL_CACHE_H__
+
+#include <time.h>
+#include <stdint.h>
+#include "journal.h"
+
+/* Number of buckets of the hash table of the cache. */
+#define JOURNAL_CACHE_BUCKETS 256
+
+/* Seconds a result is served from the cache, even if the journal did not advance. */
+#define JOURNAL_CACHE_TTL 10
+
+/* Maximum bytes of the cached results, unless -C is given. */
+#define JOURNAL_CACHE_SIZE (64 * 1024 * 1024)
+
+/* A result is only cached if it takes at most this fraction of the cache. */
+#define JOURNAL_CACHE_ENTRY_FRACTION 4
+
+/**
+ * @struct cache_entry
+ *
+ * @brief Structure containing a cached result.
+ *
+ * @param key Words of the command, each one ended by '\0'.
+ * @param key_size Size of the key.
+ * @param data Result of the command.
+ * @param size Size of the result.
+ * @param hash Hash of the key.
+ * @param generation Generation of the journal the result was read from.
+ * @param stored Instant the result was stored.
+ * @param prev Pointer to the previous entry, more recently used.
+ * @param next Pointer to the next entry, less recently used.
+ * @param chain Pointer to the next entry of the same bucket.
+ */
+typedef struct cache_entry
+{
+    char* key;
+    size_t key_size;
+    char* data;
+    size_t size;
+    uint32_t hash;
+    uint64_t generation;
+    struct timespec stored;
+    struct cache_entry* prev;
+    struct cache_entry* next;
+    struct cache_entry* chain;
+} cache_entry;
+
+/**
+ * @struct cache_flight
+ *
+ * @brief Structure containing a query being executed, the identical queries wait for its result.
+ *
+ * @param key Words of the command, each one ended by '\0'.
+ * @param key_size Size of the key.
+ * @param hash Hash of the key.
+ * @param data Result shared by the waiting queries, NULL if they must execute the command themselves.
+ * @param size Size of the result.
+ * @param done Flag indicating that the query finished.
+ * @param refs Number of queries using the flight, the executing one included.
+ * @param next Pointer to the next flight.
+ */
+typedef struct cache_flight
+{
+    char* key;
+    size_t key_size;
+    uint32_t hash;
+    char* data;
+    size_t size;
+    int done;
+    int refs;
+    struct cache_flight* next;
+} cache_flight;
+
+/**
+ * @struct journal_cache
+ *
+ * @brief Structure containing the cache of the journal queries.
+ *
+ * @param lock Mutex protecting the cache, it is used by every worker.
+ * @param flight_cond Condition variable signaled when a flight finished.
+ * @param flights Pointer to the first query being executed.
+ * @param buckets Hash table of the entries.
+ * @param head Pointer to the most recently used entry.
+ * @param tail Pointer to the least recently used entry.
+ * @param bytes Bytes of the cached results and keys.
+ * @param max_bytes Maximum bytes of the cached results and keys, 0 if the cache is disabled.
+ * @param generation Generation of the journal, incremented every time it advances.
+ * @param journal Journal watched to know when it advances, NULL if it could not be opened.
+ * @param hits Number of results served from the cache.
+ * @param misses Number of results not found in the cache.
+ * @param invalidations Number of times the journal advanced and the cache was emptied.
+ * @param evictions Number of results dropped to make room for others.
+ * @param coalesced Number of results received from an identical query executed at the same time.
+ */
+typedef struct journal_cache
+{
+    pthread_mutex_t lock;
+    pthread_cond_t flight_cond;
+    cache_flight* flights;
+    cache_entry* buckets[JOURNAL_CACHE_BUCKETS];
+    cache_entry* head;
+    cache_entry* tail;
+    size_t bytes;
+    size_t max_bytes;
+    uint64_t generation;
+    sd_journal* journal;
+    size_t hits;
+    size_t misses;
+    size_t invalidations;
+    size_t evictions;
+    size_t coalesced;
+} journal_cache;
+
+/**
+ * @brief Function that initializes the cache and opens the journal it watches.
+ *
+ * If the journal cannot be watched, the results are only dropped after JOURNAL_CACHE_TTL seconds.
+ *
+ * @param cache Pointer to the cache.
+ * @param max_bytes Maximum bytes of the cached results, 0 to disable the cache.
+ *
+ * @return void
+ */
+void journal_cache_init(journal_cache* cache, size_t max_bytes);
+
+/**
+ * @brief Function that returns the file descriptor that becomes readable when the journal changes.
+ *
+ * @param cache Pointer to the cache.
+ *
+ * @return Returns the file descriptor, -1 if the journal is not watched.
+ */
+int journal_cache_fd(journal_cache* cache);
+
+/**
+ * @brief Function that processes the changes of the journal, the cache is emptied if it advanced.
+ *
+ * Called by the event loop when the file descriptor of journal_cache_fd() is readable.
+ *
+ * @param cache Pointer to the cache.
+ *
+ * @return void
+ */
+void journal_cache_process(journal_cache* cache);
+
+/**
+ * @brief Function that builds the key of a command, its words each one ended by '\0'.
+ *
+ * @param command Options written by the client, without "journalctl".
+ * @param key Pointer to the buffer that receives the key.
+ *
+ * @return Returns -1 if the command cannot be split in words.
+ */
+int journal_cache_key(const char* command, buffer* key);
+
+/**
+ * @brief Function that looks a result up in the cache.
+ *
+ * If it is not cached but an identical query is being executed, waits for its result. Otherwise the
+ * caller executes the query, and the identical ones wait for it until journal_cache_put() is called.
+ *
+ * @param cache Pointer to the cache.
+ * @param key Pointer to the key of the command.
+ * @param size Pointer where the size of the result is stored.
+ * @param generation Pointer where the current generation of the journal is stored, it is passed to
+ * journal_cache_put() so a result read while the journal advanced is not stored.
+ * @param flight Pointer where the flight of the query is stored, NULL if the caller does not execute it
+ * on behalf of others.
+ *
+ * @return char* Copy of the result ended by '\0', NULL if the caller must execute the command.
+ */
+char* journal_cache_get(journal_cache* cache, const buffer* key, size_t* size, uint64_t* generation, cache_flight** flight);
+
+/**
+ * @brief Function that stores a result in the cache, evicting the least recently used ones if needed.
+ *
+ * A result larger than 1 / JOURNAL_CACHE_ENTRY_FRACTION of the cache is not stored. The queries waiting
+ * in the flight receive the result.
+ *
+ * @param cache Pointer to the cache.
+ * @param flight Pointer to the flight returned by journal_cache_get(), NULL if there is none.
+ * @param key Pointer to the key of the command.
+ * @param generation Generation returned by journal_cache_get() before the command was executed.
+ * @param data Result of the command, NULL if it was not gathered and the waiting queries must execute it.
+ * @param size Size of the result.
+ *
+ * @return void
+ */
+void journal_cache_put(journal_cache* cache, cache_flight* flight, const buffer* key, uint64_t generation, const char* data, size_t size);
+
+/**
+ * @brief Function that frees every cached result and closes the journal.
+ *
+ * @param cache Pointer to the cache.
+ *
+ * @return void
+ */
+void journal_cache_close(journal_cache* cache);
+
+#endif // __JOURNAL_CACHE_H__
@@ -0,0 +1,184 @@
+/**
+ * @file metrics.h
+ *
+ * @brief Header file corresponding to the metrics.c source file.
+ *
+ * @details Counters of every connection and histograms of the durations of every client type. The
+ * event loops update them with relaxed atomics, and a scrape gathers them in a report that is written
+ * in the Prometheus text format.
+ *
+ * @author Robledo, Valentín
+ * @date Mayo 2023
+ * @version 1.0
+ *
+ * @copyright Copyright (c) 2023
+ */
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include "common.h"
+#include "middle.h"
+
+/* Number of client types, the metrics are kept per type. */
+#define NUM_CLIENT_TYPES (CLIENT_C + 1)
+
+/* Number of buckets of the duration histograms, the last one is +Inf. */
+#define METRICS_BUCKETS 15
+
+/* Data type representing each counter of a connection. */
+typedef enum counter_t
+{
+    COUNTER_REQUESTS,
+    COUNTER_BYTES_RECEIVED,
+    COUNTER_BYTES_SENT,
+    COUNTER_PAYLOAD_BYTES,
+    COUNTER_ENCODED_BYTES,
+    COUNTER_RETRANSMITS,
+    NUM_COUNTERS
+} counter_t;
+
+/* Data type representing each duration measured per client type. */
+typedef enum duration_t
+{
+    DURATION_COMMAND,
+    DURATION_SEND,
+    NUM_DURATIONS
+} duration_t;
+
+/**
+ * @struct conn_stats
+ *
+ * @brief Structure containing the counters of a connection, updated by its event loop and read by any thread.
+ *
+ * @param client_type Type of client, -1 until the handshake.
+ * @param counters Counters of the connection, indexed by counter_t.
+ */
+typedef struct conn_stats
+{
+    atomic_int client_type;
+    atomic_size_t counters[NUM_COUNTERS];
+} conn_stats;
+
+/**
+ * @struct histogram
+ *
+ * @brief Structure containing a histogram of durations, updated by an event loop and read by any thread.
+ *
+ * @param buckets Number of durations of each bucket, not cumulative. The count is their sum, so it always
+ * matches the buckets of a scrape.
+ * @param sum_ns Sum of the durations, in nanoseconds.
+ */
+typedef struct histogram
+{
+    atomic_size_t buckets[METRICS_BUCKETS];
+    atomic_uint_least64_t sum_ns;
+} histogram;
+
+/**
+ * @struct histogram_counts
+ *
+ * @brief Structure containing a copy of one or more histograms added up.
+ *
+ * @param buckets Number of durations of each bucket, not cumulative.
+ * @param count Number of durations.
+ * @param sum_ns Sum of the durations, in nanoseconds.
+ */
+typedef struct histogram_counts
+{
+    size_t buckets[METRICS_BUCKETS];
+    size_t count;
+    uint64_t sum_ns;
+} histogram_counts;
+
+/**
+ * @struct conn_report
+ *
+ * @brief Structure containing a copy of the counters of an open connection.
+ *
+ * @param fd File descriptor (fd) of the connection.
+ * @param client_type Type of client.
+ * @param counters Counters of the connection, indexed by counter_t.
+ */
+typedef struct conn_report
+{
+    int fd;
+    int client_type;
+    size_t counters[NUM_COUNTERS];
+} conn_report;
+
+/**
+ * @struct metrics_report
+ *
+ * @brief Structure containing the metrics of the whole server gathered by a scrape.
+ *
+ * @param connections Number of open connections of each client type.
+ * @param counters Counters of each client type, the closed connections included.
+ * @param durations Histograms of each client type, indexed by duration_t.
+ * @param conns Counters of each open connection.
+ * @param num_conns Number of open connections reported.
+ * @param conns_cap Capacity of conns.
+ */
+typedef struct metrics_report
+{
+    size_t connections[NUM_CLIENT_TYPES];
+    size_t counters[NUM_CLIENT_TYPES][NUM_COUNTERS];
+    histogram_counts durations[NUM_CLIENT_TYPES][NUM_DURATIONS];
+    conn_report* conns;
+    size_t num_conns;
+    size_t conns_cap;
+} metrics_report;
+
+/**
+ * @brief Function that adds a duration to a histogram.
+ *
+ * @param hist Pointer to the histogram.
+ * @param ns Duration in nanoseconds.
+ *
+ * @return void
+ */
+void histogram_observe(histogram* hist, uint64_t ns);
+
+/**
+ * @brief Function that adds a histogram to the copy of a report.
+ *
+ * @param counts Pointer to the copy.
+ * @param hist Pointer to the histogram.
+ *
+ * @return void
+ */
+void histogram_collect(histogram_counts* counts, histogram* hist);
+
+/**
+ * @brief Function that adds an open connection to a report, its counters are added to its client type.
+ *
+ * @param report Pointer to the report.
+ * @param fd File descriptor (fd) of the connection.
+ * @param stats Pointer to the counters of the connection. A connection before the handshake is not reported.
+ *
+ * @return void
+ */
+void metrics_report_conn(metrics_report* report, int fd, conn_stats* stats);
+
+/**
+ * @brief Function that writes a report in the Prometheus text format.
+ *
+ * @param report Pointer to the report.
+ * @param out Pointer to the buffer the text is appended to.
+ *
+ * @return void
+ */
+void metrics_format(const metrics_report* report, buffer* out);
+
+/**
+ * @brief Function that frees the connections of a report.
+ *
+ * @param report Pointer to the report.
+ *
+ * @return void
+ */
+void metrics_report_free(metrics_report* report);
+
+#endif // __METRICS_H__
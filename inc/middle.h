@@ -17,11 +17,70 @@
 #define __MIDDLE_H__
 
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include "common.h"
+#include "checksum.h"
 
 /* Size of information packet. */
 #define PACKET_SIZE 4096
 
+/* Bytes of the message carried by each packet, the last byte of the packet is the string terminator. */
+#define PACKET_DATA_SIZE (PACKET_SIZE - 1)
+
+/* Maximum bytes of the message carried by each packet when a larger size is negotiated. */
+#define MAX_PACKET_DATA_SIZE (4 * 1024 * 1024)
+
+/* Magic number that starts the handshake. */
+#define HANDSHAKE_MAGIC 0x4D49444CU
+
+/* Version of the protocol. */
+#define PROTOCOL_VERSION 1
+
+/* Flag set in the client type when a handshake follows it. */
+#define CLIENT_NEGOTIATE 0x100
+
+/* Magic number that starts a binary frame. */
+#define FRAME_MAGIC 0xD47A
+
+/* Binary frame flag: last packet of the message. */
+#define FRAME_LAST 0x01
+
+/* Binary frame flag: the payload is compressed. */
+#define FRAME_COMPRESSED 0x02
+
+/* Number of packets in flight offered by default in the handshake. */
+#define DEFAULT_WINDOW_SIZE 32
+
+/* Maximum number of packets in flight. */
+#define MAX_WINDOW_SIZE 1024
+
+/* Handshake flag: several requests can be in flight on the connection, tagged with an identifier. */
+#define HANDSHAKE_PIPELINE 0x01
+
+/* Handshake flag: the journal output is sent while it is read, the number of packets is not known in advance. */
+#define HANDSHAKE_STREAM 0x02
+
+/* Number of packets announced for a streamed message, its end is marked by flag_last. */
+#define STREAM_PACKETS ((size_t)-1)
+
+/* Maximum number of requests of a pipelined connection waiting for their response. */
+#define MAX_PIPELINE_REQUESTS 256
+
+/* Enumeration representing the wire formats of the data packets. */
+typedef enum{
+    WIRE_JSON = 0x01,
+    WIRE_BINARY = 0x02
+} wire_format;
+
+/* Enumeration representing the records of a pipelined connection, each one starts with a record_header. */
+typedef enum{
+    RECORD_REQUEST = 1,
+    RECORD_RESPONSE,
+    RECORD_FRAME,
+    RECORD_ACK,
+    RECORD_PUSH
+} record_type;
+
 /* Enumeration representing the status of the checksum. */
 typedef enum{
     CHECKSUM_OK,
@@ -32,18 +91,218 @@ typedef enum{
  * @brief Estructura de paquete de datos.
  * 
  * @param data Arreglo de caracteres que representa la información.
+ * @param size Cantidad máxima de bytes de información, sin contar el terminador.
+ * @param length Cantidad de bytes de información.
  * @param crc_checksum Checksum de la información.
  * @param flag_last Flag que indica si es el último paquete.
+ * @param sequence Número de secuencia del paquete dentro del mensaje.
  * @param next Puntero al siguiente paquete.
  */
 typedef struct data_packet
 {
-    char data[PACKET_SIZE];
+    char* data;
+    size_t size;
+    size_t length;
     uLong crc_checksum;
     u_int8_t flag_last;
+    uint32_t sequence;
     struct data_packet* next;
 } data_packet;
 
+/**
+ * @struct packet_slice
+ *
+ * @brief Packet of a message described over the buffer of the message, so its payload is not copied.
+ *
+ * @param data Pointer to the first byte of the packet inside the message.
+ * @param length Number of bytes of the packet.
+ * @param sequence Sequence number of the packet within the message.
+ * @param crc_checksum Checksum of the packet.
+ * @param flag_last Flag indicating if it is the last packet.
+ */
+typedef struct packet_slice
+{
+    const char* data;
+    size_t length;
+    uint32_t sequence;
+    uLong crc_checksum;
+    u_int8_t flag_last;
+} packet_slice;
+
+/**
+ * @struct handshake
+ *
+ * @brief Structure exchanged after the client type to negotiate the protocol options.
+ *
+ * The client sends the options it supports and the server answers with the ones selected.
+ *
+ * @param magic HANDSHAKE_MAGIC.
+ * @param version Version of the protocol.
+ * @param wire_format Wire formats supported by the client (mask) or selected by the server.
+ * @param window Packets in flight offered by the client or selected by the server, 0 or 1 for stop-and-wait.
+ * Only used with binary frames.
+ * @param checksum Checksum algorithms supported by the client (mask) or selected by the server.
+ * @param flags HANDSHAKE_PIPELINE (only with binary frames) and HANDSHAKE_STREAM, offered by the client or granted by the server.
+ * @param reserved Reserved, sent as zero.
+ * @param packet_size Bytes of the message per packet, the largest accepted by the client or the one selected by the server.
+ */
+typedef struct handshake
+{
+    uint32_t magic;
+    uint8_t version;
+    uint8_t wire_format;
+    uint16_t window;
+    uint8_t checksum;
+    uint8_t flags;
+    uint8_t reserved[2];
+    uint32_t packet_size;
+} handshake;
+
+/**
+ * @struct frame_header
+ *
+ * @brief Header of a binary frame, sent in network byte order before the payload.
+ *
+ * @param magic FRAME_MAGIC.
+ * @param version Version of the protocol.
+ * @param flags FRAME_LAST and FRAME_COMPRESSED.
+ * @param length Size of the payload as sent.
+ * @param sequence Sequence number of the packet within the message.
+ * @param crc_checksum Checksum of the uncompressed payload.
+ */
+typedef struct frame_header
+{
+    uint16_t magic;
+    uint8_t version;
+    uint8_t flags;
+    uint32_t length;
+    uint32_t sequence;
+    uint32_t crc_checksum;
+} frame_header;
+
+/**
+ * @struct window_ack
+ *
+ * @brief Acknowledgement of a frame when a window is negotiated, sent in network byte order.
+ *
+ * @param next_sequence Cumulative acknowledgement, every packet before it was received intact.
+ * @param sequence Sequence number of the frame acknowledged.
+ * @param status Checksum status of the frame acknowledged, only that frame is sent again on CHECKSUM_FAIL.
+ */
+typedef struct window_ack
+{
+    uint32_t next_sequence;
+    uint32_t sequence;
+    uint32_t status;
+} window_ack;
+
+/**
+ * @struct record_header
+ *
+ * @brief Header of every record of a pipelined connection, the request identifier is sent in network byte order.
+ *
+ * RECORD_REQUEST is followed by a binary frame with the whole command, RECORD_RESPONSE by the number of
+ * packets of the response (uint32_t, network byte order), RECORD_FRAME by a binary frame of the response
+ * and RECORD_ACK by the window_ack of a frame of the request or response with that identifier.
+ * RECORD_PUSH is followed by a single binary frame with an update of the subscription opened by the
+ * request with that identifier, it is not acknowledged: a corrupt update is dropped, the next one replaces it.
+ *
+ * @param type Type of record.
+ * @param reserved Reserved, sent as zero.
+ * @param request_id Identifier of the request, chosen by the client.
+ */
+typedef struct record_header
+{
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t request_id;
+} record_header;
+
+/**
+ * @struct receive_window
+ *
+ * @brief Packets of a message received ahead of a packet that has to be sent again.
+ *
+ * The payloads are written straight into the message, only which ones arrived is kept here.
+ *
+ * @param filled Flags indicating which packets arrived, the packet with sequence s uses filled[s % size].
+ * @param size Number of packets in flight.
+ * @param next_sequence Sequence number of the first packet not yet received.
+ * @param algorithm Checksum algorithm of the packets.
+ * @param packet_size Bytes of the message per packet.
+ * @param lengths Lengths of the payloads of a streamed message, which is then written in a ring of size packets. NULL otherwise.
+ */
+typedef struct receive_window
+{
+    u_int8_t* filled;
+    uint32_t size;
+    uint32_t next_sequence;
+    checksum_algorithm algorithm;
+    uint32_t packet_size;
+    uint32_t* lengths;
+} receive_window;
+
+/**
+ * @struct encoded_packet
+ *
+ * @brief Data packet encoded in the negotiated wire format, ready to be sent.
+ *
+ * An uncompressed binary frame only owns its header, the payload is sent from the message itself.
+ *
+ * @param data Encoded packet, or frame header when the payload is sent from the message.
+ * @param size Size of data.
+ * @param payload Payload sent after data without being copied, NULL if it is inside data.
+ * @param payload_size Size of the payload sent after data.
+ * @param resend_offset Offset of data from which the packet is sent again after a CHECKSUM_FAIL.
+ */
+typedef struct encoded_packet
+{
+    char* data;
+    size_t size;
+    const char* payload;
+    size_t payload_size;
+    size_t resend_offset;
+} encoded_packet;
+
+/**
+ * @struct compressor
+ *
+ * @brief Compression streams of a connection, kept in memory and reused for every packet.
+ *
+ * Each compressed packet is a complete gzip member, so it can be decompressed on its own
+ * and a packet with a wrong checksum can be sent again.
+ *
+ * @param deflate Stream compressing the packets sent.
+ * @param inflate Stream decompressing the packets received.
+ * @param deflating Flag indicating that the deflate stream is initialized.
+ * @param inflating Flag indicating that the inflate stream is initialized.
+ */
+typedef struct compressor
+{
+    z_stream deflate;
+    z_stream inflate;
+    u_int8_t deflating;
+    u_int8_t inflating;
+} compressor;
+
+/**
+ * @struct buffer
+ *
+ * @brief Growable byte buffer.
+ *
+ * @param data Memory holding the bytes.
+ * @param len Number of bytes stored.
+ * @param off Offset of the first byte not yet consumed.
+ * @param cap Allocated capacity.
+ */
+typedef struct buffer
+{
+    char* data;
+    size_t len;
+    size_t off;
+    size_t cap;
+} buffer;
+
 /**
  * @brief Function that is responsible for sending a message.
  *
@@ -55,103 +314,267 @@ typedef struct data_packet
  * @param data Message to send.
  * @param client_type Type of client.
  * @param msg_type Type of message.
+ * @param options Negotiated protocol options.
+ * @param compression Compression streams of the connection.
  *
  * @note Function used by both clients and servers to communicate.
  *
  * @return void
  */
-void send_data(int client_socket, char* data, client_t client_type, msg_t msg_type);
+void send_data(int client_socket, char* data, client_t client_type, msg_t msg_type, const handshake* options, compressor* compression);
 
 /**
- * @brief Function that is responsible for sending an uncompressed message.
+ * @brief Function that is responsible for sending an encoded packet.
  *
- * First send the JSON packet size, then send the message and wait for a CHECKSUM_OK.
- * Otherwise, resend the message.
+ * Sends the packet and waits for a CHECKSUM_OK. Otherwise, sends the packet again.
  *
  * @param client_socket File descriptor (fd) of the client socket.
- * @param data_packet_json_string Data packet in JSON format.
+ * @param packet Pointer to the encoded packet.
  *
  * @return void
  */
-void send_raw_data(int client_socket, char* data_packet_json_string);
+void send_packet(int client_socket, const encoded_packet* packet);
 
 /**
- * @brief Function that is responsible for sending a compressed message.
+ * @brief Function that is responsible for sending the encoded packets of a message with a window.
  *
- * Calls the function that is responsible for creating a compressed file. Sends the size of the compressed file
- * and the size of the JSON packet. Then, sends the compressed file and waits for a CHECKSUM_OK.
- * Otherwise, sends the message again.
+ * Keeps up to window packets in flight and only sends again the packets acknowledged with CHECKSUM_FAIL.
  *
  * @param client_socket File descriptor (fd) of the client socket.
- * @param data_packet_json_string Data packet in JSON format.
+ * @param packets Encoded packets.
+ * @param num_packets Number of packets.
+ * @param window Number of packets in flight.
  *
  * @return void
  */
-void send_compress_data(int client_socket, char* data_packet_json_string);
+void send_window(int client_socket, const encoded_packet* packets, size_t num_packets, uint32_t window);
+
+/**
+ * @brief Function that sends an encoded packet with a single gather write.
+ *
+ * @param client_socket File descriptor (fd) of the client socket.
+ * @param packet Pointer to the encoded packet.
+ * @param offset Offset of the packet data from which it is sent.
+ *
+ * @return ssize_t Number of bytes sent or -1 on error.
+ */
+ssize_t send_encoded(int client_socket, const encoded_packet* packet, size_t offset);
+
+/**
+ * @brief Function that sends a record of a pipelined connection with a single gather write.
+ *
+ * @param client_socket File descriptor (fd) of the client socket.
+ * @param record Pointer to the record header.
+ * @param data Data sent after the header.
+ * @param size Size of data.
+ * @param payload Data sent after data, NULL if there is none.
+ * @param payload_size Size of payload.
+ *
+ * @return ssize_t Number of bytes sent or -1 on error.
+ */
+ssize_t send_record(int client_socket, const record_header* record, const void* data, size_t size, const void* payload, size_t payload_size);
+
+/**
+ * @brief Function that fills a record header.
+ *
+ * @param record Pointer to the record header.
+ * @param type Type of record.
+ * @param request_id Identifier of the request.
+ *
+ * @return void
+ */
+void record_format(record_header* record, record_type type, uint32_t request_id);
+
+/**
+ * @brief Function that encodes a data packet in the negotiated wire format.
+ *
+ * JSON: the size of the JSON packet followed by the JSON packet. If it is compressed, the size of the
+ * compressed data, the size of the JSON packet and the compressed data.
+ * Binary: a frame_header followed by the payload, compressed or not.
+ *
+ * @param packet Pointer to the packet.
+ * @param options Negotiated protocol options.
+ * @param compression Compression streams of the connection, NULL if the packet is not compressed.
+ *
+ * @return encoded_packet Encoded packet, its data must be freed and the message must outlive it.
+ */
+encoded_packet encode_packet(const packet_slice* packet, const handshake* options, compressor* compression);
+
+/**
+ * @brief Function that compresses data in gzip format.
+ *
+ * @param compression Compression streams of the connection.
+ * @param data Data to compress.
+ * @param size Size of the data.
+ * @param out Pointer to the buffer the compressed data is appended to.
+ *
+ * @return size_t Size of the compressed data.
+ */
+size_t compress_packet(compressor* compression, const char* data, size_t size, buffer* out);
+
+/**
+ * @brief Function that decompresses data in gzip format.
+ *
+ * @param compression Compression streams of the connection.
+ * @param compressed Compressed data.
+ * @param file_size Size of the compressed data.
+ * @param data Buffer where the data is decompressed.
+ * @param size Size of the buffer.
+ *
+ * @return size_t Size of the decompressed data.
+ */
+size_t decompress_packet(compressor* compression, const char* compressed, long file_size, char* data, size_t size);
+
+/**
+ * @brief Function that frees the compression streams of a connection.
+ *
+ * @param compression Compression streams of the connection.
+ *
+ * @return void
+ */
+void compressor_free(compressor* compression);
 
 /**
  * @brief Function that is responsible for receiving a message.
  *
  * First, receives the number of packets to be received to handle the loop.
  * Checks whether you are going to receive compressed or uncompressed data depending on the type of client and the type of message.
- * Once the message is received, it calls a function to verify the checksum.
- * Finally, it deformats the JSON and returns the received message.
+ * Once a packet is received, it calls a function to verify the checksum.
+ * Each payload is written at its offset in a single buffer, packet i starts at i * options->packet_size.
  *
  * @param client_socket File descriptor (fd) of the client socket.
  * @param client_type Client type.
  * @param message_type Message type.
+ * @param options Negotiated protocol options.
+ * @param compression Compression streams of the connection.
+ * @param stream File where a streamed message is written while it arrives, the message returned is then empty.
  *
  * @note Function used by both clients and the server to communicate.
  * @note If it receives a 0 as the number of packets, it means that the client disconnected and returns NULL.
  *
  * @return char* Message received.
  */
-char* receive_data(int client_socket, client_t client_type, msg_t message_type);
+char* receive_data(int client_socket, client_t client_type, msg_t message_type, const handshake* options, compressor* compression, FILE* stream);
+
+/**
+ * @brief Function that receives a streamed message and writes each packet as soon as the ones before it arrived.
+ *
+ * Only the packets of the window are kept, so the memory used does not depend on the size of the message.
+ *
+ * @param client_socket File descriptor (fd) of the client socket.
+ * @param options Negotiated protocol options.
+ * @param compression Compression streams of the connection, NULL if the packets are not compressed.
+ * @param stream File the message is written to.
+ *
+ * @return void
+ */
+void receive_stream(int client_socket, const handshake* options, compressor* compression, FILE* stream);
+
+/**
+ * @brief Function that is responsible for receiving a data packet.
+ *
+ * Receives the packet in the negotiated wire format and answers with the checksum status
+ * until the packet arrives intact.
+ *
+ * @param client_socket File descriptor (fd) of the client socket.
+ * @param options Negotiated protocol options.
+ * @param compression Compression streams of the connection, NULL if the packet is not compressed.
+ * @param packet Pointer to the data packet where the information is written.
+ *
+ * @return void
+ */
+void receive_packet(int client_socket, const handshake* options, compressor* compression, data_packet* packet);
+
+/**
+ * @brief Function that is responsible for receiving the packets of a message sent with a window.
+ *
+ * Answers each frame with a window_ack and writes each payload at its offset in the message.
+ *
+ * @param client_socket File descriptor (fd) of the client socket.
+ * @param num_packets Number of packets of the message.
+ * @param options Negotiated protocol options.
+ * @param compression Compression streams of the connection, NULL if the frames are not compressed.
+ * @param message Pointer to the buffer the message is written to.
+ *
+ * @return void
+ */
+void receive_window_data(int client_socket, size_t num_packets, const handshake* options, compressor* compression, buffer* message);
+
+/**
+ * @brief Function that is responsible for receiving a binary frame.
+ *
+ * @param client_socket File descriptor (fd) of the client socket.
+ * @param compression Compression streams of the connection, NULL if compressed frames are not expected.
+ * @param packet Pointer to the data packet where the information is written, longer payloads are rejected.
+ *
+ * @return void
+ */
+void receive_frame(int client_socket, compressor* compression, data_packet* packet);
 
 /**
  * @brief Function that is responsible for receiving a compressed message.
  *
- * Receives the size of the compressed file and the size of the JSON packet.
- * Receives the compressed file and copies it to a new file.
- * Decompresses the file to obtain the JSON packet.
+ * Receives the size of the compressed data and the size of the JSON packet.
+ * Receives the compressed data and decompresses it in memory to obtain the JSON packet.
  *
  * @param client_socket File descriptor (fd) of the client socket.
+ * @param compression Compression streams of the connection.
  *
  * @return char* Message in JSON format.
  */
-char* receive_compress_data(int client_socket);
+char* receive_compress_data(int client_socket, compressor* compression);
 
 /**
  * @brief Function that is responsible for packaging the message.
  *
- * Creates a list of packets to be sent.
+ * Describes the packets to be sent over the message, each one carrying up to PACKET_DATA_SIZE bytes.
  *
  * @param data Message to be packaged.
  * @param data_size Size of the message to be packaged.
  * @param num_packets Number of data packets.
+ * @param options Negotiated protocol options, they give the packet size and the checksum algorithm.
  *
- * @return data_packet* Pointer to the first data packet.
+ * @return packet_slice* Array of num_packets packets, it must be freed.
  */
-data_packet* data_packing(char* data, size_t data_size, size_t num_packets);
+packet_slice* data_packing(const char* data, size_t data_size, size_t num_packets, const handshake* options);
 
 /**
- * @brief Function that unpacks the message.
+ * @brief Function that returns the number of packets needed to send a message.
  *
- * @param packet Pointer to the first data packet.
- * @param num_packets Number of data packets.
+ * @param data_size Size of the message.
+ * @param options Negotiated protocol options.
  *
- * @return char* Unpacked message.
+ * @return size_t Number of packets.
  */
-char* data_unpacking(data_packet* packet, size_t num_packets);
+size_t packet_count(size_t data_size, const handshake* options);
 
 /**
- * @brief Function that formats a data packet to JSON.
+ * @brief Function that allocates the data of a packet.
  *
- * @param data_packet Pointer to the data packet.
+ * @param packet Pointer to the data packet.
+ * @param size Bytes of the message per packet.
+ *
+ * @return void
+ */
+void data_packet_init(data_packet* packet, size_t size);
+
+/**
+ * @brief Function that frees the data of a packet.
  *
- * @return char* Data packet in JSON format.
+ * @param packet Pointer to the data packet.
+ *
+ * @return void
+ */
+void data_packet_free(data_packet* packet);
+
+/**
+ * @brief Function that formats a packet to JSON.
+ *
+ * @param packet Pointer to the packet.
+ *
+ * @return char* Packet in JSON format.
  */
-char* json_format(data_packet* data_packet);
+char* json_format(const packet_slice* packet);
 
 /**
  * @brief Function that is responsible for unformatting a JSON data packet.
@@ -161,6 +584,124 @@ char* json_format(data_packet* data_packet);
  */
 void json_unformat(char* data_packet_json_string, data_packet* data_packet);
 
+/**
+ * @brief Function that fills a binary frame header in network byte order.
+ *
+ * @param header Pointer to the frame header.
+ * @param flags FRAME_LAST and FRAME_COMPRESSED.
+ * @param length Size of the payload as sent.
+ * @param sequence Sequence number of the packet within the message.
+ * @param crc_checksum Checksum of the uncompressed payload.
+ *
+ * @return void
+ */
+void frame_format(frame_header* header, uint8_t flags, uint32_t length, uint32_t sequence, uint32_t crc_checksum);
+
+/**
+ * @brief Function that converts a received binary frame header to host byte order and validates it.
+ *
+ * @param header Pointer to the frame header.
+ *
+ * @return Returns -1 if the magic number or the version are wrong.
+ */
+int frame_unformat(frame_header* header);
+
+/**
+ * @brief Function that sends the client type and negotiates the protocol options with the server.
+ *
+ * @param client_socket File descriptor (fd) of the client socket.
+ * @param client_type Type of client.
+ * @param offer Options supported by the client: wire formats and checksum algorithms (masks), window and packet size.
+ * @param options Pointer where the options selected by the server are written.
+ *
+ * @return Returns -1 if the negotiation failed.
+ */
+int handshake_send(int client_socket, client_t client_type, const handshake* offer, handshake* options);
+
+/**
+ * @brief Function that selects the protocol options answered to a client.
+ *
+ * The smaller window and packet size are selected, and the fastest checksum algorithm both support.
+ *
+ * @param offer Pointer to the handshake sent by the client.
+ * @param limits Options allowed by the server: wire formats and checksum algorithms (masks), maximum window and packet size.
+ * @param reply Pointer to the handshake answered to the client.
+ *
+ * @return Returns -1 if the handshake sent by the client is not valid.
+ */
+int handshake_select(const handshake* offer, const handshake* limits, handshake* reply);
+
+/**
+ * @brief Function that fills the protocol options used by a client that does not negotiate.
+ *
+ * @param options Pointer to the protocol options.
+ *
+ * @return void
+ */
+void handshake_default(handshake* options);
+
+/**
+ * @brief Function that returns the number of packets in flight of a connection.
+ *
+ * @param options Negotiated protocol options.
+ *
+ * @return uint32_t Number of packets in flight, 1 for stop-and-wait.
+ */
+uint32_t window_size(const handshake* options);
+
+/**
+ * @brief Function that fills a window acknowledgement in network byte order.
+ *
+ * @param ack Pointer to the acknowledgement.
+ * @param next_sequence Cumulative acknowledgement.
+ * @param sequence Sequence number of the frame acknowledged.
+ * @param status Checksum status of the frame acknowledged.
+ *
+ * @return void
+ */
+void window_ack_format(window_ack* ack, uint32_t next_sequence, uint32_t sequence, checksum_status status);
+
+/**
+ * @brief Function that initializes a receive window.
+ *
+ * @param window Pointer to the receive window.
+ * @param size Number of slots.
+ * @param options Negotiated protocol options, they give the checksum algorithm and the packet size.
+ *
+ * @return void
+ */
+void receive_window_init(receive_window* window, uint32_t size, const handshake* options);
+
+/**
+ * @brief Function that verifies the checksum of a packet and writes its payload at its offset in the message,
+ * or in its slot of the ring for a streamed message.
+ *
+ * @param window Pointer to the receive window.
+ * @param packet Pointer to the data packet received.
+ * @param message Pointer to the buffer the message is written to.
+ *
+ * @return checksum_status CHECKSUM_FAIL if the checksum is wrong or the packet is outside the window.
+ */
+checksum_status receive_window_store(receive_window* window, data_packet* packet, buffer* message);
+
+/**
+ * @brief Function that moves the receive window past the packets received in order.
+ *
+ * @param window Pointer to the receive window.
+ *
+ * @return uint32_t Number of packets the window moved.
+ */
+uint32_t receive_window_advance(receive_window* window);
+
+/**
+ * @brief Function that frees a receive window.
+ *
+ * @param window Pointer to the receive window.
+ *
+ * @return void
+ */
+void receive_window_free(receive_window* window);
+
 /**
  * @brief Function that is responsible for verifying the checksum of a data packet.
  *
@@ -168,28 +709,75 @@ void json_unformat(char* data_packet_json_string, data_packet* data_packet);
  *
  * @param aux Pointer to the data packet.
  * @param client_socket File descriptor (fd) of the client socket.
+ * @param algorithm Checksum algorithm of the packet.
  *
  * @return u_int8_t CHECKSUM_OK or CHECKSUM_FAIL.
  */
-u_int8_t checksum_check(data_packet* aux, int client_socket);
+u_int8_t checksum_check(data_packet* aux, int client_socket, checksum_algorithm algorithm);
 
 /**
- * @brief Function that creates a compressed file.
+ * @brief Function that verifies the checksum of a data packet without answering.
  *
- * @param data_packet_json_string Data packet in JSON format.
+ * @param packet Pointer to the data packet.
+ * @param algorithm Checksum algorithm of the packet.
+ *
+ * @return checksum_status CHECKSUM_OK or CHECKSUM_FAIL.
+ */
+checksum_status checksum_verify(data_packet* packet, checksum_algorithm algorithm);
+
+/**
+ * @brief Function that makes room in a buffer for at least size more bytes.
+ *
+ * @param buf Pointer to the buffer.
+ * @param size Number of bytes to reserve.
+ *
+ * @return void
+ */
+void buffer_reserve(buffer* buf, size_t size);
+
+/**
+ * @brief Function that appends bytes at the end of a buffer.
+ *
+ * @param buf Pointer to the buffer.
+ * @param data Bytes to append.
+ * @param size Number of bytes to append.
+ *
+ * @return void
+ */
+void buffer_append(buffer* buf, const void* data, size_t size);
+
+/**
+ * @brief Function that writes bytes at an offset from the start of a buffer, growing it if needed.
+ *
+ * @param buf Pointer to the buffer.
+ * @param offset Offset where the bytes are written.
+ * @param data Bytes to write.
+ * @param size Number of bytes to write.
+ *
+ * @return void
+ */
+void buffer_write_at(buffer* buf, size_t offset, const void* data, size_t size);
+
+/**
+ * @brief Function that marks bytes at the start of a buffer as consumed.
+ *
+ * When every byte is consumed the buffer is rewound so its memory is reused.
+ *
+ * @param buf Pointer to the buffer.
+ * @param size Number of bytes consumed.
  *
  * @return void
  */
-void create_file(char* data_packet_json_string);
+void buffer_consume(buffer* buf, size_t size);
 
 /**
- * @brief Function that frees the memory used by the data packet list.
+ * @brief Function that frees the memory used by a buffer.
  *
- * @param first_packet Pointer to the first data packet.
+ * @param buf Pointer to the buffer.
  *
  * @return void
  */
-void free_package_list(data_packet* first_packet);
+void buffer_free(buffer* buf);
 
 /**
  * @brief Function that handles an error when using the send() function.
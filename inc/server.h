@@ -15,16 +15,42 @@
 #ifndef __SERVER_H__
 #define __SERVER_H__
 
-#include <sys/sysinfo.h>
-#include <systemd/sd-journal.h>
+#include <sys/wait.h>
+#include <spawn.h>
+#include <poll.h>
 #include "middle.h"
+#include "journal.h"
 #include "server_utils.h"
+#include "event_loop.h"
+#include "journal_cache.h"
+#include "sysinfo_sampler.h"
 
-/* Path to the output file of the journalctl execution */
-#define JOURNAL_TMP_OUTPUT "/tmp/journal_output"
+/* Maximum bytes of the message per packet on the unix socket, unless -P is given. */
+#define UNIX_PACKET_SIZE (256 * 1024)
 
-/* Path to the error file of the journalctl execution */
-#define JOURNAL_TMP_ERROR "/tmp/journal_error"
+/* Maximum bytes of the message per packet on the ipv4 and ipv6 sockets, unless -P is given. */
+#define INET_PACKET_SIZE (64 * 1024)
+
+/* Length of the queue of pending connections of each listening socket, unless -B is given. */
+#define LISTEN_BACKLOG SOMAXCONN
+
+/* Maximum number of event loops, each one with its own ipv4 and ipv6 sockets. */
+#define MAX_SHARDS 64
+
+/* Path of the unix socket the metrics are scraped from, unless -M is given. */
+#define METRICS_SOCKET_PATH "/tmp/metrics_socket"
+
+/* Maximum bytes of a scrape request read, the rest is ignored. */
+#define METRICS_REQUEST_SIZE 4096
+
+/* Seconds a scrape may take to send its request or to read the answer before it is dropped. */
+#define METRICS_TIMEOUT 2
+
+/* Answer to a follow command on a connection without pipelining, the entries could not be pushed. */
+#define FOLLOW_PIPELINE_ERROR "Error: el seguimiento del journal requiere una conexión con pipelining (-p)."
+
+/* Flag indicating that a journalctl command is a follow or unfollow request. */
+#define IS_FOLLOW_COMMAND(command) (!strcmp(command, "follow") || !strncmp(command, "follow ", 7) || !strcmp(command, "unfollow"))
 
 /**
  * @def GET_CLIENT_TYPE_LETTER
@@ -43,21 +69,120 @@
  * @brief Structure containing server data.
  *
  * @param unix_socket_path UNIX socket path.
- * @param unix_socket_fd UNIX socket file descriptor (fd).
- * @param ipv4_socket_fd IPV4 socket file descriptor (fd).
- * @param ipv6_socket_fd IPV6 socket file descriptor (fd).
+ * @param unix_socket_fd UNIX socket file descriptor (fd), shared by every shard.
+ * @param metrics_socket_path Path of the UNIX socket the metrics are scraped from, NULL until this server bound it.
+ * @param metrics_socket_fd File descriptor (fd) of the metrics socket, -1 if it is not open.
  */
-struct
+struct server
 {
     char *unix_socket_path;
     int unix_socket_fd;
+    char *metrics_socket_path;
+    int metrics_socket_fd;
+};
+
+/**
+ * @struct shard
+ *
+ * @brief Structure containing an event loop and the listening sockets it owns.
+ *
+ * The ipv4 and ipv6 sockets of every shard are bound to the same ports with SO_REUSEPORT, so the kernel
+ * spreads the new connections among them.
+ *
+ * @param loop Event loop of the shard.
+ * @param ipv4_socket_fd IPV4 socket file descriptor (fd) of the shard.
+ * @param ipv6_socket_fd IPV6 socket file descriptor (fd) of the shard.
+ */
+struct shard
+{
+    event_loop loop;
     int ipv4_socket_fd;
     int ipv6_socket_fd;
-} server;
+};
+
+/**
+ * @struct server_config
+ *
+ * @brief Structure containing the server options given on the command line.
+ *
+ * @param workers Number of threads executing commands, 0 for one per online core.
+ * @param wire_formats Wire formats offered to the clients (WIRE_JSON | WIRE_BINARY).
+ * @param window Maximum number of packets in flight per connection, 1 for stop-and-wait.
+ * @param checksums Checksum algorithms offered to the clients, crc32 is used when none is shared.
+ * @param packet_size Maximum bytes of the message per packet, 0 for the default of the socket family.
+ * @param cache_size Maximum bytes of the cached journal results, 0 to disable the cache.
+ * @param sysinfo_interval Milliseconds between two samples of sysinfo, 0 to sample every request.
+ * @param shards Number of event loops, each one run by its own thread.
+ * @param backlog Length of the queue of pending connections of each listening socket.
+ * @param metrics_path Path of the UNIX socket the metrics are scraped from, empty to not serve them.
+ */
+struct server_config
+{
+    int workers;
+    uint8_t wire_formats;
+    uint16_t window;
+    uint8_t checksums;
+    uint32_t packet_size;
+    size_t cache_size;
+    unsigned long sysinfo_interval;
+    int shards;
+    int backlog;
+    const char* metrics_path;
+};
+
+/**
+ * @struct stream_fill
+ *
+ * @brief Structure containing the output of a streamed command gathered to store it in the cache.
+ *
+ * While it may fit in the cache, the output is handed over only as far as the client has room for it and
+ * the rest is gathered ahead, so the query runs at its own pace and the identical queries waiting for it
+ * never wait on the acknowledgements of the client. The rest is handed over once the output is complete
+ * or too large to be cached.
+ *
+ * @param job Job the output is handed to.
+ * @param data Output gathered, freed once it is too large to be cached.
+ * @param sent Bytes of data already handed over.
+ * @param cacheable Flag indicating that the output is still being gathered.
+ * @param flight Flight of the query, NULL once it was finished or if there is none.
+ * @param key Key of the query in the cache.
+ * @param generation Generation of the cache the query started in.
+ */
+struct stream_fill
+{
+    struct job* job;
+    buffer data;
+    size_t sent;
+    int cacheable;
+    cache_flight* flight;
+    const buffer* key;
+    uint64_t generation;
+};
 
-volatile sig_atomic_t server_flag;
-pthread_mutex_t lock;
-struct timeval timeout;
+extern struct server server;
+extern struct server_config server_config;
+extern volatile sig_atomic_t server_flag;
+
+/**
+ * @brief Function that parses the command line options of the server.
+ *
+ * -w <n>: Number of threads executing commands.
+ * -j: Only JSON packets are used, the binary frames are not offered to the clients.
+ * -W <n>: Maximum number of packets in flight per connection.
+ * -c <name>: Only the checksum algorithm given (crc32, crc32c or xxh3) is offered to the clients.
+ * -P <n>: Maximum bytes of the message per packet.
+ * -C <n>: Megabytes of the cache of journal results, 0 to disable it.
+ * -s <n>: Milliseconds between two samples of sysinfo, 0 to sample every request.
+ * -S <n>: Number of event loops, 0 for one per online core.
+ * -B <n>: Length of the queue of pending connections of each listening socket.
+ * -M <path>: Path of the UNIX socket the metrics are scraped from, an empty path to not serve them.
+ *
+ * @param argc Number of arguments.
+ * @param argv Arguments.
+ *
+ * @return void
+ */
+void parse_arguments(int argc, char* argv[]);
 
 /**
  * @brief Function that initializes the server.
@@ -69,117 +194,118 @@ struct timeval timeout;
 void server_init();
 
 /**
- * @brief Function that creates the UNIX socket.
+ * @brief Function that is responsible for creating an IPV4 socket.
  *
- * @param socket_path UNIX socket path.
+ * It is bound with SO_REUSEPORT, every shard creates its own one on the same port.
  *
- * @return Returns if the connection failed.
+ * @param socket_port Port of the IPV4 socket.
+ *
+ * @return Returns the socket, -1 if it could not be created.
  */
 int create_ipv4_socket(const uint16_t socket_port);
 
 /**
- * @brief Function that is responsible for creating the IPV4 socket.
+ * @brief Function that is responsible for creating an IPV6 socket.
  *
- * @param socket_port Port of the IPV4 socket.
+ * It is bound with SO_REUSEPORT, every shard creates its own one on the same port.
  *
- * @return Returns if the connection failed.
+ * @param socket_port Port of the IPV6 socket.
+ *
+ * @return Returns the socket, -1 if it could not be created.
  */
 int create_ipv6_socket(const uint16_t socket_port);
 
 /**
- * @brief Function that is responsible for creating the IPV6 socket.
+ * @brief Function that creates the UNIX socket.
  *
- * @param socket_port Port of the IPV6 socket.
+ * @param socket_path UNIX socket path.
  *
  * @return Returns if the connection failed.
  */
 int create_unix_socket(const char *socket_path);
 
 /**
- * @brief Function that waits for a client to connect.
+ * @brief Function that creates the UNIX socket the metrics are scraped from.
  *
- * Every certain timeout it checks if the server is closed. When a client connects,
- * a thread is created to handle it.
+ * Each connection is answered with an HTTP response holding the metrics in the Prometheus text format.
+ * A path that already exists is not removed, the server then runs without metrics.
  *
- * @return void
- */
-void wait_client();
-
-/**
- * @brief Function that is responsible for creating a thread to serve a client.
+ * @param socket_path UNIX socket path.
  *
- * @param client_socket File descriptor (fd) of the client socket.
+ * @return Returns -1 if the socket could not be created.
  */
-void create_thread(int client_socket);
+int create_metrics_socket(const char *socket_path);
 
 /**
- * @brief Function that handles the client.
+ * @brief Function that is responsible for selecting the response for the client.
  *
- * The type of client that connected is received. The thread is added to the thread list.
- * And the function that handles the server logic is called.
+ * Calls the function that is responsible for executing the command according to the type of client.
+ * Journalctl for client A and B. Sysinfo for client C.
  *
- * @param arg Pointer to the parameter.
+ * @param client_type Type of client.
+ * @param command Command sent by the client.
  *
- * @return void*
+ * @return char* Command response.
  */
-void *thread_client_handler(void* arg);
+char* client_select(client_t client_type, char* command);
 
 /**
- * @brief Function that handles the server logic.
+ * @brief Function that executes the journalctl command of a streamed job.
  *
- * Waits to detect an incoming message from the connected client and checks if the client disconnects.
- * If a message is detected, it calls the function that is responsible for receiving this message and then
- * responding. If the client disconnects, the thread is removed from the list and returns.
- * In addition, every certain timeout it checks if the server is closed.
+ * The entries read with sd-journal, or the output of the journalctl binary, are handed to the
+ * event loop while they are read.
  *
- * @param client_socket File descriptor (fd) of the client socket.
- * @param read_fds Set of file descriptors (fd) of the client.
- * @param client_type Type of client.
+ * @param job Pointer to the job.
  *
  * @return void
  */
-void server_logic(int client_socket, fd_set read_fds, client_t client_type);
+void client_stream(struct job* job);
 
 /**
- * @brief Function that is responsible for selecting the response for the client.
+ * @brief Function that executes the journalctl command.
  *
- * This function sends a warning message to the client. Then it calls the function that is responsible for
- * executing the command according to the type of client. Journalctl for client A and B. Sysinfo for client C.
- * Once the response is obtained, it calls the function that is responsible for sending the message.
+ * The query is read in process with sd-journal. Only if it uses an option the query engine
+ * does not understand, the journalctl binary is executed.
  *
- * @param client_tsocket File descriptor (fd) of the client socket.
- * @param client_type Type of client.
  * @param command Command sent by the client.
  *
- * @return void
+ * @return char* Command response.
  */
-void client_select(int client_tsocket, client_t client_type, char* command);
+char* journalctl_execute(char* command);
 
 /**
- * @brief Function that executes the journalctl command.
+ * @brief Function that executes the journalctl binary handing its output over while it is read.
  *
- * @param command Command sent by the client.
- * @param client_fd File descriptor (fd) of the client socket.
+ * The binary is started with posix_spawnp(), without a shell, and its output and errors are read
+ * from two pipes. The errors are only handed over when there is no output, without the newline at
+ * the end, like the output.
  *
- * @return char* Command response.
+ * @param command Options written by the client, split in words like a journal query.
+ * @param sink Function that receives the output, journalctl is terminated if it returns -1.
+ * @param arg Argument passed to the sink.
+ *
+ * @return void
  */
-char* journalctl_execute(char* command, int client_fd);
+void journalctl_spawn(char* command, journal_sink sink, void* arg);
 
 /**
  * @brief Function that executes the sysinfo command.
  *
+ * The result is copied from the shared snapshot, sampled at most once per interval.
+ *
  * @param command Command sent by the client.
  *
  * @return char* Command response.
  *
- * @note Only accepts the "freeram" and "loads" commands.
+ * @note Only accepts the "freeram", "loads" and "sampling" commands, the last one shows the
+ * sampling interval and how old the snapshot is.
  */
 char* sysinfo_execute(char* command);
 
 /**
  * @brief Function that handles the SIGINT signal.
  *
- * Lowers the server flag and calls the function that closes it.
+ * Lowers the server flag and wakes the event loop up through its shutdown eventfd, so it returns.
  *
  * @return void
  */
@@ -188,7 +314,7 @@ void sigint_handler();
 /**
  * @brief Function that handles closing the server.
  *
- * Calls the function that handles ending threads, destroys the mutex, and closes the socket.
+ * Closes the thread pool and the event loop with every client connection, and closes the sockets.
  *
  * @return void
  */
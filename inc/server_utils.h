@@ -13,6 +13,8 @@
 #ifndef __SERVER_UTILS_H__
 #define __SERVER_UTILS_H__
 
+#include <stdint.h>
+#include <time.h>
 #include "common.h"
 
 /**
@@ -61,11 +63,11 @@ void rmv_thread(pthread_t tid);
 void end_threads();
 
 /**
- * @brief Function that is responsible for reading a file.
+ * @brief Function that returns the monotonic time in nanoseconds, the clock of every deadline and duration of the server.
  *
- * @param file_name Name of the file.
- * @return Returns a pointer to the contents of the file.
+ * @return uint64_t Current instant in nanoseconds.
  */
-char* read_file(const char* file_name);
+uint64_t monotonic_ns(void);
+
 
 #endif // __SERVER_UTILS_H__
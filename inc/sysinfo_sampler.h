@@ -0,0 +1,102 @@
+/**
+ * @file sysinfo_sampler.h
+ *
+ * @brief Header file corresponding to the sysinfo_sampler.c source file.
+ *
+ * @details Snapshot of sysinfo() shared by every Client C request. It is sampled at most once per
+ * interval and read without locks through a sequence counter, so a burst of requests does not make
+ * a system call nor format a string each.
+ *
+ * @author Robledo, Valentín
+ * @date Mayo 2023
+ * @version 1.0
+ *
+ * @copyright Copyright (c) 2023
+ */
+
+#ifndef __SYSINFO_SAMPLER_H__
+#define __SYSINFO_SAMPLER_H__
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/sysinfo.h>
+#include "common.h"
+#include "server_utils.h"
+
+/* Size of each formatted result of the snapshot. */
+#define SYSINFO_RESULT_SIZE 60
+
+/* Milliseconds between two samples, unless -s is given. */
+#define SYSINFO_INTERVAL 1000
+
+/**
+ * @struct sysinfo_snapshot
+ *
+ * @brief Structure containing the results of a sample, already formatted.
+ *
+ * @param freeram Result of the "freeram" command.
+ * @param loads Result of the "loads" command.
+ * @param taken_ns Instant the sample was taken, from monotonic_ns().
+ */
+typedef struct sysinfo_snapshot
+{
+    char freeram[SYSINFO_RESULT_SIZE];
+    char loads[SYSINFO_RESULT_SIZE];
+    uint64_t taken_ns;
+} sysinfo_snapshot;
+
+/**
+ * @struct sysinfo_sampler
+ *
+ * @brief Structure containing the shared snapshot and how it is refreshed.
+ *
+ * @param sequence Sequence counter of the snapshot, odd while it is being written.
+ * @param snapshot Last sample.
+ * @param interval_ns Nanoseconds a sample is served before it is refreshed, 0 to sample every request.
+ * @param refresh_lock Mutex taken by the request that refreshes the snapshot, the others do not wait for it.
+ * @param samples Number of samples taken.
+ * @param reads Number of requests served from the snapshot.
+ */
+typedef struct sysinfo_sampler
+{
+    atomic_uint sequence;
+    sysinfo_snapshot snapshot;
+    uint64_t interval_ns;
+    pthread_mutex_t refresh_lock;
+    atomic_size_t samples;
+    atomic_size_t reads;
+} sysinfo_sampler;
+
+/**
+ * @brief Function that initializes the sampler and takes the first sample.
+ *
+ * @param sampler Pointer to the sampler.
+ * @param interval_ms Milliseconds between two samples, 0 to sample every request.
+ *
+ * @return void
+ */
+void sysinfo_sampler_init(sysinfo_sampler* sampler, unsigned long interval_ms);
+
+/**
+ * @brief Function that copies the snapshot, refreshing it first if it is older than the interval.
+ *
+ * Only one request refreshes an old snapshot, the ones arriving meanwhile copy the previous sample.
+ *
+ * @param sampler Pointer to the sampler.
+ * @param snapshot Pointer where the snapshot is copied.
+ *
+ * @return void
+ */
+void sysinfo_sampler_read(sysinfo_sampler* sampler, sysinfo_snapshot* snapshot);
+
+/**
+ * @brief Function that frees the resources of the sampler.
+ *
+ * @param sampler Pointer to the sampler.
+ *
+ * @return void
+ */
+void sysinfo_sampler_close(sysinfo_sampler* sampler);
+
+#endif // __SYSINFO_SAMPLER_H__
@@ -0,0 +1,262 @@
+/**
+ * @file thread_pool.h
+ *
+ * @brief Header file corresponding to the thread_pool.c source file.
+ *
+ * @details Fixed-size pool of worker threads that executes the commands sent by the clients.
+ * The event loop submits jobs to a queue and the workers hand the results back to it.
+ *
+ * @author Robledo, Valentín
+ * @date Mayo 2023
+ * @version 1.0
+ *
+ * @copyright Copyright (c) 2023
+ */
+
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <time.h>
+#include "common.h"
+#include "middle.h"
+
+/* Seconds a streamed job waits for an acknowledgement with every chunk in flight before it gives up on the client. */
+#define STREAM_STALL_TIMEOUT 10
+
+struct event_loop;
+struct connection;
+
+/**
+ * @struct job
+ *
+ * @brief Structure representing a command waiting to be executed or already executed.
+ *
+ * @param loop Event loop the result is handed back to.
+ * @param conn Connection that sent the command, NULL if it was closed meanwhile.
+ * @param client_type Type of client.
+ * @param request_id Identifier of the request on a pipelined connection.
+ * @param command Command sent by the client.
+ * @param result Command response.
+ * @param enqueued Instant the job was queued.
+ * @param exec_ns Nanoseconds the command took to execute, streamed chunks included.
+ * @param next Pointer to the next job.
+ * @param sibling Pointer to the next job of the same connection not yet completed.
+ * @param stream Flag indicating that the result is handed to the event loop in chunks while it is produced.
+ * @param stream_lock Mutex protecting chunks_in_flight and cancelled.
+ * @param stream_cond Condition variable signaled when a chunk was acknowledged or the stream was cancelled.
+ * @param chunk_size Size of every chunk but the last one, the packet size of the connection.
+ * @param max_chunks Maximum number of chunks handed over and not yet acknowledged.
+ * @param chunks_in_flight Number of chunks handed over and not yet acknowledged.
+ * @param cancelled Flag indicating that the connection was closed and the stream must stop.
+ * @param stalled Flag indicating that the stream was stopped because the client acknowledged nothing for
+ * STREAM_STALL_TIMEOUT seconds, the event loop closes its connection.
+ * @param pending Bytes of the result not yet handed over.
+ */
+struct job
+{
+    struct event_loop* loop;
+    struct connection* conn;
+    client_t client_type;
+    uint32_t request_id;
+    char* command;
+    char* result;
+    struct timespec enqueued;
+    uint64_t exec_ns;
+    struct job* next;
+    struct job* sibling;
+    int stream;
+    pthread_mutex_t stream_lock;
+    pthread_cond_t stream_cond;
+    size_t chunk_size;
+    size_t max_chunks;
+    size_t chunks_in_flight;
+    int cancelled;
+    int stalled;
+    buffer pending;
+};
+
+/**
+ * @struct chunk
+ *
+ * @brief Structure representing a piece of a streamed result handed to the event loop.
+ *
+ * @param job Job that produced the chunk.
+ * @param data Bytes of the chunk, owned by the chunk.
+ * @param size Number of bytes.
+ * @param last Flag indicating that it is the last chunk of the result.
+ * @param next Pointer to the next chunk.
+ */
+struct chunk
+{
+    struct job* job;
+    char* data;
+    size_t size;
+    int last;
+    struct chunk* next;
+};
+
+/**
+ * @struct pool_stats
+ *
+ * @brief Structure containing the statistics of the thread pool.
+ *
+ * @param workers Number of worker threads.
+ * @param queue_depth Number of jobs waiting in the queue.
+ * @param max_queue_depth Maximum number of jobs that were waiting at the same time.
+ * @param jobs_completed Number of jobs executed.
+ * @param total_wait_ns Time spent by all jobs waiting in the queue, in nanoseconds.
+ * @param max_wait_ns Maximum time a job waited in the queue, in nanoseconds.
+ * @param total_exec_ns Time spent executing all jobs, in nanoseconds.
+ */
+struct pool_stats
+{
+    int workers;
+    size_t queue_depth;
+    size_t max_queue_depth;
+    size_t jobs_completed;
+    uint64_t total_wait_ns;
+    uint64_t max_wait_ns;
+    uint64_t total_exec_ns;
+};
+
+/**
+ * @struct thread_pool
+ *
+ * @brief Structure containing the thread pool data.
+ *
+ * @param threads Worker thread identifiers.
+ * @param mutex Mutex protecting the queue and the statistics.
+ * @param cond Condition variable signaled when a job is queued or the pool is closed.
+ * @param head Pointer to the first queued job.
+ * @param last Pointer to the last queued job.
+ * @param stop Flag indicating that the workers must finish.
+ * @param stats Statistics of the pool.
+ */
+typedef struct thread_pool
+{
+    pthread_t* threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    struct job* head;
+    struct job* last;
+    int stop;
+    struct pool_stats stats;
+} thread_pool;
+
+/**
+ * @brief Function that initializes the thread pool.
+ *
+ * Creates the worker threads with every signal blocked, so the signals are handled by the main thread.
+ *
+ * @param pool Pointer to the thread pool.
+ * @param workers Number of worker threads, if it is 0 one per online core is created.
+ *
+ * @return Returns -1 if the initialization failed.
+ */
+int thread_pool_init(thread_pool* pool, int workers);
+
+/**
+ * @brief Function that queues a job to be executed by a worker.
+ *
+ * @param pool Pointer to the thread pool.
+ * @param job Pointer to the job.
+ *
+ * @return void
+ */
+void thread_pool_submit(thread_pool* pool, struct job* job);
+
+/**
+ * @brief Function that copies the statistics of the thread pool.
+ *
+ * @param pool Pointer to the thread pool.
+ * @param stats Pointer where the statistics are copied.
+ *
+ * @return void
+ */
+void thread_pool_stats(thread_pool* pool, struct pool_stats* stats);
+
+/**
+ * @brief Function that closes the thread pool.
+ *
+ * Wakes up and joins every worker thread. The jobs that were not executed are handed back to
+ * their event loop without a result.
+ *
+ * @param pool Pointer to the thread pool.
+ *
+ * @return void
+ */
+void thread_pool_close(thread_pool* pool);
+
+/**
+ * @brief Function that prepares a job to hand its result over in chunks.
+ *
+ * @param job Pointer to the job.
+ * @param chunk_size Size of every chunk but the last one.
+ * @param max_chunks Maximum number of chunks handed over and not yet acknowledged.
+ *
+ * @return void
+ */
+void job_stream_init(struct job* job, size_t chunk_size, size_t max_chunks);
+
+/**
+ * @brief Function that appends bytes to the result of a streamed job.
+ *
+ * Called by the worker. Every full chunk is handed to the event loop, the worker sleeps while
+ * max_chunks chunks are waiting for their acknowledgement, STREAM_STALL_TIMEOUT seconds at most.
+ *
+ * @param job Pointer to the job.
+ * @param data Bytes of the result.
+ * @param size Number of bytes.
+ *
+ * @return Returns -1 if the connection was closed or stalled and the result is no longer needed.
+ */
+int job_stream_write(struct job* job, const char* data, size_t size);
+
+/**
+ * @brief Function that returns how many bytes job_stream_write() takes without waiting for an acknowledgement.
+ *
+ * @param job Pointer to the job.
+ *
+ * @return size_t Number of bytes, 0 if the connection was closed.
+ */
+size_t job_stream_room(struct job* job);
+
+/**
+ * @brief Function that hands the last chunk of a streamed job over, even if it is empty.
+ *
+ * @param job Pointer to the job.
+ *
+ * @return void
+ */
+void job_stream_end(struct job* job);
+
+/**
+ * @brief Function that marks a chunk of a streamed job as acknowledged.
+ *
+ * Called by the event loop, wakes the worker up if it was waiting.
+ *
+ * @param job Pointer to the job.
+ *
+ * @return void
+ */
+void job_stream_release(struct job* job);
+
+/**
+ * @brief Function that cancels a streamed job because its connection was closed.
+ *
+ * @param job Pointer to the job.
+ *
+ * @return void
+ */
+void job_stream_cancel(struct job* job);
+
+/**
+ * @brief Function that frees a job.
+ *
+ * @param job Pointer to the job.
+ *
+ * @return void
+ */
+void free_job(struct job* job);
+
+#endif // __THREAD_POOL_H__
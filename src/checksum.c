@@ -0,0 +1,300 @@
+/**
+ * @file checksum.c
+ *
+ * @brief Source file for the implementation of the checksum engines.
+ *
+ * @details Contains the zlib crc32, CRC32C (hardware with software fallback) and xxHash3 engines
+ * and the selection of the fastest one during the handshake.
+ *
+ * @author Robledo, Valentín
+ * @date Mayo 2023
+ * @version 1.0
+ *
+ * @copyright Copyright (c) 2023
+ */
+
+#include <string.h>
+#include <pthread.h>
+#include <zlib.h>
+#include "../inc/checksum.h"
+
+#ifdef HAVE_XXHASH
+#include <xxhash.h>
+#endif
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+/* CRC-32C (Castagnoli) polynomial, reflected. */
+#define CRC32C_POLY 0x82F63B78U
+
+/* Bytes processed by each of the three streams in a long and a short round. */
+#define CRC32C_LONG 8192
+#define CRC32C_SHORT 256
+
+static uint32_t crc32c_table[256];
+static uint32_t crc32c_long[4][256];
+static uint32_t crc32c_short[4][256];
+static int crc32c_hardware;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_init(void);
+static uint32_t crc32c_software(uint32_t crc, const unsigned char* data, size_t size);
+static uint32_t crc32c(const void* data, size_t size);
+static uint32_t gf2_matrix_times(const uint32_t* mat, uint32_t vec);
+static void gf2_matrix_square(uint32_t* square, const uint32_t* mat);
+static void crc32c_zeros(uint32_t zeros[][256], size_t size);
+static uint32_t crc32c_shift(uint32_t zeros[][256], uint32_t crc);
+
+#if defined(__x86_64__)
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char* data, size_t size);
+#endif
+
+uint32_t checksum_compute(checksum_algorithm algorithm, const void* data, size_t size)
+{
+    switch(algorithm)
+    {
+    case CHECKSUM_CRC32C:
+        return crc32c(data, size);
+
+#ifdef HAVE_XXHASH
+    case CHECKSUM_XXH3:
+        return (uint32_t)XXH3_64bits(data, size);
+#endif
+
+    default:
+        return (uint32_t)crc32(crc32(0L, Z_NULL, 0), (const Bytef*)data, (uInt)size);
+    }
+}
+
+checksum_algorithm checksum_select(uint8_t algorithms)
+{
+    algorithms &= CHECKSUMS_SUPPORTED;
+
+    pthread_once(&crc32c_once, crc32c_init);
+
+    if(algorithms & CHECKSUM_CRC32C && crc32c_hardware)
+        return CHECKSUM_CRC32C;
+
+    if(algorithms & CHECKSUM_XXH3)
+        return CHECKSUM_XXH3;
+
+    if(algorithms & CHECKSUM_CRC32C)
+        return CHECKSUM_CRC32C;
+
+    return CHECKSUM_CRC32;
+}
+
+const char* checksum_name(checksum_algorithm algorithm)
+{
+    switch(algorithm)
+    {
+    case CHECKSUM_CRC32C:
+        return "crc32c";
+
+    case CHECKSUM_XXH3:
+        return "xxh3";
+
+    default:
+        return "crc32";
+    }
+}
+
+int checksum_parse(const char* name)
+{
+    const checksum_algorithm algorithms[] = {CHECKSUM_CRC32, CHECKSUM_CRC32C, CHECKSUM_XXH3};
+
+    for(size_t i = 0; i < sizeof(algorithms) / sizeof(algorithms[0]); i++)
+        if(algorithms[i] & CHECKSUMS_SUPPORTED && strcmp(name, checksum_name(algorithms[i])) == 0)
+            return algorithms[i];
+
+    return -1;
+}
+
+static void crc32c_init(void)
+{
+    for(uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t crc = n;
+
+        for(int k = 0; k < 8; k++)
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+
+        crc32c_table[n] = crc;
+    }
+
+    crc32c_zeros(crc32c_long, CRC32C_LONG);
+    crc32c_zeros(crc32c_short, CRC32C_SHORT);
+
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    crc32c_hardware = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static uint32_t crc32c(const void* data, size_t size)
+{
+    pthread_once(&crc32c_once, crc32c_init);
+
+#if defined(__x86_64__)
+    if(crc32c_hardware)
+        return crc32c_sse42(0, data, size);
+#endif
+
+    return crc32c_software(0, data, size);
+}
+
+static uint32_t crc32c_software(uint32_t crc, const unsigned char* data, size_t size)
+{
+    crc = ~crc;
+
+    while(size--)
+        crc = crc32c_table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+/* The three streams hide the latency of the crc32 instruction, their results are joined by
+ * shifting the first ones over the zeros of the bytes that follow them. */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char* data, size_t size)
+{
+    uint64_t crc0 = ~crc;
+    uint64_t crc1, crc2, word;
+
+    while(size > 0 && ((uintptr_t)data & 7) != 0)
+    {
+        crc0 = _mm_crc32_u8((uint32_t)crc0, *data++);
+        size--;
+    }
+
+    while(size >= 3 * CRC32C_LONG)
+    {
+        const unsigned char* end = data + CRC32C_LONG;
+        crc1 = crc2 = 0;
+
+        do{
+            memcpy(&word, data, sizeof(word));
+            crc0 = _mm_crc32_u64(crc0, word);
+            memcpy(&word, data + CRC32C_LONG, sizeof(word));
+            crc1 = _mm_crc32_u64(crc1, word);
+            memcpy(&word, data + 2 * CRC32C_LONG, sizeof(word));
+            crc2 = _mm_crc32_u64(crc2, word);
+            data += sizeof(word);
+        }while(data < end);
+
+        crc0 = crc32c_shift(crc32c_long, (uint32_t)crc0) ^ crc1;
+        crc0 = crc32c_shift(crc32c_long, (uint32_t)crc0) ^ crc2;
+        data += 2 * CRC32C_LONG;
+        size -= 3 * CRC32C_LONG;
+    }
+
+    while(size >= 3 * CRC32C_SHORT)
+    {
+        const unsigned char* end = data + CRC32C_SHORT;
+        crc1 = crc2 = 0;
+
+        do{
+            memcpy(&word, data, sizeof(word));
+            crc0 = _mm_crc32_u64(crc0, word);
+            memcpy(&word, data + CRC32C_SHORT, sizeof(word));
+            crc1 = _mm_crc32_u64(crc1, word);
+            memcpy(&word, data + 2 * CRC32C_SHORT, sizeof(word));
+            crc2 = _mm_crc32_u64(crc2, word);
+            data += sizeof(word);
+        }while(data < end);
+
+        crc0 = crc32c_shift(crc32c_short, (uint32_t)crc0) ^ crc1;
+        crc0 = crc32c_shift(crc32c_short, (uint32_t)crc0) ^ crc2;
+        data += 2 * CRC32C_SHORT;
+        size -= 3 * CRC32C_SHORT;
+    }
+
+    while(size >= sizeof(word))
+    {
+        memcpy(&word, data, sizeof(word));
+        crc0 = _mm_crc32_u64(crc0, word);
+        data += sizeof(word);
+        size -= sizeof(word);
+    }
+
+    while(size > 0)
+    {
+        crc0 = _mm_crc32_u8((uint32_t)crc0, *data++);
+        size--;
+    }
+
+    return ~(uint32_t)crc0;
+}
+#endif
+
+static uint32_t gf2_matrix_times(const uint32_t* mat, uint32_t vec)
+{
+    uint32_t sum = 0;
+
+    while(vec)
+    {
+        if(vec & 1)
+            sum ^= *mat;
+
+        vec >>= 1;
+        mat++;
+    }
+
+    return sum;
+}
+
+static void gf2_matrix_square(uint32_t* square, const uint32_t* mat)
+{
+    for(int n = 0; n < 32; n++)
+        square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+/* Builds the tables that apply the operator of appending size zero bytes (a power of two) to a crc. */
+static void crc32c_zeros(uint32_t zeros[][256], size_t size)
+{
+    uint32_t even[32], odd[32];
+    uint32_t row = 1;
+
+    odd[0] = CRC32C_POLY;
+    for(int n = 1; n < 32; n++)
+    {
+        odd[n] = row;
+        row <<= 1;
+    }
+
+    gf2_matrix_square(even, odd);
+    gf2_matrix_square(odd, even);
+
+    uint32_t* op = even;
+
+    while(1)
+    {
+        gf2_matrix_square(even, odd);
+        op = even;
+        size >>= 1;
+        if(size == 0)
+            break;
+
+        gf2_matrix_square(odd, even);
+        op = odd;
+        size >>= 1;
+        if(size == 0)
+            break;
+    }
+
+    for(uint32_t n = 0; n < 256; n++)
+    {
+        zeros[0][n] = gf2_matrix_times(op, n);
+        zeros[1][n] = gf2_matrix_times(op, n << 8);
+        zeros[2][n] = gf2_matrix_times(op, n << 16);
+        zeros[3][n] = gf2_matrix_times(op, n << 24);
+    }
+}
+
+static uint32_t crc32c_shift(uint32_t zeros[][256], uint32_t crc)
+{
+    return zeros[0][crc & 0xFF] ^ zeros[1][(crc >> 8) & 0xFF] ^ zeros[2][(crc >> 16) & 0xFF] ^ zeros[3][crc >> 24];
+}
@@ -0,0 +1,83 @@
+/**
+ * @file checksum_bench.c
+ *
+ * @brief Source file for the microbenchmark of the checksum engines.
+ *
+ * @details Reports the throughput of checksum_compute() for every algorithm compiled in, on blocks
+ * of 4 KB, 64 KB and 256 KB (the default packet size on the unix socket). Built with the
+ * checksum_bench target, which is not part of all.
+ *
+ * @author Robledo, Valentín
+ * @date Mayo 2023
+ * @version 1.0
+ *
+ * @copyright Copyright (c) 2023
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../inc/checksum.h"
+
+/* Bytes checksummed for each algorithm and block size. */
+#define BENCH_TOTAL_BYTES (1024UL * 1024 * 1024)
+
+static const size_t block_sizes[] = {4 * 1024, 64 * 1024, 256 * 1024};
+
+static double now_seconds(void);
+
+int main(void)
+{
+    const checksum_algorithm algorithms[] = {CHECKSUM_CRC32, CHECKSUM_CRC32C, CHECKSUM_XXH3};
+    size_t max_size = block_sizes[sizeof(block_sizes) / sizeof(block_sizes[0]) - 1];
+    unsigned char* data = malloc(max_size);
+
+    if(data == NULL)
+    {
+        printf("Error: no se pudo asignar memoria para el bloque.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    srand(1);
+    for(size_t i = 0; i < max_size; i++)
+        data[i] = (unsigned char)rand();
+
+    for(size_t a = 0; a < sizeof(algorithms) / sizeof(algorithms[0]); a++)
+    {
+        if(!(CHECKSUMS_SUPPORTED & algorithms[a]))
+            continue;
+
+        for(size_t b = 0; b < sizeof(block_sizes) / sizeof(block_sizes[0]); b++)
+        {
+            size_t size = block_sizes[b];
+            size_t rounds = BENCH_TOTAL_BYTES / size;
+            volatile uint32_t sink = 0;
+
+            /* One warm up pass, so the first algorithm does not pay for the page faults. */
+            sink ^= checksum_compute(algorithms[a], data, size);
+
+            double start = now_seconds();
+
+            for(size_t r = 0; r < rounds; r++)
+                sink ^= checksum_compute(algorithms[a], data, size);
+
+            double elapsed = now_seconds() - start;
+
+            printf("%-7s %4zu KB: %6.2f GB/s\n", checksum_name(algorithms[a]), size / 1024,
+                   (double)(rounds * size) / elapsed / 1e9);
+        }
+    }
+
+    free(data);
+
+    return 0;
+}
+
+static double now_seconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
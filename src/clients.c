@@ -16,21 +16,32 @@
 
 int main(int argc, char* argv[]) 
 {   
-    if(argc == 3)
+    int opt;
+
+    while((opt = getopt(argc, argv, "p")) != -1)
     {
-        client_t client_type = (client_t)atoi(argv[1]);
-        
-        client_init(client_type, atoi(argv[2]), NULL);
+        if(opt != 'p')
+        {
+            printf("Uso: %s [-p] <tipo de cliente> <tipo de socket> [ip]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
 
-        message_sender(client_socket, client_type);
+        pipeline = 1;
     }
-    else if(argc == 4)
+
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if(argc == 3 || argc == 4)
     {
         client_t client_type = (client_t)atoi(argv[1]);
         
-        client_init(client_type, atoi(argv[2]), argv[3]);
+        client_init(client_type, atoi(argv[2]), argc == 4 ? argv[3] : NULL);
 
-        message_sender(client_socket, client_type);
+        if(options.flags & HANDSHAKE_PIPELINE)
+            message_pipeline(client_socket, client_type);
+        else
+            message_sender(client_socket, client_type);
     }
     else
     {
@@ -50,32 +61,121 @@ void message_sender(int client_socket, client_t client_type)
     while(1){   
         char *command;
 
-        if(client_status_f == SENDING)
+        do
         {
-            do
+            command = malloc(100);               
+            read_flag = read_input(file, command);
+
+            if(read_flag == INPUT_OMIT)
+                free(command);
+
+            if(read_flag == INPUT_OMIT && feof(file))
             {
-                command = malloc(100);               
-                read_flag = read_input(file, command);
+                client_flag = CLIENT_DOWN;
+                close_client(client_socket);
+            }
+        }while(read_flag == INPUT_OMIT);
+
+        send_data(client_socket, command, client_type, CLIENT_MESSAGE, &options, &compression);
+        free(command);
+
+        /* The receiving thread prints the response and hands the turn back. */
+        pthread_mutex_lock(&status_lock);
+        client_status_f = RECEIVING;
+        pthread_cond_broadcast(&status_cond);
+
+        while(client_status_f == RECEIVING)
+            pthread_cond_wait(&status_cond, &status_lock);
+
+        pthread_mutex_unlock(&status_lock);
+    }
+}
 
-                if(read_flag == INPUT_OMIT)
-                    free(command);
-            }while(read_flag == INPUT_OMIT);
+void message_pipeline(int client_socket, client_t client_type)
+{
+    create_thread(client_socket, client_type);
+    FILE* file = stdin;
+    uint32_t next_id = 1;
 
-            send_data(client_socket, command, client_type, CLIENT_MESSAGE);
+    while(1)
+    {
+        char* command = malloc(100);
+
+        if(read_input(file, command) == INPUT_OMIT)
+        {
             free(command);
-            client_status_f = RECEIVING;
+
+            if(!feof(file))
+                continue;
+
+            /* Every response is printed before the client is closed. */
+            pthread_mutex_lock(&pipeline_lock);
+            while(outstanding > 0)
+                pthread_cond_wait(&pipeline_cond, &pipeline_lock);
+            pthread_mutex_unlock(&pipeline_lock);
+
+            client_flag = CLIENT_DOWN;
+            close_client(client_socket);
+        }
+
+        struct request* request = malloc(sizeof(struct request));
+        if(request == NULL)
+        {
+            printf("Error: no se pudo asignar memoria para la petición.\n");
+            exit(EXIT_FAILURE);
         }
+
+        request->id = next_id++;
+        request->command = command;
+
+        pthread_mutex_lock(&pipeline_lock);
+        while(outstanding >= MAX_PIPELINE_REQUESTS)
+            pthread_cond_wait(&pipeline_cond, &pipeline_lock);
+
+        request->next = requests;
+        requests = request;
+        outstanding++;
+        pthread_mutex_unlock(&pipeline_lock);
+
+        send_request(client_socket, request);
     }
 }
 
+void send_request(int client_socket, const struct request* request)
+{
+    record_header record;
+    frame_header frame;
+    uint32_t length = (uint32_t)strlen(request->command);
+
+    record_format(&record, RECORD_REQUEST, request->id);
+    frame_format(&frame, FRAME_LAST, length, 0, checksum_compute((checksum_algorithm)options.checksum, request->command, length));
+
+    /* Both threads write records, each one goes out whole. */
+    pthread_mutex_lock(&send_lock);
+    ssize_t sent = send_record(client_socket, &record, &frame, sizeof(frame), request->command, length);
+    pthread_mutex_unlock(&send_lock);
+
+    if(sent == -1)
+        send_error_handler("Error: No se pudo enviar la petición");
+}
+
 void client_init(client_t client_type, int protocol_type, const char* arg)
 {
     server_flag = SERVER_UP;
     client_flag = CLIENT_UP;
     client_status_f = SENDING;
-
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 300;
+    pthread_mutex_init(&status_lock, NULL);
+    pthread_cond_init(&status_cond, NULL);
+    pthread_mutex_init(&pipeline_lock, NULL);
+    pthread_cond_init(&pipeline_cond, NULL);
+    pthread_mutex_init(&send_lock, NULL);
+
+    shutdown_fd = eventfd(0, EFD_CLOEXEC);
+    if(shutdown_fd == -1)
+    {
+        perror("eventfd() failed");
+        exit(EXIT_FAILURE);
+    }
 
     signal(SIGINT, sigint_handler);
     signal(SIGUSR1, sigusr1_handler);
@@ -106,9 +206,18 @@ void client_init(client_t client_type, int protocol_type, const char* arg)
         break;
     }
 
-    if(send(client_socket, &client_type, sizeof(client_type), 0) == -1)
+    handshake offer;
+
+    memset(&offer, 0, sizeof(offer));
+    offer.wire_format = WIRE_JSON | WIRE_BINARY;
+    offer.window = DEFAULT_WINDOW_SIZE;
+    offer.checksum = CHECKSUMS_SUPPORTED;
+    offer.flags = HANDSHAKE_STREAM | (pipeline ? HANDSHAKE_PIPELINE : 0);
+    offer.packet_size = MAX_PACKET_DATA_SIZE;
+
+    if(handshake_send(client_socket, client_type, &offer, &options) == -1)
     {
-        perror("Error al enviar el tipo de cliente\n");
+        perror("Error al negociar el formato con el servidor\n");
         exit(EXIT_FAILURE);
     }
 }
@@ -232,7 +341,10 @@ void *thread_function(void *arg)
     fd_set read_fds;
     FD_ZERO(&read_fds);
 
-    receiving_logic(client_tsocket, client_type, read_fds);
+    if(options.flags & HANDSHAKE_PIPELINE)
+        receiving_records(client_tsocket, client_type);
+    else
+        receiving_logic(client_tsocket, client_type, read_fds);
 
     pthread_kill(main_tid, SIGUSR1);
 
@@ -245,29 +357,50 @@ void receiving_logic(int client_tsocket, client_t client_type, fd_set read_fds)
     {
         FD_ZERO(&read_fds);
         FD_SET(client_tsocket, &read_fds);
+        FD_SET(shutdown_fd, &read_fds);
         u_int8_t receive_message;   
         char* data;
 
-        int ret = select(client_tsocket + 1, &read_fds, NULL, NULL, &timeout);
-        if(ret == 0)
-        {
-            if(server_flag == SERVER_DOWN)
-                break;
-        }
-        else if(ret > 0)
+        int ret = select((client_tsocket > shutdown_fd ? client_tsocket : shutdown_fd) + 1, &read_fds, NULL, NULL, NULL);
+        if(ret == -1 && errno != EINTR)
+            break;
+
+        if(ret > 0 && FD_ISSET(shutdown_fd, &read_fds))
+            break;
+
+        if(ret > 0)
         {
+            if(client_status_f == SENDING)
+            {
+                /* Only the end of the connection is looked at, the bytes belong to the main thread
+                 * waiting for the checksum status, so wait until it hands the socket over. */
+                ssize_t peek = recv(client_tsocket, &receive_message, sizeof(receive_message), MSG_PEEK);
+                if(peek == (ssize_t)0 || (peek == (ssize_t)-1 && errno != EINTR))
+                    break;
+
+                pthread_mutex_lock(&status_lock);
+                while(client_status_f == SENDING)
+                    pthread_cond_wait(&status_cond, &status_lock);
+                pthread_mutex_unlock(&status_lock);
+                continue;
+            }
+
             ssize_t rec = recv(client_tsocket, &receive_message, sizeof(receive_message), 0);
             
-            if(receive_message == SERVER_MESSAGE && client_status_f == RECEIVING && rec > (ssize_t)0)
+            if(receive_message == SERVER_MESSAGE && rec > (ssize_t)0)
             {
-                data = receive_data(client_tsocket, client_type, SERVER_MESSAGE);
+                data = receive_data(client_tsocket, client_type, SERVER_MESSAGE, &options, &compression, stdout);
                 if(data == NULL)
                     break;
                 
                 printf("%s\n", data);
 
                 free(data);
+
+                pthread_mutex_lock(&status_lock);
                 client_status_f = SENDING;
+                pthread_cond_broadcast(&status_cond);
+                pthread_mutex_unlock(&status_lock);
             }
             else if(rec == (ssize_t)0)
                 break;
@@ -277,6 +410,186 @@ void receiving_logic(int client_tsocket, client_t client_type, fd_set read_fds)
     return;
 }
 
+void receiving_records(int client_tsocket, client_t client_type)
+{
+    struct response* responses = NULL;
+    data_packet packet;
+    fd_set read_fds;
+
+    data_packet_init(&packet, options.packet_size);
+
+    while(1)
+    {
+        FD_ZERO(&read_fds);
+        FD_SET(client_tsocket, &read_fds);
+        FD_SET(shutdown_fd, &read_fds);
+
+        int ret = select((client_tsocket > shutdown_fd ? client_tsocket : shutdown_fd) + 1, &read_fds, NULL, NULL, NULL);
+        if(ret == -1 && errno != EINTR)
+            break;
+
+        if(ret > 0 && FD_ISSET(shutdown_fd, &read_fds))
+            break;
+
+        if(ret > 0 && receive_record(client_tsocket, client_type, &responses, &packet) == -1)
+            break;
+    }
+
+    data_packet_free(&packet);
+}
+
+int receive_record(int client_tsocket, client_t client_type, struct response** responses, data_packet* packet)
+{
+    record_header record;
+    window_ack ack;
+
+    if(recv(client_tsocket, &record, sizeof(record), MSG_WAITALL) != (ssize_t)sizeof(record))
+        return -1;
+
+    uint32_t request_id = ntohl(record.request_id);
+
+    if(record.type == RECORD_ACK)
+    {
+        if(recv(client_tsocket, &ack, sizeof(ack), MSG_WAITALL) != (ssize_t)sizeof(ack))
+            return -1;
+
+        if(ntohl(ack.status) == CHECKSUM_OK)
+            return 0;
+
+        pthread_mutex_lock(&pipeline_lock);
+        struct request* request = requests;
+        while(request != NULL && request->id != request_id)
+            request = request->next;
+        pthread_mutex_unlock(&pipeline_lock);
+
+        /* Only this thread removes requests, so it is still valid without the lock. */
+        if(request != NULL)
+            send_request(client_tsocket, request);
+
+        return 0;
+    }
+
+    if(record.type == RECORD_RESPONSE)
+    {
+        uint32_t num_packets;
+
+        if(recv(client_tsocket, &num_packets, sizeof(num_packets), MSG_WAITALL) != (ssize_t)sizeof(num_packets))
+            return -1;
+
+        uint32_t window = window_size(&options);
+        struct response* response = calloc(1, sizeof(struct response));
+
+        if(response == NULL)
+        {
+            printf("Error: no se pudo asignar memoria para la respuesta.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        response->id = request_id;
+        response->num_packets = ntohl(num_packets);
+        response->next = *responses;
+        *responses = response;
+
+        if(response->num_packets == 0)
+            response_done(responses, response);
+        else
+            receive_window_init(&response->receiving, response->num_packets < window ? (uint32_t)response->num_packets : window, &options);
+
+        return 0;
+    }
+
+    /* An update of a subscription is not acknowledged, a corrupt one is dropped and the next one replaces it. */
+    if(record.type == RECORD_PUSH)
+    {
+        receive_frame(client_tsocket, NULL, packet);
+
+        if(checksum_verify(packet, (checksum_algorithm)options.checksum) != CHECKSUM_OK)
+            return 0;
+
+        /* A push of a followed query carries several entries, each line is printed with the identifier. */
+        char* line = packet->data;
+        char* end;
+
+        while((end = strchr(line, '\n')) != NULL)
+        {
+            *end = '\0';
+            printf("[%u] %s\n", request_id, line);
+            line = end + 1;
+        }
+
+        if(*line != '\0')
+            printf("[%u] %s\n", request_id, line);
+
+        return 0;
+    }
+
+    struct response* response = *responses;
+
+    while(response != NULL && response->id != request_id)
+        response = response->next;
+
+    if(record.type != RECORD_FRAME || response == NULL)
+    {
+        printf("Error: Registro inválido del servidor.\n");
+        return -1;
+    }
+
+    receive_frame(client_tsocket, client_type == CLIENT_B ? &compression : NULL, packet);
+
+    checksum_status status = receive_window_store(&response->receiving, packet, &response->message);
+    response->delivered += receive_window_advance(&response->receiving);
+
+    record_format(&record, RECORD_ACK, request_id);
+    window_ack_format(&ack, response->receiving.next_sequence, packet->sequence, status);
+
+    pthread_mutex_lock(&send_lock);
+    ssize_t sent = send_record(client_tsocket, &record, &ack, sizeof(ack), NULL, 0);
+    pthread_mutex_unlock(&send_lock);
+
+    if(sent == -1)
+        send_error_handler("Error: No se pudo enviar el estado del checksum");
+
+    if(response->delivered == response->num_packets)
+    {
+        receive_window_free(&response->receiving);
+        response_done(responses, response);
+    }
+
+    return 0;
+}
+
+void response_done(struct response** responses, struct response* response)
+{
+    buffer_append(&response->message, "", 1);
+    printf("[%u] %s\n", response->id, response->message.data);
+    buffer_free(&response->message);
+
+    while(*responses != response)
+        responses = &(*responses)->next;
+    *responses = response->next;
+
+    uint32_t id = response->id;
+    free(response);
+
+    pthread_mutex_lock(&pipeline_lock);
+    struct request** link = &requests;
+
+    while(*link != NULL && (*link)->id != id)
+        link = &(*link)->next;
+
+    if(*link != NULL)
+    {
+        struct request* request = *link;
+        *link = request->next;
+        free(request->command);
+        free(request);
+        outstanding--;
+    }
+
+    pthread_cond_broadcast(&pipeline_cond);
+    pthread_mutex_unlock(&pipeline_lock);
+}
+
 void close_client(int client_socket)
 {   
     //printf("\033[2J\033[1;1H");
@@ -286,6 +599,7 @@ void close_client(int client_socket)
         printf("El cliente ha sido desconectado.\n");
 
     close(client_socket);
+    close(shutdown_fd);
     free(unix_socket_path);
 
     exit(EXIT_SUCCESS);
@@ -294,6 +608,7 @@ void close_client(int client_socket)
 void sigint_handler()
 {
     client_flag = CLIENT_DOWN;
+    eventfd_write(shutdown_fd, 1);
     close_client(client_socket);
 }
 
@@ -0,0 +1,161 @@
+/**
+ * @file conn_registry.c
+ *
+ * @brief Source file for the registry of the connections of an event loop.
+ *
+ * @details The slots are probed linearly from the hash of the file descriptor. The table is rebuilt,
+ * twice as large if more than half of it holds connections, once the connections and the tombstones
+ * use three quarters of it.
+ *
+ * @author Robledo, Valentín
+ * @date Mayo 2023
+ * @version 1.0
+ *
+ * @copyright Copyright (c) 2023
+ */
+
+#include "../inc/conn_registry.h"
+
+static size_t fd_hash(int fd, size_t capacity);
+static registry_slot* slots_alloc(size_t capacity);
+static void registry_rebuild(conn_registry* registry, size_t capacity);
+static registry_slot* registry_lookup(conn_registry* registry, int fd);
+
+void conn_registry_init(conn_registry* registry)
+{
+    memset(registry, 0, sizeof(*registry));
+    pthread_mutex_init(&registry->lock, NULL);
+
+    registry->slots = slots_alloc(CONN_REGISTRY_SLOTS);
+    registry->capacity = CONN_REGISTRY_SLOTS;
+}
+
+void conn_registry_add(conn_registry* registry, int fd, struct connection* conn)
+{
+    pthread_mutex_lock(&registry->lock);
+
+    if((registry->used + 1) * 4 > registry->capacity * 3)
+        registry_rebuild(registry, (registry->count + 1) * 2 > registry->capacity ? registry->capacity * 2 : registry->capacity);
+
+    size_t index = fd_hash(fd, registry->capacity);
+
+    /* The descriptor is not registered, so the first free slot of the probe is taken, tombstones included. */
+    while(registry->slots[index].fd >= 0)
+        index = (index + 1) & (registry->capacity - 1);
+
+    if(registry->slots[index].fd == REGISTRY_EMPTY)
+        registry->used++;
+
+    registry->slots[index].fd = fd;
+    registry->slots[index].conn = conn;
+    registry->count++;
+
+    pthread_mutex_unlock(&registry->lock);
+}
+
+void conn_registry_remove(conn_registry* registry, int fd, conn_stats* stats)
+{
+    pthread_mutex_lock(&registry->lock);
+
+    registry_slot* slot = registry_lookup(registry, fd);
+
+    if(slot != NULL)
+    {
+        slot->fd = REGISTRY_TOMBSTONE;
+        slot->conn = NULL;
+        registry->count--;
+
+        int client_type = atomic_load_explicit(&stats->client_type, memory_order_relaxed);
+
+        if(client_type >= 0 && client_type < NUM_CLIENT_TYPES)
+            for(int i = 0; i < NUM_COUNTERS; i++)
+                registry->closed[client_type][i] += atomic_load_explicit(&stats->counters[i], memory_order_relaxed);
+    }
+
+    pthread_mutex_unlock(&registry->lock);
+}
+
+struct connection* conn_registry_next(conn_registry* registry, size_t* index)
+{
+    while(*index < registry->capacity)
+    {
+        registry_slot* slot = &registry->slots[(*index)++];
+
+        if(slot->conn != NULL)
+            return slot->conn;
+    }
+
+    return NULL;
+}
+
+void conn_registry_close(conn_registry* registry)
+{
+    free(registry->slots);
+    registry->slots = NULL;
+    registry->capacity = registry->count = registry->used = 0;
+    pthread_mutex_destroy(&registry->lock);
+}
+
+static size_t fd_hash(int fd, size_t capacity)
+{
+    /* The descriptors are consecutive, the multiplicative hash spreads them over the table. */
+    return (size_t)(((uint32_t)fd * 2654435761u) & (uint32_t)(capacity - 1));
+}
+
+static registry_slot* slots_alloc(size_t capacity)
+{
+    registry_slot* slots = malloc(capacity * sizeof(registry_slot));
+    if(slots == NULL)
+    {
+        printf("Error: no se pudo asignar memoria para el registro de conexiones.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(size_t i = 0; i < capacity; i++)
+    {
+        slots[i].fd = REGISTRY_EMPTY;
+        slots[i].conn = NULL;
+    }
+
+    return slots;
+}
+
+static void registry_rebuild(conn_registry* registry, size_t capacity)
+{
+    registry_slot* old = registry->slots;
+    size_t old_capacity = registry->capacity;
+
+    registry->slots = slots_alloc(capacity);
+    registry->capacity = capacity;
+    registry->used = registry->count;
+
+    for(size_t i = 0; i < old_capacity; i++)
+    {
+        if(old[i].conn == NULL)
+            continue;
+
+        size_t index = fd_hash(old[i].fd, capacity);
+
+        while(registry->slots[index].fd != REGISTRY_EMPTY)
+            index = (index + 1) & (capacity - 1);
+
+        registry->slots[index] = old[i];
+    }
+
+    free(old);
+}
+
+static registry_slot* registry_lookup(conn_registry* registry, int fd)
+{
+    size_t index = fd_hash(fd, registry->capacity);
+
+    while(registry->slots[index].fd != REGISTRY_EMPTY)
+    {
+        if(registry->slots[index].fd == fd)
+            return &registry->slots[index];
+
+        index = (index + 1) & (registry->capacity - 1);
+    }
+
+    return NULL;
+}
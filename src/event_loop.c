@@ -0,0 +1,2256 @@
+/**
+ * @file event_loop.c
+ *
+ * @brief Source file for the implementation of the server event loop.
+ *
+ * @details Contains the epoll loop that accepts clients and the non-blocking state machine
+ * that drives the middleware protocol of each connection.
+ *
+ * @author Robledo, Valentín
+ * @date Mayo 2023
+ * @version 1.0
+ *
+ * @copyright Copyright (c) 2023
+ */
+
+#define _GNU_SOURCE
+
+#include "../inc/event_loop.h"
+#include "../inc/server.h"
+
+static void accept_clients(event_loop* loop, int listen_fd);
+static void listeners_pause(event_loop* loop);
+static void listeners_resume(event_loop* loop);
+static void close_connection(event_loop* loop, connection* conn);
+static int conn_read(event_loop* loop, connection* conn);
+static int conn_flush(event_loop* loop, connection* conn);
+static void conn_send(event_loop* loop, connection* conn, const void* data, size_t size);
+static void conn_queue(connection* conn, const void* data, size_t size);
+static void conn_write(event_loop* loop, connection* conn);
+static void conn_consume_queue(connection* conn, size_t sent);
+static void conn_count(connection* conn, counter_t counter, size_t value);
+static void flush_connections(event_loop* loop);
+#ifdef HAVE_IO_URING
+static void ring_flush(event_loop* loop);
+#endif
+static void conn_update_events(event_loop* loop, connection* conn);
+static void conn_process_input(event_loop* loop, connection* conn);
+static int conn_receive_ack(event_loop* loop, connection* conn);
+static int conn_apply_ack(event_loop* loop, connection* conn, response* resp, checksum_status status, size_t sequence, size_t next_sequence);
+static int conn_receive_record(event_loop* loop, connection* conn);
+static int conn_receive_request(event_loop* loop, connection* conn, uint32_t request_id);
+static void conn_receive_packet(event_loop* loop, connection* conn);
+static void conn_store_packet(event_loop* loop, connection* conn, data_packet* packet);
+static uint32_t conn_packet_size(connection* conn);
+static void conn_execute(event_loop* loop, connection* conn);
+static void conn_submit(event_loop* loop, connection* conn, const char* command, uint32_t request_id);
+static void conn_detach_job(connection* conn, struct job* job);
+static void conn_start_response(event_loop* loop, connection* conn, char* result, uint32_t id);
+static response* conn_add_response(connection* conn, uint32_t id, size_t slots);
+static void conn_receive_chunk(event_loop* loop, struct chunk* chunk);
+static response* conn_find_stream(connection* conn, struct job* job);
+static void conn_finish_response(event_loop* loop, connection* conn, response* resp);
+static void conn_next_response(event_loop* loop, connection* conn);
+static void conn_send_packet(connection* conn, response* resp, size_t index, size_t offset);
+static void conn_fill_window(event_loop* loop, connection* conn, response* resp);
+static void conn_release_packet(response* resp, size_t sequence);
+static void conn_free_response(response* resp);
+static void process_completions(event_loop* loop);
+static int conn_subscribe(event_loop* loop, connection* conn, const char* command, uint32_t request_id);
+static size_t conn_unsubscribe(event_loop* loop, connection* conn, int metric);
+static void conn_reply(event_loop* loop, connection* conn, char* result, uint32_t request_id);
+static void publish_updates(event_loop* loop);
+static push_frame* push_encode(event_loop* loop, push_frame* frames, size_t* num_frames, const sysinfo_snapshot* snapshot, metric_t metric, uint8_t checksum);
+static void timer_arm(event_loop* loop);
+static size_t push_format(char* data, const char* payload, uint32_t length, uint8_t checksum);
+static int conn_follow(event_loop* loop, connection* conn, const char* command, uint32_t request_id);
+static size_t conn_unfollow(event_loop* loop, connection* conn);
+static size_t conn_queued(connection* conn);
+static void feed_read(event_loop* loop, follow_feed* feed);
+static void feed_drain(event_loop* loop, follow_feed* feed);
+static int feed_room(follow_feed* feed);
+static void conn_resume_follows(event_loop* loop, connection* conn);
+static void feed_chunk(follow_chunk** chunks, size_t* num_chunks, size_t offset, size_t length, size_t entries);
+static void feed_push(event_loop* loop, follower* follower, follow_chunk* chunk, const char* entries);
+static void feed_close(event_loop* loop, follow_feed* feed);
+static void free_closed_feeds(event_loop* loop);
+
+int event_loop_init(event_loop* loop, const int* listen_fds, int num_listeners, thread_pool* pool)
+{
+    struct epoll_event event;
+
+    memset(loop, 0, sizeof(*loop));
+    loop->pool = pool;
+    pthread_mutex_init(&loop->completed_lock, NULL);
+    conn_registry_init(&loop->registry);
+
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(loop->epoll_fd == -1)
+    {
+        perror("epoll_create1() failed");
+        return -1;
+    }
+
+    loop->notify.type = HANDLE_NOTIFY;
+    loop->notify.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(loop->notify.fd == -1)
+    {
+        perror("eventfd() failed");
+        return -1;
+    }
+
+    event.events = EPOLLIN;
+    event.data.ptr = &loop->notify;
+
+    if(epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->notify.fd, &event) == -1)
+    {
+        perror("epoll_ctl() eventfd failed");
+        return -1;
+    }
+
+    loop->shutdown.type = HANDLE_SHUTDOWN;
+    loop->shutdown.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(loop->shutdown.fd == -1)
+    {
+        perror("eventfd() failed");
+        return -1;
+    }
+
+    event.events = EPOLLIN;
+    event.data.ptr = &loop->shutdown;
+
+    if(epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->shutdown.fd, &event) == -1)
+    {
+        perror("epoll_ctl() eventfd failed");
+        return -1;
+    }
+
+    for(int i = 0; i < num_listeners; i++)
+    {
+        loop->listeners[i].type = HANDLE_LISTENER;
+        loop->listeners[i].fd = listen_fds[i];
+
+        /* A socket shared by several event loops wakes only one of them up for each client. */
+        event.events = EPOLLIN | EPOLLEXCLUSIVE;
+        event.data.ptr = &loop->listeners[i];
+
+        if(epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, listen_fds[i], &event) == -1)
+        {
+            perror("epoll_ctl() listener failed");
+            return -1;
+        }
+    }
+
+    loop->num_listeners = num_listeners;
+
+#ifdef HAVE_IO_URING
+    if(io_ring_init(&loop->ring, IO_RING_ENTRIES) == -1)
+    {
+        printf("Advertencia: io_uring no está disponible (%s), se envía con send().\n", strerror(errno));
+        loop->ring.fd = -1;
+    }
+#endif
+
+    return 0;
+}
+
+int event_loop_watch(event_loop* loop, journal_cache* cache)
+{
+    struct epoll_event event;
+
+    loop->journal.type = HANDLE_JOURNAL;
+    loop->journal.fd = journal_cache_fd(cache);
+    if(loop->journal.fd == -1)
+        return -1;
+
+    event.events = EPOLLIN;
+    event.data.ptr = &loop->journal;
+
+    if(epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->journal.fd, &event) == -1)
+    {
+        perror("epoll_ctl() journal failed");
+        return -1;
+    }
+
+    loop->cache = cache;
+
+    return 0;
+}
+
+int event_loop_publish(event_loop* loop, sysinfo_sampler* sampler)
+{
+    struct epoll_event event;
+
+    loop->timer.type = HANDLE_TIMER;
+    loop->timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(loop->timer.fd == -1)
+    {
+        perror("timerfd_create() failed");
+        return -1;
+    }
+
+    event.events = EPOLLIN;
+    event.data.ptr = &loop->timer;
+
+    if(epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->timer.fd, &event) == -1)
+    {
+        perror("epoll_ctl() timerfd failed");
+        return -1;
+    }
+
+    loop->sampler = sampler;
+
+    return 0;
+}
+
+void event_loop_run(event_loop* loop)
+{
+    struct epoll_event events[MAX_EVENTS];
+
+    while(1)
+    {
+        int ret = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, -1);
+
+        if(ret == -1)
+        {
+            if(errno == EINTR)
+                continue;
+
+            perror("Error en epoll_wait, espera de eventos.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        for(int i = 0; i < ret; i++)
+        {
+            struct handle* handle = events[i].data.ptr;
+
+            if(handle->type == HANDLE_LISTENER)
+            {
+                accept_clients(loop, handle->fd);
+                continue;
+            }
+
+            if(handle->type == HANDLE_NOTIFY)
+            {
+                process_completions(loop);
+                continue;
+            }
+
+            if(handle->type == HANDLE_SHUTDOWN)
+                return;
+
+            if(handle->type == HANDLE_JOURNAL)
+            {
+                journal_cache_process(loop->cache);
+                continue;
+            }
+
+            if(handle->type == HANDLE_TIMER)
+            {
+                publish_updates(loop);
+                continue;
+            }
+
+            /* A feed closed earlier in the round has no followers left, its event is stale. */
+            if(handle->type == HANDLE_FOLLOW)
+            {
+                if(((follow_feed*)handle)->followers != NULL)
+                    feed_read(loop, (follow_feed*)handle);
+                continue;
+            }
+
+            connection* conn = (connection*)handle;
+
+            if(events[i].events & (EPOLLERR | EPOLLHUP) && !(events[i].events & EPOLLIN))
+            {
+                close_connection(loop, conn);
+                continue;
+            }
+
+            if(events[i].events & EPOLLOUT && conn_flush(loop, conn) == -1)
+            {
+                close_connection(loop, conn);
+                continue;
+            }
+
+            if(events[i].events & EPOLLOUT && conn->follows > 0)
+                conn_resume_follows(loop, conn);
+
+            if(events[i].events & EPOLLIN)
+            {
+                int status = conn_read(loop, conn);
+
+                conn_process_input(loop, conn);
+
+                if(status == -1)
+                    close_connection(loop, conn);
+            }
+        }
+
+        flush_connections(loop);
+        free_closed_feeds(loop);
+    }
+}
+
+void event_loop_complete(event_loop* loop, struct job* job)
+{
+    pthread_mutex_lock(&loop->completed_lock);
+    job->next = loop->completed;
+    loop->completed = job;
+    pthread_mutex_unlock(&loop->completed_lock);
+
+    if(eventfd_write(loop->notify.fd, 1) == -1)
+        perror("eventfd_write() failed");
+}
+
+void event_loop_stream(event_loop* loop, struct chunk* chunk)
+{
+    chunk->next = NULL;
+
+    pthread_mutex_lock(&loop->completed_lock);
+
+    if(loop->chunks_last != NULL)
+        loop->chunks_last->next = chunk;
+    else
+        loop->chunks = chunk;
+    loop->chunks_last = chunk;
+
+    pthread_mutex_unlock(&loop->completed_lock);
+
+    if(eventfd_write(loop->notify.fd, 1) == -1)
+        perror("eventfd_write() failed");
+}
+
+void event_loop_cancel(event_loop* loop)
+{
+    size_t index = 0;
+    connection* conn;
+
+    while((conn = conn_registry_next(&loop->registry, &index)) != NULL)
+        for(struct job* job = conn->jobs; job != NULL; job = job->sibling)
+            if(job->stream)
+                job_stream_cancel(job);
+}
+
+void event_loop_stop(event_loop* loop)
+{
+    eventfd_write(loop->shutdown.fd, 1);
+}
+
+void event_loop_metrics(event_loop* loop, metrics_report* report)
+{
+    size_t index = 0;
+    connection* conn;
+
+    pthread_mutex_lock(&loop->registry.lock);
+
+    for(int type = 0; type < NUM_CLIENT_TYPES; type++)
+        for(int i = 0; i < NUM_COUNTERS; i++)
+            report->counters[type][i] += loop->registry.closed[type][i];
+
+    while((conn = conn_registry_next(&loop->registry, &index)) != NULL)
+        metrics_report_conn(report, conn->handle.fd, &conn->stats);
+
+    pthread_mutex_unlock(&loop->registry.lock);
+
+    for(int type = 0; type < NUM_CLIENT_TYPES; type++)
+        for(int i = 0; i < NUM_DURATIONS; i++)
+            histogram_collect(&report->durations[type][i], &loop->durations[type][i]);
+}
+
+void event_loop_close(event_loop* loop)
+{
+    pthread_mutex_lock(&loop->completed_lock);
+    struct job* job = loop->completed;
+    struct chunk* chunk = loop->chunks;
+    loop->completed = NULL;
+    loop->chunks = loop->chunks_last = NULL;
+    pthread_mutex_unlock(&loop->completed_lock);
+
+    while(chunk != NULL)
+    {
+        struct chunk* next = chunk->next;
+        free(chunk->data);
+        free(chunk);
+        chunk = next;
+    }
+
+    while(job != NULL)
+    {
+        struct job* next = job->next;
+
+        if(job->conn != NULL)
+        {
+            response* resp = conn_find_stream(job->conn, job);
+
+            if(resp != NULL)
+                resp->job = NULL;
+
+            conn_detach_job(job->conn, job);
+        }
+
+        free_job(job);
+        job = next;
+    }
+
+    size_t index = 0;
+    connection* conn;
+
+    /* A closed connection leaves a tombstone behind, the iteration goes on with the next slot. */
+    while((conn = conn_registry_next(&loop->registry, &index)) != NULL)
+        close_connection(loop, conn);
+
+    free_closed_feeds(loop);
+    conn_registry_close(&loop->registry);
+
+    if(loop->sampler != NULL)
+        close(loop->timer.fd);
+
+#ifdef HAVE_IO_URING
+    if(loop->ring.fd != -1)
+        io_ring_close(&loop->ring);
+#endif
+
+    close(loop->notify.fd);
+    close(loop->shutdown.fd);
+    close(loop->epoll_fd);
+    pthread_mutex_destroy(&loop->completed_lock);
+}
+
+static void process_completions(event_loop* loop)
+{
+    eventfd_t value;
+
+    if(eventfd_read(loop->notify.fd, &value) == -1)
+        return;
+
+    pthread_mutex_lock(&loop->completed_lock);
+    struct job* job = loop->completed;
+    struct chunk* chunk = loop->chunks;
+    loop->completed = NULL;
+    loop->chunks = loop->chunks_last = NULL;
+    pthread_mutex_unlock(&loop->completed_lock);
+
+    /* A job hands its last chunk over before it is completed, so its chunks go first. */
+    while(chunk != NULL)
+    {
+        struct chunk* next = chunk->next;
+        conn_receive_chunk(loop, chunk);
+        chunk = next;
+    }
+
+    while(job != NULL)
+    {
+        struct job* next = job->next;
+        connection* conn = job->conn;
+        response* resp = conn != NULL ? conn_find_stream(conn, job) : NULL;
+
+        if(conn != NULL)
+            conn_detach_job(conn, job);
+
+        histogram_observe(&loop->durations[job->client_type][DURATION_COMMAND], job->exec_ns);
+
+        /* The result of a streamed job was already handed over, its response may even be finished. */
+        if(job->stream)
+        {
+            if(resp != NULL)
+                resp->job = NULL;
+
+            /* The response of a stalled stream will never be complete, the client is dropped. */
+            if(job->stalled && conn != NULL)
+            {
+                printf("Error: el cliente %d no confirmó ningún paquete en %d segundos, se cierra la conexión.\n", conn->handle.fd, STREAM_STALL_TIMEOUT);
+                shutdown(conn->handle.fd, SHUT_RDWR);
+            }
+
+            free_job(job);
+            job = next;
+            continue;
+        }
+
+        /* The responses of a pipelined connection are started one after the other, in completion order. */
+        if(conn != NULL && conn->options.flags & HANDSHAKE_PIPELINE)
+        {
+            job->next = NULL;
+
+            if(conn->ready_last != NULL)
+                conn->ready_last->next = job;
+            else
+                conn->ready = job;
+            conn->ready_last = job;
+
+            conn_next_response(loop, conn);
+
+            job = next;
+            continue;
+        }
+
+        if(conn != NULL)
+        {
+            conn_start_response(loop, conn, job->result, job->request_id);
+            job->result = NULL;
+        }
+
+        free_job(job);
+        job = next;
+    }
+}
+
+static void accept_clients(event_loop* loop, int listen_fd)
+{
+    /* Every pending client is accepted at once, a burst of connections costs a single wake up. */
+    while(1)
+    {
+        int client_socket = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if(client_socket == -1)
+        {
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            /* Out of descriptors the rest stay in the backlog, the level triggered listeners would wake the loop
+             * up again right away, so they are not watched until one of its connections is closed. */
+            if(errno == EMFILE || errno == ENFILE)
+                listeners_pause(loop);
+            else if(errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("Error al aceptar la conexión del cliente.\n");
+            return;
+        }
+
+        connection* conn = calloc(1, sizeof(connection));
+        if(conn == NULL)
+        {
+            printf("Error: no se pudo asignar memoria para la conexión.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        conn->handle.type = HANDLE_CONNECTION;
+        conn->handle.fd = client_socket;
+        conn->state = CONN_HANDSHAKE;
+        conn->events = EPOLLIN;
+        atomic_store_explicit(&conn->stats.client_type, -1, memory_order_relaxed);
+
+        struct epoll_event event;
+        event.events = conn->events;
+        event.data.ptr = conn;
+
+        if(epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, client_socket, &event) == -1)
+        {
+            perror("epoll_ctl() client failed");
+            close(client_socket);
+            free(conn);
+            continue;
+        }
+
+        conn_registry_add(&loop->registry, client_socket, conn);
+    }
+}
+
+static void listeners_pause(event_loop* loop)
+{
+    if(loop->listeners_paused)
+        return;
+
+    perror("Error al aceptar la conexión del cliente, no se aceptan más hasta cerrar una conexión.\n");
+
+    for(int i = 0; i < loop->num_listeners; i++)
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, loop->listeners[i].fd, NULL);
+
+    loop->listeners_paused = 1;
+}
+
+static void listeners_resume(event_loop* loop)
+{
+    struct epoll_event event;
+
+    /* EPOLLEXCLUSIVE cannot be modified, the listeners are added again. */
+    event.events = EPOLLIN | EPOLLEXCLUSIVE;
+
+    for(int i = 0; i < loop->num_listeners; i++)
+    {
+        event.data.ptr = &loop->listeners[i];
+
+        if(epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->listeners[i].fd, &event) == -1)
+            perror("epoll_ctl() listener failed");
+    }
+
+    loop->listeners_paused = 0;
+}
+
+static void close_connection(event_loop* loop, connection* conn)
+{
+    if(conn->state != CONN_HANDSHAKE)
+        printf("Cliente %d tipo %c desconectado, peticiones: %zu, bytes recibidos: %zu, bytes enviados: %zu.\n",
+               conn->handle.fd, GET_CLIENT_TYPE_LETTER(conn->client_type), atomic_load(&conn->stats.counters[COUNTER_REQUESTS]),
+               atomic_load(&conn->stats.counters[COUNTER_BYTES_RECEIVED]), atomic_load(&conn->stats.counters[COUNTER_BYTES_SENT]));
+
+    for(struct job* job = conn->jobs; job != NULL; job = job->sibling)
+    {
+        job->conn = NULL;
+
+        if(job->stream)
+            job_stream_cancel(job);
+    }
+
+    if(conn->subscriptions > 0)
+        conn_unsubscribe(loop, conn, -1);
+
+    if(conn->follows > 0)
+        conn_unfollow(loop, conn);
+
+    while(conn->ready != NULL)
+    {
+        struct job* next = conn->ready->next;
+        free_job(conn->ready);
+        conn->ready = next;
+    }
+
+    if(conn->flushing)
+    {
+        connection** link = &loop->flushes;
+        while(*link != conn)
+            link = &(*link)->flush_next;
+        *link = conn->flush_next;
+    }
+
+    conn_registry_remove(&loop->registry, conn->handle.fd, &conn->stats);
+
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, conn->handle.fd, NULL);
+    close(conn->handle.fd);
+
+    if(loop->listeners_paused)
+        listeners_resume(loop);
+
+    while(conn->responses != NULL)
+    {
+        response* next = conn->responses->next;
+        conn_free_response(conn->responses);
+        conn->responses = next;
+    }
+
+    receive_window_free(&conn->receiving);
+    compressor_free(&conn->compression);
+    buffer_free(&conn->in);
+    buffer_free(&conn->out);
+    buffer_free(&conn->command);
+
+    for(size_t i = conn->queue_head; i < conn->queue_len; i++)
+        free(conn->owned[i]);
+
+    free(conn->queue);
+    free(conn->owned);
+    free(conn);
+}
+
+static int conn_read(event_loop* loop, connection* conn)
+{
+    (void)loop;
+
+    while(1)
+    {
+        buffer_reserve(&conn->in, READ_CHUNK_SIZE);
+
+        ssize_t rec = recv(conn->handle.fd, conn->in.data + conn->in.len, READ_CHUNK_SIZE, 0);
+
+        if(rec > 0)
+        {
+            conn->in.len += (size_t)rec;
+            conn_count(conn, COUNTER_BYTES_RECEIVED, (size_t)rec);
+            continue;
+        }
+
+        if(rec == 0)
+            return -1;
+
+        if(errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+
+        if(errno != EINTR)
+            return -1;
+    }
+}
+
+static int conn_flush(event_loop* loop, connection* conn)
+{
+    while(conn->out.off < conn->out.len)
+    {
+        ssize_t sent = send(conn->handle.fd, conn->out.data + conn->out.off, conn->out.len - conn->out.off, MSG_NOSIGNAL);
+
+        loop->send_calls++;
+
+        if(sent == -1)
+        {
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            if(errno == EINTR)
+                continue;
+
+            return -1;
+        }
+
+        conn_count(conn, COUNTER_BYTES_SENT, (size_t)sent);
+        buffer_consume(&conn->out, (size_t)sent);
+    }
+
+    while(conn->out.off == conn->out.len && conn->queue_head < conn->queue_len)
+    {
+        struct msghdr msg;
+        size_t iovcnt = conn->queue_len - conn->queue_head;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = conn->queue + conn->queue_head;
+        msg.msg_iovlen = iovcnt < IOV_MAX ? iovcnt : IOV_MAX;
+
+        ssize_t sent = sendmsg(conn->handle.fd, &msg, MSG_NOSIGNAL);
+
+        loop->send_calls++;
+
+        if(sent == -1)
+        {
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            if(errno == EINTR)
+                continue;
+
+            return -1;
+        }
+
+        conn_count(conn, COUNTER_BYTES_SENT, (size_t)sent);
+        conn_consume_queue(conn, (size_t)sent);
+    }
+
+    conn_update_events(loop, conn);
+
+    return 0;
+}
+
+static void conn_send(event_loop* loop, connection* conn, const void* data, size_t size)
+{
+    /* The out buffer goes before the queue, so while there are slices queued the data is queued after them as a copy. */
+    if(conn->queue_head < conn->queue_len)
+    {
+        void* copy = malloc(size);
+        if(copy == NULL)
+        {
+            printf("Error: no se pudo asignar memoria para la cola de envío.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        memcpy(copy, data, size);
+        conn_queue(conn, copy, size);
+        conn->owned[conn->queue_len - 1] = copy;
+        conn_write(loop, conn);
+        return;
+    }
+
+    buffer_append(&conn->out, data, size);
+    conn_write(loop, conn);
+}
+
+static void conn_queue(connection* conn, const void* data, size_t size)
+{
+    if(size == 0)
+        return;
+
+    if(conn->queue_len == conn->queue_cap)
+    {
+        size_t cap = conn->queue_cap ? conn->queue_cap * 2 : 16;
+        struct iovec* queue = realloc(conn->queue, cap * sizeof(struct iovec));
+        void** owned = queue != NULL ? realloc(conn->owned, cap * sizeof(void*)) : NULL;
+
+        if(queue == NULL || owned == NULL)
+        {
+            printf("Error: no se pudo asignar memoria para la cola de envío.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        conn->queue = queue;
+        conn->owned = owned;
+        conn->queue_cap = cap;
+    }
+
+    conn->owned[conn->queue_len] = NULL;
+    conn->queue[conn->queue_len].iov_base = (void*)data;
+    conn->queue[conn->queue_len++].iov_len = size;
+}
+
+static void conn_write(event_loop* loop, connection* conn)
+{
+    if(conn->events & EPOLLOUT || conn->flushing)
+        return;
+
+    /* The bytes written during a round are sent at its end, so the small writes of a packet share the system calls. */
+    conn->flushing = 1;
+    conn->flush_next = loop->flushes;
+    loop->flushes = conn;
+}
+
+static void conn_consume_queue(connection* conn, size_t sent)
+{
+    while(sent > 0 && sent >= conn->queue[conn->queue_head].iov_len)
+    {
+        sent -= conn->queue[conn->queue_head].iov_len;
+        free(conn->owned[conn->queue_head]);
+        conn->owned[conn->queue_head++] = NULL;
+    }
+
+    if(sent > 0)
+    {
+        conn->queue[conn->queue_head].iov_base = (char*)conn->queue[conn->queue_head].iov_base + sent;
+        conn->queue[conn->queue_head].iov_len -= sent;
+    }
+
+    if(conn->queue_head == conn->queue_len)
+        conn->queue_head = conn->queue_len = 0;
+}
+
+static void conn_count(connection* conn, counter_t counter, size_t value)
+{
+    /* Only the event loop writes the counters, the relaxed adds just keep a scrape from reading them torn. */
+    atomic_fetch_add_explicit(&conn->stats.counters[counter], value, memory_order_relaxed);
+}
+
+static void flush_connections(event_loop* loop)
+{
+#ifdef HAVE_IO_URING
+    if(loop->ring.fd != -1)
+    {
+        /* Resuming a followed query may write to the connections again, they are sent in the next batch. */
+        while(loop->flushes != NULL)
+            ring_flush(loop);
+        return;
+    }
+#endif
+
+    while(loop->flushes != NULL)
+    {
+        connection* conn = loop->flushes;
+
+        loop->flushes = conn->flush_next;
+        conn->flushing = 0;
+
+        /* If the client went away, epoll reports it on the next round and the connection is closed there. */
+        if(conn_flush(loop, conn) == 0 && conn->follows > 0)
+            conn_resume_follows(loop, conn);
+    }
+}
+
+#ifdef HAVE_IO_URING
+static void ring_flush(event_loop* loop)
+{
+    unsigned count = 0;
+
+    /* Each connection sends its out buffer or, once it is empty, its queued slices, like conn_flush(). */
+    while(loop->flushes != NULL && count < IO_RING_ENTRIES)
+    {
+        connection* conn = loop->flushes;
+        ring_send* send = &loop->ring_sends[count];
+        struct io_uring_sqe* sqe;
+
+        loop->flushes = conn->flush_next;
+        conn->flushing = 0;
+
+        if(conn->out.off == conn->out.len && conn->queue_head == conn->queue_len)
+            continue;
+
+        sqe = io_ring_get_sqe(&loop->ring);
+
+        send->conn = conn;
+        send->queue = conn->out.off == conn->out.len;
+
+        if(!send->queue)
+        {
+            send->size = conn->out.len - conn->out.off;
+
+            sqe->opcode = IORING_OP_SEND;
+            sqe->addr = (uint64_t)(uintptr_t)(conn->out.data + conn->out.off);
+            sqe->len = (uint32_t)send->size;
+        }
+        else
+        {
+            size_t iovcnt = conn->queue_len - conn->queue_head;
+
+            memset(&send->msg, 0, sizeof(send->msg));
+            send->msg.msg_iov = conn->queue + conn->queue_head;
+            send->msg.msg_iovlen = iovcnt < IOV_MAX ? iovcnt : IOV_MAX;
+
+            send->size = 0;
+            for(size_t i = 0; i < send->msg.msg_iovlen; i++)
+                send->size += send->msg.msg_iov[i].iov_len;
+
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->addr = (uint64_t)(uintptr_t)&send->msg;
+            sqe->len = 1;
+        }
+
+        /* A full socket completes the send with -EAGAIN instead of leaving it waiting in the kernel. */
+        sqe->fd = conn->handle.fd;
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_DONTWAIT;
+        sqe->user_data = count++;
+    }
+
+    if(count == 0)
+        return;
+
+    loop->send_calls++;
+
+    if(io_ring_submit(&loop->ring) == -1)
+    {
+        perror("Error en io_uring_enter, envío de respuestas.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct io_uring_cqe* cqe;
+
+    while((cqe = io_ring_peek(&loop->ring)) != NULL)
+    {
+        ring_send* send = &loop->ring_sends[cqe->user_data];
+        connection* conn = send->conn;
+        int res = cqe->res;
+
+        io_ring_seen(&loop->ring);
+
+        /* If the client went away, epoll reports it on the next round and the connection is closed there. */
+        if(res < 0 && res != -EAGAIN)
+            continue;
+
+        if(res > 0)
+            conn_count(conn, COUNTER_BYTES_SENT, (size_t)res);
+
+        if(res > 0 && send->queue)
+            conn_consume_queue(conn, (size_t)res);
+        else if(res > 0)
+            buffer_consume(&conn->out, (size_t)res);
+
+        /* Everything submitted was sent and there is more, it goes in the next batch. Otherwise the socket is full. */
+        if((size_t)res == send->size && (conn->out.off < conn->out.len || conn->queue_head < conn->queue_len))
+        {
+            conn_write(loop, conn);
+            continue;
+        }
+
+        conn_update_events(loop, conn);
+
+        if(conn->follows > 0)
+            conn_resume_follows(loop, conn);
+    }
+}
+#endif
+
+static void conn_update_events(event_loop* loop, connection* conn)
+{
+    uint32_t events = EPOLLIN;
+
+    if(conn->out.off < conn->out.len || conn->queue_head < conn->queue_len)
+        events |= EPOLLOUT;
+
+    if(events == conn->events)
+        return;
+
+    struct epoll_event event;
+    event.events = events;
+    event.data.ptr = conn;
+
+    if(epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, conn->handle.fd, &event) == -1)
+        perror("epoll_ctl() modify failed");
+
+    conn->events = events;
+}
+
+static void conn_process_input(event_loop* loop, connection* conn)
+{
+    while(1)
+    {
+        size_t available = conn->in.len - conn->in.off;
+        char* data = conn->in.data + conn->in.off;
+
+        switch(conn->state)
+        {
+        case CONN_HANDSHAKE:
+            if(available < sizeof(client_t))
+                return;
+
+            int hello;
+            memcpy(&hello, data, sizeof(client_t));
+            buffer_consume(&conn->in, sizeof(client_t));
+
+            int negotiate = hello & CLIENT_NEGOTIATE;
+            conn->client_type = (client_t)(hello & ~CLIENT_NEGOTIATE);
+
+            if(conn->client_type != CLIENT_A && conn->client_type != CLIENT_B && conn->client_type != CLIENT_C)
+            {
+                printf("Error: cliente no válido.\n");
+                shutdown(conn->handle.fd, SHUT_RDWR);
+                return;
+            }
+
+            atomic_store_explicit(&conn->stats.client_type, (int)conn->client_type, memory_order_relaxed);
+            printf("Cliente %d tipo %c conectado.\n", conn->handle.fd, GET_CLIENT_TYPE_LETTER(conn->client_type));
+            handshake_default(&conn->options);
+            conn->state = negotiate ? CONN_NEGOTIATE : CONN_NUM_PACKETS;
+            break;
+
+        case CONN_NEGOTIATE:
+            if(available < sizeof(handshake))
+                return;
+
+            handshake offer, limits;
+            memcpy(&offer, data, sizeof(handshake));
+            buffer_consume(&conn->in, sizeof(handshake));
+
+            memset(&limits, 0, sizeof(limits));
+            limits.wire_format = server_config.wire_formats;
+            limits.window = server_config.window;
+            limits.checksum = server_config.checksums;
+            limits.flags = HANDSHAKE_PIPELINE | HANDSHAKE_STREAM;
+            limits.packet_size = conn_packet_size(conn);
+
+            if(handshake_select(&offer, &limits, &conn->options) == -1)
+            {
+                printf("Error: negociación no válida del cliente %d.\n", conn->handle.fd);
+                shutdown(conn->handle.fd, SHUT_RDWR);
+                return;
+            }
+
+            conn_send(loop, conn, &conn->options, sizeof(handshake));
+            conn->state = conn->options.flags & HANDSHAKE_PIPELINE ? CONN_RECORD : CONN_NUM_PACKETS;
+            break;
+
+        case CONN_NUM_PACKETS:
+            if(available < sizeof(size_t))
+                return;
+
+            memcpy(&conn->num_packets, data, sizeof(size_t));
+            buffer_consume(&conn->in, sizeof(size_t));
+
+            conn->packets_received = 0;
+            conn->command.len = conn->command.off = 0;
+
+            if(conn->num_packets == 0)
+            {
+                conn_execute(loop, conn);
+                break;
+            }
+
+            uint32_t window = window_size(&conn->options);
+
+            if(window > 1)
+                receive_window_init(&conn->receiving, conn->num_packets < window ? (uint32_t)conn->num_packets : window, &conn->options);
+
+            conn->state = CONN_PACKET_SIZE;
+            break;
+
+        case CONN_PACKET_SIZE:
+            if(conn->options.wire_format == WIRE_BINARY)
+            {
+                if(available < sizeof(frame_header))
+                    return;
+
+                memcpy(&conn->frame, data, sizeof(frame_header));
+                buffer_consume(&conn->in, sizeof(frame_header));
+
+                /* Clients never compress their messages. */
+                if(frame_unformat(&conn->frame) == -1 || conn->frame.flags & FRAME_COMPRESSED || conn->frame.length > conn->options.packet_size)
+                {
+                    printf("Error: cabecera de paquete inválida del cliente %d.\n", conn->handle.fd);
+                    shutdown(conn->handle.fd, SHUT_RDWR);
+                    return;
+                }
+
+                conn->json_size = conn->frame.length;
+                conn->state = CONN_PACKET_BODY;
+                break;
+            }
+
+            if(available < sizeof(size_t))
+                return;
+
+            memcpy(&conn->json_size, data, sizeof(size_t));
+            buffer_consume(&conn->in, sizeof(size_t));
+
+            conn->state = CONN_PACKET_BODY;
+            break;
+
+        case CONN_PACKET_BODY:
+            if(available < conn->json_size)
+                return;
+
+            conn_receive_packet(loop, conn);
+            break;
+
+        case CONN_EXECUTING:
+            return;
+
+        case CONN_SENDING:
+            if(conn_receive_ack(loop, conn) == -1)
+                return;
+            break;
+
+        case CONN_RECORD:
+            if(conn_receive_record(loop, conn) == -1)
+                return;
+            break;
+        }
+    }
+}
+
+static int conn_receive_ack(event_loop* loop, connection* conn)
+{
+    size_t available = conn->in.len - conn->in.off;
+    char* data = conn->in.data + conn->in.off;
+    checksum_status status;
+    size_t sequence;
+    size_t next_sequence;
+
+    if(window_size(&conn->options) > 1)
+    {
+        window_ack ack;
+
+        if(available < sizeof(window_ack))
+            return -1;
+
+        memcpy(&ack, data, sizeof(window_ack));
+        buffer_consume(&conn->in, sizeof(window_ack));
+
+        status = (checksum_status)ntohl(ack.status);
+        sequence = ntohl(ack.sequence);
+        next_sequence = ntohl(ack.next_sequence);
+    }
+    else
+    {
+        if(available < sizeof(checksum_status))
+            return -1;
+
+        memcpy(&status, data, sizeof(checksum_status));
+        buffer_consume(&conn->in, sizeof(checksum_status));
+
+        sequence = conn->responses->packet_index;
+        next_sequence = status == CHECKSUM_OK ? sequence + 1 : sequence;
+    }
+
+    return conn_apply_ack(loop, conn, conn->responses, status, sequence, next_sequence);
+}
+
+static int conn_apply_ack(event_loop* loop, connection* conn, response* resp, checksum_status status, size_t sequence, size_t next_sequence)
+{
+    if(sequence >= resp->next_packet)
+    {
+        printf("Error: confirmación no válida del cliente %d.\n", conn->handle.fd);
+        shutdown(conn->handle.fd, SHUT_RDWR);
+        return -1;
+    }
+
+    /* A packet before packet_index was already released, its slot may hold a newer one. */
+    if(sequence < resp->packet_index)
+        return 0;
+
+    if(status == CHECKSUM_FAIL)
+    {
+        conn_count(conn, COUNTER_RETRANSMITS, 1);
+        conn_send_packet(conn, resp, sequence, resp->packets[sequence % resp->slots].resend_offset);
+        conn_write(loop, conn);
+        return 0;
+    }
+
+    resp->acked[sequence % resp->slots] = 1;
+
+    for(; resp->packet_index < resp->packets_count && (resp->packet_index < next_sequence || resp->acked[resp->packet_index % resp->slots]); resp->packet_index++)
+        conn_release_packet(resp, resp->packet_index);
+
+    if(resp->packet_index < resp->packets_count || !resp->complete)
+    {
+        conn_fill_window(loop, conn, resp);
+        return 0;
+    }
+
+    conn_finish_response(loop, conn, resp);
+
+    return 0;
+}
+
+static int conn_receive_record(event_loop* loop, connection* conn)
+{
+    size_t available = conn->in.len - conn->in.off;
+    char* data = conn->in.data + conn->in.off;
+    record_header record;
+
+    if(available < sizeof(record_header))
+        return -1;
+
+    memcpy(&record, data, sizeof(record_header));
+    uint32_t request_id = ntohl(record.request_id);
+
+    if(record.type == RECORD_REQUEST)
+    {
+        if(available < sizeof(record_header) + sizeof(frame_header))
+            return -1;
+
+        memcpy(&conn->frame, data + sizeof(record_header), sizeof(frame_header));
+
+        /* A request is a single frame, the commands are much smaller than the packet size. */
+        if(frame_unformat(&conn->frame) == -1 || conn->frame.flags & FRAME_COMPRESSED || !(conn->frame.flags & FRAME_LAST) || conn->frame.length > conn->options.packet_size)
+        {
+            printf("Error: cabecera de paquete inválida del cliente %d.\n", conn->handle.fd);
+            shutdown(conn->handle.fd, SHUT_RDWR);
+            return -1;
+        }
+
+        if(available < sizeof(record_header) + sizeof(frame_header) + conn->frame.length)
+            return -1;
+
+        buffer_consume(&conn->in, sizeof(record_header) + sizeof(frame_header));
+        int ret = conn_receive_request(loop, conn, request_id);
+        buffer_consume(&conn->in, conn->frame.length);
+        return ret;
+    }
+
+    if(record.type == RECORD_ACK)
+    {
+        window_ack ack;
+
+        if(available < sizeof(record_header) + sizeof(window_ack))
+            return -1;
+
+        memcpy(&ack, data + sizeof(record_header), sizeof(window_ack));
+        buffer_consume(&conn->in, sizeof(record_header) + sizeof(window_ack));
+
+        response* resp = conn->responses;
+
+        while(resp != NULL && resp->id != request_id)
+            resp = resp->next;
+
+        if(resp != NULL)
+            return conn_apply_ack(loop, conn, resp, (checksum_status)ntohl(ack.status), ntohl(ack.sequence), ntohl(ack.next_sequence));
+    }
+
+    printf("Error: registro no válido del cliente %d.\n", conn->handle.fd);
+    shutdown(conn->handle.fd, SHUT_RDWR);
+    return -1;
+}
+
+static int conn_receive_request(event_loop* loop, connection* conn, uint32_t request_id)
+{
+    data_packet packet;
+    record_header record;
+    window_ack ack;
+
+    memset(&packet, 0, sizeof(packet));
+    packet.data = conn->in.data + conn->in.off;
+    packet.size = packet.length = conn->frame.length;
+    packet.crc_checksum = conn->frame.crc_checksum;
+
+    checksum_status status = checksum_verify(&packet, (checksum_algorithm)conn->options.checksum);
+
+    if(status == CHECKSUM_OK && conn->pending >= MAX_PIPELINE_REQUESTS)
+    {
+        printf("Error: el cliente %d superó el máximo de peticiones en curso.\n", conn->handle.fd);
+        shutdown(conn->handle.fd, SHUT_RDWR);
+        return -1;
+    }
+
+    /* The record and the acknowledgement go out together, so they are never split by other queued data. */
+    char reply[sizeof(record_header) + sizeof(window_ack)];
+
+    record_format(&record, RECORD_ACK, request_id);
+    window_ack_format(&ack, status == CHECKSUM_OK ? 1 : 0, 0, status);
+    memcpy(reply, &record, sizeof(record));
+    memcpy(reply + sizeof(record), &ack, sizeof(ack));
+    conn_send(loop, conn, reply, sizeof(reply));
+
+    if(status == CHECKSUM_FAIL)
+        return 0;
+
+    conn->command.len = conn->command.off = 0;
+    buffer_append(&conn->command, packet.data, packet.length);
+    buffer_append(&conn->command, "", 1);
+
+    conn->pending++;
+    conn_count(conn, COUNTER_REQUESTS, 1);
+
+    /* A subscription lives in the event loop, only the updates are read from the sampler. */
+    if(conn->client_type == CLIENT_C && loop->sampler != NULL && conn_subscribe(loop, conn, conn->command.data, request_id) == 0)
+        return 0;
+
+    if(conn->client_type != CLIENT_C && conn_follow(loop, conn, conn->command.data, request_id) == 0)
+        return 0;
+
+    conn_submit(loop, conn, conn->command.data, request_id);
+
+    return 0;
+}
+
+static void conn_receive_packet(event_loop* loop, connection* conn)
+{
+    data_packet packet;
+
+    /* A binary payload is used where it was received, it is only consumed once it was stored. */
+    if(conn->options.wire_format == WIRE_BINARY)
+    {
+        memset(&packet, 0, sizeof(packet));
+        packet.data = conn->in.data + conn->in.off;
+        packet.size = packet.length = conn->json_size;
+        packet.crc_checksum = conn->frame.crc_checksum;
+        packet.flag_last = (u_int8_t)(conn->frame.flags & FRAME_LAST);
+        packet.sequence = conn->frame.sequence;
+
+        conn_store_packet(loop, conn, &packet);
+        buffer_consume(&conn->in, conn->json_size);
+        return;
+    }
+
+    char* data_packet_json_string = calloc(conn->json_size + 1, sizeof(char));
+
+    memcpy(data_packet_json_string, conn->in.data + conn->in.off, conn->json_size);
+    buffer_consume(&conn->in, conn->json_size);
+
+    data_packet_init(&packet, conn->options.packet_size);
+    json_unformat(data_packet_json_string, &packet);
+    free(data_packet_json_string);
+
+    conn_store_packet(loop, conn, &packet);
+    data_packet_free(&packet);
+}
+
+static void conn_store_packet(event_loop* loop, connection* conn, data_packet* packet)
+{
+    if(window_size(&conn->options) > 1)
+    {
+        checksum_status status = receive_window_store(&conn->receiving, packet, &conn->command);
+        window_ack ack;
+
+        conn->packets_received += receive_window_advance(&conn->receiving);
+
+        window_ack_format(&ack, conn->receiving.next_sequence, packet->sequence, status);
+        conn_send(loop, conn, &ack, sizeof(ack));
+
+        if(conn->packets_received < conn->num_packets)
+        {
+            conn->state = CONN_PACKET_SIZE;
+            return;
+        }
+
+        receive_window_free(&conn->receiving);
+        conn_execute(loop, conn);
+        return;
+    }
+
+    checksum_status status = checksum_verify(packet, (checksum_algorithm)conn->options.checksum);
+    conn_send(loop, conn, &status, sizeof(status));
+
+    if(status == CHECKSUM_FAIL)
+        return;
+
+    buffer_append(&conn->command, packet->data, packet->length);
+
+    if(++conn->packets_received < conn->num_packets && !packet->flag_last)
+    {
+        conn->state = CONN_PACKET_SIZE;
+        return;
+    }
+
+    conn_execute(loop, conn);
+}
+
+static uint32_t conn_packet_size(connection* conn)
+{
+    struct sockaddr_storage address;
+    socklen_t length = sizeof(address);
+
+    if(server_config.packet_size != 0)
+        return server_config.packet_size;
+
+    if(getsockname(conn->handle.fd, (struct sockaddr*)&address, &length) == 0 && address.ss_family == AF_UNIX)
+        return UNIX_PACKET_SIZE;
+
+    return INET_PACKET_SIZE;
+}
+
+static void conn_execute(event_loop* loop, connection* conn)
+{
+    buffer_append(&conn->command, "", 1);
+
+    conn->state = CONN_EXECUTING;
+    conn_count(conn, COUNTER_REQUESTS, 1);
+    conn_submit(loop, conn, conn->command.data + conn->command.off, 0);
+}
+
+static void conn_submit(event_loop* loop, connection* conn, const char* command, uint32_t request_id)
+{
+    printf("Cliente %d tipo %c envió: %s\n", conn->handle.fd, GET_CLIENT_TYPE_LETTER(conn->client_type), command);
+
+    struct job* job = calloc(1, sizeof(struct job));
+    if(job == NULL)
+    {
+        printf("Error: no se pudo asignar memoria para el trabajo.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    job->loop = loop;
+    job->conn = conn;
+    job->client_type = conn->client_type;
+    job->request_id = request_id;
+    job->command = strdup(command);
+    job->sibling = conn->jobs;
+
+    /* Only one response is sent at a time outside pipelining, so the journal can be streamed. */
+    if(conn->options.flags & HANDSHAKE_STREAM && !(conn->options.flags & HANDSHAKE_PIPELINE) && conn->client_type != CLIENT_C)
+        job_stream_init(job, conn->options.packet_size, 2 * window_size(&conn->options));
+
+    conn->jobs = job;
+    thread_pool_submit(loop->pool, job);
+}
+
+static void conn_detach_job(connection* conn, struct job* job)
+{
+    struct job** link = &conn->jobs;
+
+    while(*link != NULL && *link != job)
+        link = &(*link)->sibling;
+
+    if(*link != NULL)
+        *link = job->sibling;
+
+    job->conn = NULL;
+    job->sibling = NULL;
+}
+
+static void conn_start_response(event_loop* loop, connection* conn, char* result, uint32_t id)
+{
+    if(result == NULL)
+        result = strdup("Error: el servidor no pudo ejecutar el comando.");
+
+    size_t data_size = strlen(result);
+    size_t num_packets = packet_count(data_size, &conn->options);
+
+    packet_slice* slices = data_packing(result, data_size, num_packets, &conn->options);
+
+    response* resp = conn_add_response(conn, id, num_packets ? num_packets : 1);
+
+    resp->data = result;
+    resp->size = data_size;
+    resp->packets_count = num_packets;
+    resp->complete = 1;
+
+    for(size_t i = 0; i < num_packets; i++)
+    {
+        resp->packets[i] = encode_packet(&slices[i], &conn->options, conn->client_type == CLIENT_B ? &conn->compression : NULL);
+        conn_count(conn, COUNTER_ENCODED_BYTES, resp->packets[i].size + resp->packets[i].payload_size);
+    }
+
+    conn_count(conn, COUNTER_PAYLOAD_BYTES, data_size);
+
+    free(slices);
+
+    /* The header is copied, a response without packets is freed before it is sent. */
+    if(conn->options.flags & HANDSHAKE_PIPELINE)
+    {
+        char header[sizeof(record_header) + sizeof(uint32_t)];
+        record_header record;
+        uint32_t count = htonl((uint32_t)num_packets);
+
+        record_format(&record, RECORD_RESPONSE, id);
+        memcpy(header, &record, sizeof(record));
+        memcpy(header + sizeof(record), &count, sizeof(count));
+        conn_send(loop, conn, header, sizeof(header));
+
+        record_format(&resp->frame_record, RECORD_FRAME, id);
+    }
+    else
+    {
+        char header[sizeof(u_int8_t) + sizeof(size_t)];
+
+        header[0] = SERVER_MESSAGE;
+        memcpy(header + sizeof(u_int8_t), &num_packets, sizeof(size_t));
+        conn_send(loop, conn, header, sizeof(header));
+
+        conn->state = CONN_SENDING;
+    }
+
+    if(num_packets == 0)
+    {
+        conn_finish_response(loop, conn, resp);
+        return;
+    }
+
+    conn_fill_window(loop, conn, resp);
+}
+
+static response* conn_add_response(connection* conn, uint32_t id, size_t slots)
+{
+    response* resp = calloc(1, sizeof(response));
+    if(resp == NULL)
+    {
+        printf("Error: no se pudo asignar memoria para la respuesta.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    resp->id = id;
+    resp->slots = slots;
+    resp->started_ns = monotonic_ns();
+    resp->packets = calloc(slots, sizeof(encoded_packet));
+    resp->acked = calloc(slots, sizeof(u_int8_t));
+
+    if(resp->packets == NULL || resp->acked == NULL)
+    {
+        printf("Error: no se pudo asignar memoria para la respuesta.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    response** last = &conn->responses;
+    while(*last != NULL)
+        last = &(*last)->next;
+    *last = resp;
+
+    return resp;
+}
+
+static void conn_receive_chunk(event_loop* loop, struct chunk* chunk)
+{
+    connection* conn = chunk->job->conn;
+
+    if(conn == NULL)
+    {
+        free(chunk->data);
+        free(chunk);
+        return;
+    }
+
+    response* resp = conn_find_stream(conn, chunk->job);
+
+    /* The first chunk starts the response, its number of packets is not known yet. */
+    if(resp == NULL)
+    {
+        char header[sizeof(u_int8_t) + sizeof(size_t)];
+        size_t num_packets = STREAM_PACKETS;
+
+        resp = conn_add_response(conn, 0, chunk->job->max_chunks);
+        resp->job = chunk->job;
+        resp->chunks = calloc(resp->slots, sizeof(char*));
+
+        if(resp->chunks == NULL)
+        {
+            printf("Error: no se pudo asignar memoria para la respuesta.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        header[0] = SERVER_MESSAGE;
+        memcpy(header + sizeof(u_int8_t), &num_packets, sizeof(size_t));
+        conn_send(loop, conn, header, sizeof(header));
+
+        conn->state = CONN_SENDING;
+    }
+
+    packet_slice slice;
+    size_t slot = resp->packets_count % resp->slots;
+
+    slice.data = chunk->data;
+    slice.length = chunk->size;
+    slice.sequence = (uint32_t)resp->packets_count;
+    slice.flag_last = (u_int8_t)chunk->last;
+    slice.crc_checksum = checksum_compute((checksum_algorithm)conn->options.checksum, chunk->data, chunk->size);
+
+    resp->packets[slot] = encode_packet(&slice, &conn->options, conn->client_type == CLIENT_B ? &conn->compression : NULL);
+    conn_count(conn, COUNTER_PAYLOAD_BYTES, chunk->size);
+    conn_count(conn, COUNTER_ENCODED_BYTES, resp->packets[slot].size + resp->packets[slot].payload_size);
+    resp->chunks[slot] = chunk->data;
+    resp->packets_count++;
+    resp->size += chunk->size;
+    resp->complete = chunk->last;
+
+    free(chunk);
+
+    conn_fill_window(loop, conn, resp);
+}
+
+static response* conn_find_stream(connection* conn, struct job* job)
+{
+    response* resp = conn->responses;
+
+    while(resp != NULL && (resp->job != job || job == NULL))
+        resp = resp->next;
+
+    return resp;
+}
+
+static void conn_finish_response(event_loop* loop, connection* conn, response* resp)
+{
+    printf("Mensaje enviado al cliente %d de tamaño %ld[Kb].\n", conn->handle.fd, resp->size);
+
+    histogram_observe(&loop->durations[conn->client_type][DURATION_SEND], monotonic_ns() - resp->started_ns);
+
+    response** link = &conn->responses;
+    while(*link != resp)
+        link = &(*link)->next;
+    *link = resp->next;
+
+    conn_free_response(resp);
+
+    if(!(conn->options.flags & HANDSHAKE_PIPELINE))
+    {
+        conn->state = CONN_NUM_PACKETS;
+        return;
+    }
+
+    conn->pending--;
+    conn_next_response(loop, conn);
+}
+
+static void conn_next_response(event_loop* loop, connection* conn)
+{
+    struct job* job = conn->ready;
+    response* last = conn->responses;
+
+    while(last != NULL && last->next != NULL)
+        last = last->next;
+
+    /* A response starts once every packet of the previous one was sent, only the resends are mixed with it. */
+    if(job == NULL || (last != NULL && last->next_packet < last->packets_count))
+        return;
+
+    conn->ready = job->next;
+    if(conn->ready == NULL)
+        conn->ready_last = NULL;
+
+    conn_start_response(loop, conn, job->result, job->request_id);
+    job->result = NULL;
+    free_job(job);
+}
+
+static void conn_send_packet(connection* conn, response* resp, size_t index, size_t offset)
+{
+    encoded_packet* out = &resp->packets[index % resp->slots];
+
+    if(conn->options.flags & HANDSHAKE_PIPELINE)
+        conn_queue(conn, &resp->frame_record, sizeof(record_header));
+
+    if(offset < out->size)
+        conn_queue(conn, out->data + offset, out->size - offset);
+
+    conn_queue(conn, out->payload, out->payload_size);
+}
+
+static void conn_fill_window(event_loop* loop, connection* conn, response* resp)
+{
+    size_t window = window_size(&conn->options);
+
+    for(; resp->next_packet < resp->packets_count && resp->next_packet < resp->packet_index + window; resp->next_packet++)
+        conn_send_packet(conn, resp, resp->next_packet, 0);
+
+    conn_write(loop, conn);
+
+    if(conn->options.flags & HANDSHAKE_PIPELINE && resp->next_packet == resp->packets_count)
+        conn_next_response(loop, conn);
+}
+
+static void conn_release_packet(response* resp, size_t sequence)
+{
+    size_t slot = sequence % resp->slots;
+
+    resp->acked[slot] = 0;
+    free(resp->packets[slot].data);
+    resp->packets[slot].data = NULL;
+
+    if(resp->chunks == NULL)
+        return;
+
+    free(resp->chunks[slot]);
+    resp->chunks[slot] = NULL;
+
+    if(resp->job != NULL)
+        job_stream_release(resp->job);
+}
+
+static void conn_free_response(response* resp)
+{
+    for(size_t i = resp->packet_index; i < resp->packets_count; i++)
+        conn_release_packet(resp, i);
+
+    free(resp->packets);
+    free(resp->acked);
+    free(resp->chunks);
+    free(resp->data);
+    free(resp);
+}
+
+static int conn_subscribe(event_loop* loop, connection* conn, const char* command, uint32_t request_id)
+{
+    static const char* const metrics[] = {"freeram", "loads"};
+    char name[16];
+    unsigned long interval;
+    char extra;
+    int metric = -1;
+    int unsubscribe;
+    int words;
+    char* result;
+
+    if(!strncmp(command, "subscribe ", 10))
+    {
+        unsubscribe = 0;
+        words = sscanf(command, "subscribe %15s %lu %c", name, &interval, &extra);
+    }
+    else if(!strcmp(command, "unsubscribe") || !strncmp(command, "unsubscribe ", 12))
+    {
+        unsubscribe = 1;
+        words = sscanf(command, "unsubscribe %15s %c", name, &extra);
+    }
+    else
+        return -1;
+
+    printf("Cliente %d tipo %c envió: %s\n", conn->handle.fd, GET_CLIENT_TYPE_LETTER(conn->client_type), command);
+
+    for(int i = 0; words > 0 && i < (int)(sizeof(metrics) / sizeof(metrics[0])); i++)
+        if(!strcmp(name, metrics[i]))
+            metric = i;
+
+    result = calloc(SUBSCRIBE_RESULT_SIZE, sizeof(char));
+    if(result == NULL)
+    {
+        printf("Error: no se pudo asignar memoria para el buffer.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(unsubscribe && (words < 1 || (words == 1 && metric != -1)))
+        snprintf(result, SUBSCRIBE_RESULT_SIZE, "Suscripciones canceladas: %zu.", conn_unsubscribe(loop, conn, metric));
+    else if(unsubscribe || words != 2 || metric == -1)
+        snprintf(result, SUBSCRIBE_RESULT_SIZE, "Uso: subscribe <freeram|loads> <milisegundos>, unsubscribe [freeram|loads]");
+    else if(interval < SUBSCRIBE_MIN_INTERVAL)
+        snprintf(result, SUBSCRIBE_RESULT_SIZE, "Error: el intervalo mínimo es %d[ms].", SUBSCRIBE_MIN_INTERVAL);
+    else if(conn->subscriptions >= MAX_SUBSCRIPTIONS)
+        snprintf(result, SUBSCRIBE_RESULT_SIZE, "Error: máximo de %d suscripciones por conexión.", MAX_SUBSCRIPTIONS);
+    else
+    {
+        subscription* sub = calloc(1, sizeof(subscription));
+        if(sub == NULL)
+        {
+            printf("Error: no se pudo asignar memoria para la suscripción.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        /* The first update goes out on the next round of the loop, right after the reply. */
+        sub->conn = conn;
+        sub->id = request_id;
+        sub->metric = (metric_t)metric;
+        sub->interval_ns = (uint64_t)interval * 1000000;
+        sub->due_ns = monotonic_ns();
+        sub->next = loop->subscriptions;
+        loop->subscriptions = sub;
+        conn->subscriptions++;
+
+        snprintf(result, SUBSCRIBE_RESULT_SIZE, "Suscrito a %s cada %lu[ms].", metrics[metric], interval);
+        timer_arm(loop);
+    }
+
+    conn_reply(loop, conn, result, request_id);
+
+    return 0;
+}
+
+static size_t conn_unsubscribe(event_loop* loop, connection* conn, int metric)
+{
+    subscription** link = &loop->subscriptions;
+    size_t removed = 0;
+
+    while(*link != NULL)
+    {
+        subscription* sub = *link;
+
+        if(sub->conn != conn || (metric != -1 && sub->metric != (metric_t)metric))
+        {
+            link = &sub->next;
+            continue;
+        }
+
+        *link = sub->next;
+        free(sub);
+        removed++;
+    }
+
+    conn->subscriptions -= removed;
+    timer_arm(loop);
+
+    return removed;
+}
+
+static void conn_reply(event_loop* loop, connection* conn, char* result, uint32_t request_id)
+{
+    struct job* job = calloc(1, sizeof(struct job));
+    if(job == NULL)
+    {
+        printf("Error: no se pudo asignar memoria para el trabajo.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    job->client_type = conn->client_type;
+    job->request_id = request_id;
+    job->result = result;
+
+    /* The reply is answered like a completed job, after the responses already waiting. */
+    if(conn->ready_last != NULL)
+        conn->ready_last->next = job;
+    else
+        conn->ready = job;
+    conn->ready_last = job;
+
+    conn_next_response(loop, conn);
+}
+
+static void publish_updates(event_loop* loop)
+{
+    push_frame frames[MAX_PUSH_FRAMES];
+    size_t num_frames = 0;
+    sysinfo_snapshot snapshot;
+    uint64_t expirations;
+    int sampled = 0;
+
+    if(read(loop->timer.fd, &expirations, sizeof(expirations)) == -1)
+        return;
+
+    uint64_t now = monotonic_ns();
+
+    for(subscription* sub = loop->subscriptions; sub != NULL; sub = sub->next)
+    {
+        if(sub->due_ns > now)
+            continue;
+
+        /* The updates follow a grid of the interval, so the subscribers with the same interval are due together
+         * and share the encoded update. A late subscriber skips the updates it missed. */
+        sub->due_ns = (now / sub->interval_ns + 1) * sub->interval_ns;
+
+        /* The socket is full, the update is dropped and the next one replaces it. */
+        if(sub->conn->events & EPOLLOUT)
+        {
+            loop->push_drops++;
+            continue;
+        }
+
+        /* Every subscriber due now receives the same sample. */
+        if(!sampled)
+        {
+            sysinfo_sampler_read(loop->sampler, &snapshot);
+            sampled = 1;
+        }
+
+        push_frame* frame = push_encode(loop, frames, &num_frames, &snapshot, sub->metric, sub->conn->options.checksum);
+        record_header record;
+
+        record_format(&record, RECORD_PUSH, sub->id);
+        memcpy(frame->data, &record, sizeof(record));
+        conn_send(loop, sub->conn, frame->data, frame->size);
+
+        loop->pushes++;
+    }
+
+    timer_arm(loop);
+}
+
+static push_frame* push_encode(event_loop* loop, push_frame* frames, size_t* num_frames, const sysinfo_snapshot* snapshot, metric_t metric, uint8_t checksum)
+{
+    for(size_t i = 0; i < *num_frames; i++)
+        if(frames[i].metric == metric && frames[i].checksum == checksum)
+            return &frames[i];
+
+    push_frame* frame = &frames[(*num_frames)++];
+    const char* payload = metric == METRIC_FREERAM ? snapshot->freeram : snapshot->loads;
+
+    frame->metric = metric;
+    frame->checksum = checksum;
+    frame->size = push_format(frame->data, payload, (uint32_t)strlen(payload), checksum);
+
+    loop->push_encodes++;
+
+    return frame;
+}
+
+static void timer_arm(event_loop* loop)
+{
+    struct itimerspec spec;
+    uint64_t due = 0;
+
+    memset(&spec, 0, sizeof(spec));
+
+    for(subscription* sub = loop->subscriptions; sub != NULL; sub = sub->next)
+        if(due == 0 || sub->due_ns < due)
+            due = sub->due_ns;
+
+    /* A zero time disarms the timer, an update already due makes it expire at once. */
+    if(due != 0)
+    {
+        spec.it_value.tv_sec = (time_t)(due / 1000000000);
+        spec.it_value.tv_nsec = (long)(due % 1000000000);
+    }
+
+    if(timerfd_settime(loop->timer.fd, TFD_TIMER_ABSTIME, &spec, NULL) == -1)
+        perror("timerfd_settime() failed");
+}
+
+static size_t push_format(char* data, const char* payload, uint32_t length, uint8_t checksum)
+{
+    frame_header header;
+
+    /* The record header is left to the caller, it carries the identifier of each receiver. */
+    frame_format(&header, FRAME_LAST, length, 0, checksum_compute((checksum_algorithm)checksum, payload, length));
+    memcpy(data + sizeof(record_header), &header, sizeof(header));
+    memcpy(data + sizeof(record_header) + sizeof(header), payload, length);
+
+    return sizeof(record_header) + sizeof(header) + length;
+}
+
+static int conn_follow(event_loop* loop, connection* conn, const char* command, uint32_t request_id)
+{
+    struct journal_query query;
+    follow_feed* feed;
+    char* result;
+    int r = 0;
+
+    if(!strcmp(command, "unfollow"))
+    {
+        printf("Cliente %d tipo %c envió: %s\n", conn->handle.fd, GET_CLIENT_TYPE_LETTER(conn->client_type), command);
+
+        result = calloc(SUBSCRIBE_RESULT_SIZE, sizeof(char));
+        if(result == NULL)
+        {
+            printf("Error: no se pudo asignar memoria para el buffer.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        snprintf(result, SUBSCRIBE_RESULT_SIZE, "Seguimientos cancelados: %zu.", conn_unfollow(loop, conn));
+        conn_reply(loop, conn, result, request_id);
+        return 0;
+    }
+
+    if(strcmp(command, "follow") && strncmp(command, "follow ", 7))
+        return -1;
+
+    printf("Cliente %d tipo %c envió: %s\n", conn->handle.fd, GET_CLIENT_TYPE_LETTER(conn->client_type), command);
+
+    /* Only the filters are followed, the entries already written are read with a normal query. */
+    if(journal_parse(command + 6, &query) == -1 || query.reverse || query.lines != -1 || query.since != JOURNAL_NO_TIME || query.until != JOURNAL_NO_TIME)
+    {
+        conn_reply(loop, conn, strdup("Uso: follow [-u <unidad>] [-p <prioridad>] [-b [<arranque>]] [-k], unfollow"), request_id);
+        return 0;
+    }
+
+    if(conn->follows >= MAX_FOLLOWS)
+    {
+        result = calloc(SUBSCRIBE_RESULT_SIZE, sizeof(char));
+        if(result == NULL)
+        {
+            printf("Error: no se pudo asignar memoria para el buffer.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        snprintf(result, SUBSCRIBE_RESULT_SIZE, "Error: máximo de %d seguimientos por conexión.", MAX_FOLLOWS);
+        conn_reply(loop, conn, result, request_id);
+        return 0;
+    }
+
+    /* journal_parse() clears the query, so two commands with the same filters give the same bytes. */
+    for(feed = loop->feeds; feed != NULL; feed = feed->next)
+        if(!memcmp(&feed->query, &query, sizeof(query)))
+            break;
+
+    if(feed == NULL)
+    {
+        struct epoll_event event;
+
+        feed = calloc(1, sizeof(follow_feed));
+        if(feed == NULL)
+        {
+            printf("Error: no se pudo asignar memoria para el seguimiento.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        if((r = journal_follow_open(&feed->reader, &query)) >= 0)
+        {
+            memcpy(&feed->query, &query, sizeof(query));
+            feed->handle.type = HANDLE_FOLLOW;
+            feed->handle.fd = r;
+
+            event.events = EPOLLIN;
+            event.data.ptr = &feed->handle;
+
+            if(epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, feed->handle.fd, &event) == -1)
+            {
+                r = -errno;
+                journal_reader_close(&feed->reader);
+            }
+        }
+
+        if(r < 0)
+        {
+            result = calloc(SUBSCRIBE_RESULT_SIZE, sizeof(char));
+            if(result == NULL)
+            {
+                printf("Error: no se pudo asignar memoria para el buffer.\n");
+                exit(EXIT_FAILURE);
+            }
+
+            snprintf(result, SUBSCRIBE_RESULT_SIZE, "Error: no se puede seguir el journal (%s).", strerror(-r));
+            conn_reply(loop, conn, result, request_id);
+            free(feed);
+            return 0;
+        }
+
+        feed->next = loop->feeds;
+        loop->feeds = feed;
+    }
+
+    follower* new_follower = calloc(1, sizeof(follower));
+    if(new_follower == NULL)
+    {
+        printf("Error: no se pudo asignar memoria para el seguimiento.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    new_follower->conn = conn;
+    new_follower->id = request_id;
+    new_follower->next = feed->followers;
+    feed->followers = new_follower;
+    conn->follows++;
+
+    conn_reply(loop, conn, strdup("Siguiendo las entradas nuevas del journal."), request_id);
+
+    return 0;
+}
+
+static size_t conn_unfollow(event_loop* loop, connection* conn)
+{
+    follow_feed* feed = loop->feeds;
+    size_t removed = 0;
+
+    while(feed != NULL)
+    {
+        follow_feed* next = feed->next;
+        follower** link = &feed->followers;
+
+        while(*link != NULL)
+        {
+            follower* current = *link;
+
+            if(current->conn != conn)
+            {
+                link = &current->next;
+                continue;
+            }
+
+            *link = current->next;
+            free(current);
+            removed++;
+        }
+
+        /* The journal is closed with its last follower. */
+        if(feed->followers == NULL)
+            feed_close(loop, feed);
+
+        feed = next;
+    }
+
+    conn->follows -= removed;
+
+    return removed;
+}
+
+static size_t conn_queued(connection* conn)
+{
+    size_t queued = conn->out.len - conn->out.off;
+
+    for(size_t i = conn->queue_head; i < conn->queue_len; i++)
+        queued += conn->queue[i].iov_len;
+
+    return queued;
+}
+
+static void feed_read(event_loop* loop, follow_feed* feed)
+{
+    int r = sd_journal_process(feed->reader.journal);
+
+    if(r == SD_JOURNAL_APPEND || r == SD_JOURNAL_INVALIDATE)
+        feed_drain(loop, feed);
+}
+
+static void feed_drain(event_loop* loop, follow_feed* feed)
+{
+    /* A batch is read only while some follower has room, so the query advances at the pace of its fastest follower. */
+    do{
+        follow_chunk* chunks = NULL;
+        size_t num_chunks = 0;
+        size_t chunk_start = 0;
+        size_t entries = 0;
+        buffer out;
+        int r;
+
+        memset(&out, 0, sizeof(out));
+
+        /* The new entries are cut in frames at the end of an entry, only an entry longer than a frame is split. */
+        while(out.len < FOLLOW_BATCH_SIZE)
+        {
+            size_t start = out.len;
+
+            if((r = journal_reader_next(&feed->reader, &out)) <= 0)
+                break;
+
+            loop->follow_entries++;
+
+            if(out.len - chunk_start > FOLLOW_FRAME_SIZE && entries > 0)
+            {
+                feed_chunk(&chunks, &num_chunks, chunk_start, start - chunk_start, entries);
+                chunk_start = start;
+                entries = 0;
+            }
+
+            entries++;
+
+            while(out.len - chunk_start > FOLLOW_FRAME_SIZE)
+            {
+                feed_chunk(&chunks, &num_chunks, chunk_start, FOLLOW_FRAME_SIZE, entries);
+                chunk_start += FOLLOW_FRAME_SIZE;
+                entries = 0;
+            }
+        }
+
+        feed->backlog = out.len >= FOLLOW_BATCH_SIZE;
+
+        if(r < 0)
+            printf("Error: no se pudieron leer las entradas nuevas del journal (%s).\n", strerror(-r));
+
+        if(out.len > chunk_start)
+            feed_chunk(&chunks, &num_chunks, chunk_start, out.len - chunk_start, entries);
+
+        for(follower* current = feed->followers; current != NULL; current = current->next)
+            for(size_t i = 0; i < num_chunks; i++)
+                feed_push(loop, current, &chunks[i], out.data);
+
+        for(size_t i = 0; i < num_chunks; i++)
+            for(size_t j = 0; j <= CHECKSUM_XXH3; j++)
+                free(chunks[i].encoded[j]);
+
+        free(chunks);
+        buffer_free(&out);
+    }while(feed->backlog && feed_room(feed));
+}
+
+static int feed_room(follow_feed* feed)
+{
+    for(follower* current = feed->followers; current != NULL; current = current->next)
+        if(conn_queued(current->conn) < FOLLOW_MAX_QUEUED / 2)
+            return 1;
+
+    return 0;
+}
+
+static void conn_resume_follows(event_loop* loop, connection* conn)
+{
+    follow_feed* feed = loop->feeds;
+
+    if(conn_queued(conn) >= FOLLOW_MAX_QUEUED / 2)
+        return;
+
+    while(feed != NULL)
+    {
+        follow_feed* next = feed->next;
+
+        if(feed->backlog)
+            for(follower* current = feed->followers; current != NULL; current = current->next)
+                if(current->conn == conn)
+                {
+                    feed_drain(loop, feed);
+                    break;
+                }
+
+        feed = next;
+    }
+}
+
+static void feed_chunk(follow_chunk** chunks, size_t* num_chunks, size_t offset, size_t length, size_t entries)
+{
+    follow_chunk* grown = realloc(*chunks, (*num_chunks + 1) * sizeof(follow_chunk));
+    if(grown == NULL)
+    {
+        printf("Error: no se pudo asignar memoria para el seguimiento.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(&grown[*num_chunks], 0, sizeof(follow_chunk));
+    grown[*num_chunks].offset = offset;
+    grown[*num_chunks].length = length;
+    grown[(*num_chunks)++].entries = entries;
+
+    *chunks = grown;
+}
+
+static void feed_push(event_loop* loop, follower* follower, follow_chunk* chunk, const char* entries)
+{
+    connection* conn = follower->conn;
+    uint8_t checksum = conn->options.checksum;
+    record_header record;
+
+    /* A slow follower loses the entries instead of making the server keep them, the others are not held back. */
+    if(conn_queued(conn) > FOLLOW_MAX_QUEUED)
+    {
+        follower->dropped += chunk->entries;
+        loop->follow_drops += chunk->entries;
+        return;
+    }
+
+    /* The entries dropped meanwhile are reported once, in a single line before the next ones. */
+    if(follower->dropped > 0)
+    {
+        char notice[sizeof(record_header) + sizeof(frame_header) + SUBSCRIBE_RESULT_SIZE];
+        char text[SUBSCRIBE_RESULT_SIZE];
+        int length = snprintf(text, sizeof(text), "-- %zu entradas descartadas --\n", follower->dropped);
+        size_t size = push_format(notice, text, (uint32_t)length, checksum);
+
+        record_format(&record, RECORD_PUSH, follower->id);
+        memcpy(notice, &record, sizeof(record));
+        conn_send(loop, conn, notice, size);
+
+        follower->dropped = 0;
+    }
+
+    if(chunk->encoded[checksum] == NULL)
+    {
+        chunk->encoded[checksum] = malloc(sizeof(record_header) + sizeof(frame_header) + chunk->length);
+        if(chunk->encoded[checksum] == NULL)
+        {
+            printf("Error: no se pudo asignar memoria para el seguimiento.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        push_format(chunk->encoded[checksum], entries + chunk->offset, (uint32_t)chunk->length, checksum);
+    }
+
+    record_format(&record, RECORD_PUSH, follower->id);
+    memcpy(chunk->encoded[checksum], &record, sizeof(record));
+    conn_send(loop, conn, chunk->encoded[checksum], sizeof(record_header) + sizeof(frame_header) + chunk->length);
+
+    loop->follow_pushes++;
+}
+
+static void feed_close(event_loop* loop, follow_feed* feed)
+{
+    follow_feed** link = &loop->feeds;
+
+    while(*link != feed)
+        link = &(*link)->next;
+    *link = feed->next;
+
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, feed->handle.fd, NULL);
+
+    /* Its event may still be pending in the round, so it is freed once the round is over. */
+    feed->next = loop->closed_feeds;
+    loop->closed_feeds = feed;
+}
+
+static void free_closed_feeds(event_loop* loop)
+{
+    while(loop->closed_feeds != NULL)
+    {
+        follow_feed* feed = loop->closed_feeds;
+
+        loop->closed_feeds = feed->next;
+        journal_reader_close(&feed->reader);
+        free(feed);
+    }
+}
@@ -0,0 +1,150 @@
+/**
+ * @file io_ring.c
+ *
+ * @brief Source file for the io_uring instance used by the event loop.
+ *
+ * @details The queues are mapped as described by io_uring_setup(2). The server is the only producer
+ * of the submission queue and the only consumer of the completion queue, so the shared indexes only
+ * need acquire and release accesses.
+ *
+ * @author Robledo, Valentín
+ * @date Mayo 2023
+ * @version 1.0
+ *
+ * @copyright Copyright (c) 2023
+ */
+
+#include "../inc/io_ring.h"
+
+int io_ring_init(io_ring* ring, unsigned entries)
+{
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if(ring->fd == -1)
+        return -1;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if(params.features & IORING_FEAT_SINGLE_MMAP && ring->cq_ring_size > ring->sq_ring_size)
+        ring->sq_ring_size = ring->cq_ring_size;
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if(ring->sq_ring == MAP_FAILED)
+    {
+        close(ring->fd);
+        return -1;
+    }
+
+    ring->cq_ring = ring->sq_ring;
+
+    if(!(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if(ring->cq_ring == MAP_FAILED)
+        {
+            munmap(ring->sq_ring, ring->sq_ring_size);
+            close(ring->fd);
+            return -1;
+        }
+    }
+
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED)
+    {
+        if(ring->cq_ring != ring->sq_ring)
+            munmap(ring->cq_ring, ring->cq_ring_size);
+        munmap(ring->sq_ring, ring->sq_ring_size);
+        close(ring->fd);
+        return -1;
+    }
+
+    ring->sq_tail = (unsigned*)((char*)ring->sq_ring + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)((char*)ring->sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)((char*)ring->sq_ring + params.sq_off.array);
+    ring->cq_head = (unsigned*)((char*)ring->cq_ring + params.cq_off.head);
+    ring->cq_tail = (unsigned*)((char*)ring->cq_ring + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)((char*)ring->cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)((char*)ring->cq_ring + params.cq_off.cqes);
+    ring->entries = params.sq_entries;
+
+    return 0;
+}
+
+struct io_uring_sqe* io_ring_get_sqe(io_ring* ring)
+{
+    if(ring->queued == ring->entries)
+        return NULL;
+
+    unsigned tail = *ring->sq_tail + ring->queued;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->queued++;
+
+    return sqe;
+}
+
+int io_ring_submit(io_ring* ring)
+{
+    unsigned queued = ring->queued;
+    unsigned submit = queued;
+
+    if(queued == 0)
+        return 0;
+
+    /* The entries are visible to the kernel before the new tail. */
+    atomic_store_explicit((_Atomic unsigned*)ring->sq_tail, *ring->sq_tail + queued, memory_order_release);
+    ring->queued = 0;
+
+    /* A wait interrupted by a signal returns once the entries were submitted, the rest of the completions are waited for again. */
+    while(1)
+    {
+        unsigned ready = atomic_load_explicit((_Atomic unsigned*)ring->cq_tail, memory_order_acquire) - *ring->cq_head;
+
+        if(submit == 0 && ready >= queued)
+            return (int)queued;
+
+        if(syscall(__NR_io_uring_enter, ring->fd, submit, queued - ready, IORING_ENTER_GETEVENTS, NULL, 0) == -1)
+        {
+            if(errno == EINTR)
+                continue;
+
+            return -1;
+        }
+
+        submit = 0;
+    }
+}
+
+struct io_uring_cqe* io_ring_peek(io_ring* ring)
+{
+    unsigned head = *ring->cq_head;
+
+    if(head == atomic_load_explicit((_Atomic unsigned*)ring->cq_tail, memory_order_acquire))
+        return NULL;
+
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+void io_ring_seen(io_ring* ring)
+{
+    atomic_store_explicit((_Atomic unsigned*)ring->cq_head, *ring->cq_head + 1, memory_order_release);
+}
+
+void io_ring_close(io_ring* ring)
+{
+    munmap(ring->sqes, ring->entries * sizeof(struct io_uring_sqe));
+
+    if(ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
@@ -0,0 +1,726 @@
+/**
+ * @file journal.c
+ *
+ * @brief Source file for the implementation of the journal query engine.
+ *
+ * @details Contains the functions that parse the journalctl options sent by the clients and read
+ * the matching entries directly with sd-journal.
+ *
+ * @author Robledo, Valentín
+ * @date Mayo 2023
+ * @version 1.0
+ *
+ * @copyright Copyright (c) 2023
+ */
+
+#define _GNU_SOURCE
+
+#include "../inc/journal.h"
+
+/* Number of entries shown by -n when no number is given. */
+#define JOURNAL_DEFAULT_LINES 10
+
+static const char* priority_names[] = {"emerg", "alert", "crit", "err", "warning", "notice", "info", "debug"};
+
+static int option_value(char** tokens, int count, int* i, const char* short_name, const char* long_name, char** value);
+static int optional_value(char** tokens, int count, int* i, const char* short_name, const char* long_name, char** value);
+static int parse_unit(const char* value, struct journal_query* query);
+static int parse_priority(const char* value, struct journal_query* query);
+static int parse_priority_level(const char* value, size_t length);
+static int parse_lines(const char* value, struct journal_query* query);
+static int parse_boot(const char* value, struct journal_query* query);
+static int parse_time(const char* value, uint64_t* usec);
+static int is_number(const char* value);
+static int is_boot_id(const char* value);
+static int add_matches(journal_reader* reader);
+static int seek_start(journal_reader* reader);
+static int format_entry(sd_journal* journal, uint64_t usec, buffer* out);
+static int append_field(sd_journal* journal, const char* field, buffer* out);
+static char* error_message(const char* message, int error);
+static int stream_error(journal_sink sink, void* arg, const char* message, int error);
+static int buffer_sink(void* arg, const char* data, size_t size);
+
+int journal_parse(const char* command, struct journal_query* query)
+{
+    char* tokens[JOURNAL_MAX_TOKENS];
+    char* line = strdup(command);
+    int count = journal_split(line, tokens);
+    int ret = count < 0 ? -1 : 0;
+
+    memset(query, 0, sizeof(*query));
+    query->priority_max = -1;
+    query->lines = -1;
+
+    for(int i = 0; i < count && ret == 0; i++)
+    {
+        char* token = tokens[i];
+        char* value = NULL;
+
+        if(!strcmp(token, "--no-pager") || !strcmp(token, "-q") || !strcmp(token, "--quiet"))
+            continue;
+        else if(!strcmp(token, "-r") || !strcmp(token, "--reverse"))
+            query->reverse = 1;
+        else if(!strcmp(token, "-k") || !strcmp(token, "--dmesg"))
+        {
+            query->kernel = 1;
+            ret = query->boot_id[0] ? 0 : parse_boot(NULL, query);
+        }
+        else if(option_value(tokens, count, &i, "-u", "--unit", &value))
+            ret = parse_unit(value, query);
+        else if(option_value(tokens, count, &i, "-p", "--priority", &value))
+            ret = parse_priority(value, query);
+        else if(option_value(tokens, count, &i, "-S", "--since", &value))
+            ret = parse_time(value, &query->since);
+        else if(option_value(tokens, count, &i, "-U", "--until", &value))
+            ret = parse_time(value, &query->until);
+        else if(optional_value(tokens, count, &i, "-n", "--lines", &value))
+            ret = parse_lines(value, query);
+        else if(optional_value(tokens, count, &i, "-b", "--boot", &value))
+            ret = parse_boot(value, query);
+        else
+            ret = -1;
+    }
+
+    free(line);
+
+    return ret;
+}
+
+int journal_reader_open(journal_reader* reader, const struct journal_query* query)
+{
+    int r;
+
+    memset(reader, 0, sizeof(*reader));
+    reader->query = *query;
+    reader->remaining = query->lines;
+
+    if((r = sd_journal_open(&reader->journal, SD_JOURNAL_LOCAL_ONLY)) < 0)
+        return r;
+
+    if((r = add_matches(reader)) < 0 || (r = seek_start(reader)) < 0)
+    {
+        journal_reader_close(reader);
+        return r;
+    }
+
+    return 0;
+}
+
+int journal_follow_open(journal_reader* reader, const struct journal_query* query)
+{
+    int r;
+
+    memset(reader, 0, sizeof(*reader));
+    reader->query = *query;
+    reader->remaining = -1;
+
+    if((r = sd_journal_open(&reader->journal, SD_JOURNAL_LOCAL_ONLY)) < 0)
+        return r;
+
+    /* The journal points to the last entry, the next one read is the first one written from now on. */
+    if((r = add_matches(reader)) < 0 || (r = sd_journal_seek_tail(reader->journal)) < 0 || (r = sd_journal_previous(reader->journal)) < 0 ||
+       (r = sd_journal_get_fd(reader->journal)) < 0)
+    {
+        journal_reader_close(reader);
+        return r;
+    }
+
+    return r;
+}
+
+int journal_reader_next(journal_reader* reader, buffer* out)
+{
+    const struct journal_query* query = &reader->query;
+
+    while(reader->remaining != 0)
+    {
+        uint64_t usec;
+        int r;
+
+        if(reader->positioned)
+        {
+            reader->positioned = 0;
+            r = 1;
+        }
+        else
+            r = query->reverse ? sd_journal_previous(reader->journal) : sd_journal_next(reader->journal);
+
+        if(r <= 0)
+            return r;
+
+        if((r = sd_journal_get_realtime_usec(reader->journal, &usec)) < 0)
+            return r;
+
+        if(query->reverse)
+        {
+            if(query->since != JOURNAL_NO_TIME && usec < query->since)
+                return 0;
+            if(query->until != JOURNAL_NO_TIME && usec > query->until)
+                continue;
+        }
+        else
+        {
+            if(query->until != JOURNAL_NO_TIME && usec > query->until)
+                return 0;
+            if(query->since != JOURNAL_NO_TIME && usec < query->since)
+                continue;
+        }
+
+        if(format_entry(reader->journal, usec, out) == 0)
+            continue;
+
+        if(reader->remaining > 0)
+            reader->remaining--;
+
+        return 1;
+    }
+
+    return 0;
+}
+
+void journal_reader_close(journal_reader* reader)
+{
+    if(reader->journal != NULL)
+        sd_journal_close(reader->journal);
+
+    reader->journal = NULL;
+}
+
+char* journal_query(const char* command)
+{
+    buffer out;
+
+    memset(&out, 0, sizeof(out));
+
+    if(journal_query_stream(command, buffer_sink, &out) == -1)
+        return NULL;
+
+    buffer_append(&out, "", 1);
+
+    return out.data;
+}
+
+int journal_query_stream(const char* command, journal_sink sink, void* arg)
+{
+    struct journal_query query;
+    journal_reader reader;
+    buffer out;
+    int written = 0;
+    int r;
+
+    if(journal_parse(command, &query) == -1)
+        return -1;
+
+    if((r = journal_reader_open(&reader, &query)) < 0)
+        return stream_error(sink, arg, "Failed to open journal", r);
+
+    memset(&out, 0, sizeof(out));
+
+    /* The last byte is held back, the newline of the last entry is not sent. */
+    while((r = journal_reader_next(&reader, &out)) > 0)
+    {
+        if(out.len - 1 < JOURNAL_STREAM_BLOCK)
+            continue;
+
+        if(sink(arg, out.data, out.len - 1) == -1)
+            break;
+
+        out.data[0] = out.data[out.len - 1];
+        out.len = 1;
+        written = 1;
+    }
+
+    journal_reader_close(&reader);
+
+    if(r < 0)
+    {
+        /* The entries already sent are completed with the ones read before the error. */
+        if(written && sink(arg, out.data, out.len) == -1)
+            r = 0;
+
+        buffer_free(&out);
+        return r < 0 ? stream_error(sink, arg, "Failed to read journal", r) : 0;
+    }
+
+    if(out.len == 0 && !written)
+        buffer_append(&out, "-- No entries --\n", strlen("-- No entries --\n"));
+
+    if(r == 0 && out.len > 1)
+        sink(arg, out.data, out.len - 1);
+
+    buffer_free(&out);
+
+    return 0;
+}
+
+int journal_split(char* line, char** tokens)
+{
+    char* read = line;
+    char* write = line;
+    int count = 0;
+
+    while(*read != '\0')
+    {
+        char quote = '\0';
+
+        while(*read == ' ' || *read == '\t')
+            read++;
+
+        if(*read == '\0')
+            break;
+
+        if(count == JOURNAL_MAX_TOKENS)
+            return -1;
+
+        tokens[count++] = write;
+
+        while(*read != '\0' && (quote != '\0' || (*read != ' ' && *read != '\t')))
+        {
+            if(quote != '\0' && *read == quote)
+                quote = '\0';
+            else if(quote == '\0' && (*read == '"' || *read == '\''))
+                quote = *read;
+            else
+                *write++ = *read;
+
+            read++;
+        }
+
+        if(quote != '\0')
+            return -1;
+
+        if(*read != '\0')
+            read++;
+
+        *write++ = '\0';
+    }
+
+    return count;
+}
+
+static int option_value(char** tokens, int count, int* i, const char* short_name, const char* long_name, char** value)
+{
+    char* token = tokens[*i];
+    size_t long_length = strlen(long_name);
+
+    if(!strcmp(token, short_name) || !strcmp(token, long_name))
+    {
+        *value = *i + 1 < count ? tokens[++(*i)] : NULL;
+        return 1;
+    }
+
+    if(!strncmp(token, long_name, long_length) && token[long_length] == '=')
+    {
+        *value = token + long_length + 1;
+        return 1;
+    }
+
+    if(!strncmp(token, short_name, strlen(short_name)))
+    {
+        *value = token + strlen(short_name);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int optional_value(char** tokens, int count, int* i, const char* short_name, const char* long_name, char** value)
+{
+    char* token = tokens[*i];
+    size_t long_length = strlen(long_name);
+
+    if(!strcmp(token, short_name) || !strcmp(token, long_name))
+    {
+        *value = NULL;
+
+        if(*i + 1 < count && (is_number(tokens[*i + 1]) || is_boot_id(tokens[*i + 1])))
+            *value = tokens[++(*i)];
+
+        return 1;
+    }
+
+    if(!strncmp(token, long_name, long_length) && token[long_length] == '=')
+    {
+        *value = token + long_length + 1;
+        return 1;
+    }
+
+    if(!strncmp(token, short_name, strlen(short_name)))
+    {
+        *value = token + strlen(short_name);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int parse_unit(const char* value, struct journal_query* query)
+{
+    if(value == NULL || *value == '\0' || strpbrk(value, "*?[") != NULL || query->num_units == JOURNAL_MAX_UNITS)
+        return -1;
+
+    int length = snprintf(query->units[query->num_units], JOURNAL_UNIT_SIZE, "%s%s", value,
+                          strchr(value, '.') == NULL ? ".service" : "");
+
+    if(length >= JOURNAL_UNIT_SIZE)
+        return -1;
+
+    query->num_units++;
+
+    return 0;
+}
+
+static int parse_priority(const char* value, struct journal_query* query)
+{
+    if(value == NULL)
+        return -1;
+
+    const char* range = strstr(value, "..");
+
+    if(range == NULL)
+    {
+        query->priority_min = 0;
+        query->priority_max = parse_priority_level(value, strlen(value));
+    }
+    else
+    {
+        query->priority_min = parse_priority_level(value, (size_t)(range - value));
+        query->priority_max = parse_priority_level(range + 2, strlen(range + 2));
+    }
+
+    if(query->priority_min < 0 || query->priority_max < 0)
+        return -1;
+
+    if(query->priority_min > query->priority_max)
+    {
+        int aux = query->priority_min;
+        query->priority_min = query->priority_max;
+        query->priority_max = aux;
+    }
+
+    return 0;
+}
+
+static int parse_priority_level(const char* value, size_t length)
+{
+    if(length == 1 && value[0] >= '0' && value[0] <= '7')
+        return value[0] - '0';
+
+    for(int i = 0; i < 8; i++)
+        if(strlen(priority_names[i]) == length && !strncmp(value, priority_names[i], length))
+            return i;
+
+    return -1;
+}
+
+static int parse_lines(const char* value, struct journal_query* query)
+{
+    if(value == NULL || *value == '\0')
+    {
+        query->lines = JOURNAL_DEFAULT_LINES;
+        return 0;
+    }
+
+    if(!strcmp(value, "all"))
+    {
+        query->lines = -1;
+        return 0;
+    }
+
+    if(!is_number(value))
+        return -1;
+
+    query->lines = strtol(value, NULL, 10);
+
+    return 0;
+}
+
+static int parse_boot(const char* value, struct journal_query* query)
+{
+    if(value == NULL || *value == '\0' || !strcmp(value, "0"))
+    {
+        sd_id128_t boot_id;
+
+        if(sd_id128_get_boot(&boot_id) < 0)
+            return -1;
+
+        sd_id128_to_string(boot_id, query->boot_id);
+        return 0;
+    }
+
+    if(!is_boot_id(value))
+        return -1;
+
+    strcpy(query->boot_id, value);
+
+    return 0;
+}
+
+static int parse_time(const char* value, uint64_t* usec)
+{
+    static const char* formats[] = {"%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d", "%H:%M:%S", "%H:%M"};
+    time_t now = time(NULL);
+    struct tm today;
+
+    if(value == NULL || *value == '\0')
+        return -1;
+
+    localtime_r(&now, &today);
+    today.tm_hour = today.tm_min = today.tm_sec = 0;
+    today.tm_isdst = -1;
+
+    if(!strcmp(value, "now"))
+    {
+        *usec = (uint64_t)now * 1000000ULL;
+        return 0;
+    }
+
+    if(!strcmp(value, "today") || !strcmp(value, "yesterday") || !strcmp(value, "tomorrow"))
+    {
+        today.tm_mday += !strcmp(value, "yesterday") ? -1 : !strcmp(value, "tomorrow") ? 1 : 0;
+        *usec = (uint64_t)mktime(&today) * 1000000ULL;
+        return 0;
+    }
+
+    if(value[0] == '-' || value[0] == '+')
+    {
+        char* unit;
+        long amount = strtol(value + 1, &unit, 10);
+        long seconds;
+
+        if(unit == value + 1)
+            return -1;
+
+        if(*unit == '\0' || !strcmp(unit, "s") || !strcmp(unit, "sec"))
+            seconds = amount;
+        else if(!strcmp(unit, "m") || !strcmp(unit, "min"))
+            seconds = amount * 60;
+        else if(!strcmp(unit, "h") || !strcmp(unit, "hour"))
+            seconds = amount * 3600;
+        else if(!strcmp(unit, "d") || !strcmp(unit, "day"))
+            seconds = amount * 86400;
+        else
+            return -1;
+
+        *usec = (uint64_t)(value[0] == '-' ? now - seconds : now + seconds) * 1000000ULL;
+        return 0;
+    }
+
+    for(size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+    {
+        struct tm tm = today;
+        char* end = strptime(value, formats[i], &tm);
+
+        if(end != NULL && *end == '\0')
+        {
+            tm.tm_isdst = -1;
+            *usec = (uint64_t)mktime(&tm) * 1000000ULL;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static int is_number(const char* value)
+{
+    if(*value == '\0')
+        return 0;
+
+    for(; *value != '\0'; value++)
+        if(*value < '0' || *value > '9')
+            return 0;
+
+    return 1;
+}
+
+static int is_boot_id(const char* value)
+{
+    if(strlen(value) != SD_ID128_STRING_MAX - 1)
+        return 0;
+
+    return strspn(value, "0123456789abcdef") == SD_ID128_STRING_MAX - 1;
+}
+
+static int add_matches(journal_reader* reader)
+{
+    const struct journal_query* query = &reader->query;
+    sd_journal* journal = reader->journal;
+    char match[JOURNAL_UNIT_SIZE + 32];
+    int r;
+
+    for(int i = 0; i < query->num_units; i++)
+    {
+        snprintf(match, sizeof(match), "_SYSTEMD_UNIT=%s", query->units[i]);
+        if((r = sd_journal_add_match(journal, match, 0)) < 0 || (r = sd_journal_add_disjunction(journal)) < 0)
+            return r;
+
+        /* Messages logged by systemd about the unit (started, stopped, failed...). */
+        snprintf(match, sizeof(match), "UNIT=%s", query->units[i]);
+        if((r = sd_journal_add_match(journal, "_PID=1", 0)) < 0 || (r = sd_journal_add_match(journal, match, 0)) < 0 ||
+           (r = sd_journal_add_disjunction(journal)) < 0)
+            return r;
+    }
+
+    if(query->num_units > 0 && (r = sd_journal_add_conjunction(journal)) < 0)
+        return r;
+
+    for(int priority = query->priority_min; priority <= query->priority_max; priority++)
+    {
+        snprintf(match, sizeof(match), "PRIORITY=%d", priority);
+        if((r = sd_journal_add_match(journal, match, 0)) < 0)
+            return r;
+    }
+
+    if(query->kernel && (r = sd_journal_add_match(journal, "_TRANSPORT=kernel", 0)) < 0)
+        return r;
+
+    if(query->boot_id[0] != '\0')
+    {
+        snprintf(match, sizeof(match), "_BOOT_ID=%s", query->boot_id);
+        if((r = sd_journal_add_match(journal, match, 0)) < 0)
+            return r;
+    }
+
+    return 0;
+}
+
+static int seek_start(journal_reader* reader)
+{
+    const struct journal_query* query = &reader->query;
+    sd_journal* journal = reader->journal;
+    int r;
+
+    /* Same starting point journalctl chooses for each combination of options. */
+    if(query->since != JOURNAL_NO_TIME && !query->reverse)
+        return sd_journal_seek_realtime_usec(journal, query->since);
+
+    if(query->until != JOURNAL_NO_TIME && query->reverse)
+        return sd_journal_seek_realtime_usec(journal, query->until + 1);
+
+    if(query->lines < 0 || query->reverse)
+        return query->reverse ? sd_journal_seek_tail(journal) : sd_journal_seek_head(journal);
+
+    /* Go back the requested number of entries and read forward from there. */
+    reader->remaining = -1;
+
+    if(query->lines == 0)
+    {
+        reader->remaining = 0;
+        return 0;
+    }
+
+    if((r = sd_journal_seek_tail(journal)) < 0 || (r = sd_journal_previous_skip(journal, (uint64_t)query->lines)) < 0)
+        return r;
+
+    if(r == 0)
+        reader->remaining = 0;
+    else
+        reader->positioned = 1;
+
+    return 0;
+}
+
+static int format_entry(sd_journal* journal, uint64_t usec, buffer* out)
+{
+    const void* data;
+    size_t length;
+    char timestamp[32];
+    struct tm tm;
+    time_t seconds = (time_t)(usec / 1000000ULL);
+
+    if(sd_journal_get_data(journal, "MESSAGE", &data, &length) < 0)
+        return 0;
+
+    size_t start = out->len;
+
+    localtime_r(&seconds, &tm);
+    strftime(timestamp, sizeof(timestamp), "%b %d %H:%M:%S ", &tm);
+    buffer_append(out, timestamp, strlen(timestamp));
+
+    append_field(journal, "_HOSTNAME", out);
+    buffer_append(out, " ", 1);
+
+    if(append_field(journal, "SYSLOG_IDENTIFIER", out) < 0 && append_field(journal, "_COMM", out) < 0)
+        buffer_append(out, "unknown", strlen("unknown"));
+
+    size_t before_pid = out->len;
+    buffer_append(out, "[", 1);
+
+    if(append_field(journal, "_PID", out) < 0 && append_field(journal, "SYSLOG_PID", out) < 0)
+        out->len = before_pid;
+    else
+        buffer_append(out, "]", 1);
+
+    buffer_append(out, ": ", 2);
+
+    size_t prefix_length = out->len - start;
+
+    if(sd_journal_get_data(journal, "MESSAGE", &data, &length) < 0)
+        return 0;
+
+    const char* message = (const char*)data + strlen("MESSAGE=");
+    length -= strlen("MESSAGE=");
+
+    /* Continuation lines are aligned with the first one, like journalctl does. */
+    for(const char* line_end; (line_end = memchr(message, '\n', length)) != NULL && (size_t)(line_end - message) + 1 < length; )
+    {
+        size_t line_length = (size_t)(line_end - message) + 1;
+
+        buffer_append(out, message, line_length);
+        buffer_reserve(out, prefix_length);
+        memset(out->data + out->len, ' ', prefix_length);
+        out->len += prefix_length;
+
+        message += line_length;
+        length -= line_length;
+    }
+
+    buffer_append(out, message, length);
+
+    if(length == 0 || message[length - 1] != '\n')
+        buffer_append(out, "\n", 1);
+
+    return 1;
+}
+
+static int append_field(sd_journal* journal, const char* field, buffer* out)
+{
+    const void* data;
+    size_t length;
+    size_t field_length = strlen(field) + 1;
+
+    if(sd_journal_get_data(journal, field, &data, &length) < 0 || length < field_length)
+        return -1;
+
+    buffer_append(out, (const char*)data + field_length, length - field_length);
+
+    return 0;
+}
+
+static int stream_error(journal_sink sink, void* arg, const char* message, int error)
+{
+    char* result = error_message(message, error);
+
+    sink(arg, result, strlen(result));
+    free(result);
+
+    return 0;
+}
+
+static int buffer_sink(void* arg, const char* data, size_t size)
+{
+    buffer_append((buffer*)arg, data, size);
+
+    return 0;
+}
+
+static char* error_message(const char* message, int error)
+{
+    size_t size = strlen(message) + strlen(strerror(-error)) + 3;
+    char* result = calloc(size, sizeof(char));
+
+    snprintf(result, size, "%s: %s", message, strerror(-error));
+
+    return result;
+}
@@ -0,0 +1,401 @@
+/**
+ * @file journal_cache.c
+ *
+ * @brief Source file for the cache of the journal query results.
+ *
+ * @details The entries are kept in a hash table to find them and in a list ordered by use to evict
+ * them. The queries being executed are kept in a short list of flights. Every worker uses the cache,
+ * so all of it is protected by a single mutex.
+ *
+ * @author Robledo, Valentín
+ * @date Mayo 2023
+ * @version 1.0
+ *
+ * @copyright Copyright (c) 2023
+ */
+
+#include "../inc/journal_cache.h"
+
+static uint32_t key_hash(const char* key, size_t size);
+static cache_entry* cache_find(journal_cache* cache, const buffer* key, uint32_t hash);
+static void cache_unlink(journal_cache* cache, cache_entry* entry);
+static void cache_remove(journal_cache* cache, cache_entry* entry);
+static void cache_clear(journal_cache* cache);
+static int entry_expired(const cache_entry* entry, const struct timespec* now);
+static void cache_store(journal_cache* cache, const buffer* key, uint64_t generation, const char* data, size_t size);
+static char* result_copy(const char* data, size_t size);
+static cache_flight* flight_find(journal_cache* cache, const buffer* key, uint32_t hash);
+static cache_flight* flight_start(journal_cache* cache, const buffer* key, uint32_t hash);
+static void flight_release(cache_flight* flight);
+
+void journal_cache_init(journal_cache* cache, size_t max_bytes)
+{
+    int r;
+
+    memset(cache, 0, sizeof(*cache));
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_cond_init(&cache->flight_cond, NULL);
+
+    cache->max_bytes = max_bytes;
+
+    if(max_bytes == 0)
+        return;
+
+    if((r = sd_journal_open(&cache->journal, SD_JOURNAL_LOCAL_ONLY)) < 0 || (r = sd_journal_get_fd(cache->journal)) < 0)
+    {
+        printf("Advertencia: no se puede vigilar el journal (%s), la caché se vacía cada %d segundos.\n", strerror(-r), JOURNAL_CACHE_TTL);
+
+        if(cache->journal != NULL)
+            sd_journal_close(cache->journal);
+
+        cache->journal = NULL;
+    }
+}
+
+int journal_cache_fd(journal_cache* cache)
+{
+    if(cache->journal == NULL)
+        return -1;
+
+    return sd_journal_get_fd(cache->journal);
+}
+
+void journal_cache_process(journal_cache* cache)
+{
+    int r = sd_journal_process(cache->journal);
+
+    if(r != SD_JOURNAL_APPEND && r != SD_JOURNAL_INVALIDATE)
+        return;
+
+    pthread_mutex_lock(&cache->lock);
+
+    cache->generation++;
+    cache->invalidations++;
+    cache_clear(cache);
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+int journal_cache_key(const char* command, buffer* key)
+{
+    char* tokens[JOURNAL_MAX_TOKENS];
+    char* line = strdup(command);
+    int count = journal_split(line, tokens);
+
+    for(int i = 0; i < count; i++)
+        buffer_append(key, tokens[i], strlen(tokens[i]) + 1);
+
+    free(line);
+
+    return count < 0 ? -1 : 0;
+}
+
+char* journal_cache_get(journal_cache* cache, const buffer* key, size_t* size, uint64_t* generation, cache_flight** flight)
+{
+    uint32_t hash = key_hash(key->data, key->len);
+    struct timespec now;
+    char* result = NULL;
+
+    *generation = 0;
+    *flight = NULL;
+
+    if(cache->max_bytes == 0)
+        return NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&cache->lock);
+
+    cache_entry* entry = cache_find(cache, key, hash);
+
+    if(entry != NULL && entry_expired(entry, &now))
+    {
+        cache_remove(cache, entry);
+        entry = NULL;
+    }
+
+    *generation = cache->generation;
+
+    if(entry == NULL)
+    {
+        cache_flight* current = flight_find(cache, key, hash);
+
+        if(current == NULL)
+        {
+            *flight = flight_start(cache, key, hash);
+            cache->misses++;
+            pthread_mutex_unlock(&cache->lock);
+            return NULL;
+        }
+
+        current->refs++;
+
+        while(!current->done)
+            pthread_cond_wait(&cache->flight_cond, &cache->lock);
+
+        /* Without a shared result the command is executed again, without coalescing the others. */
+        if(current->data != NULL)
+        {
+            result = result_copy(current->data, current->size);
+            *size = current->size;
+            cache->coalesced++;
+        }
+        else
+            cache->misses++;
+
+        *generation = cache->generation;
+        flight_release(current);
+
+        pthread_mutex_unlock(&cache->lock);
+        return result;
+    }
+
+    /* The entry goes to the front, it is the last one evicted. */
+    cache_unlink(cache, entry);
+    entry->next = cache->head;
+    if(cache->head != NULL)
+        cache->head->prev = entry;
+    cache->head = entry;
+    if(cache->tail == NULL)
+        cache->tail = entry;
+
+    result = result_copy(entry->data, entry->size);
+    *size = entry->size;
+
+    cache->hits++;
+
+    pthread_mutex_unlock(&cache->lock);
+
+    return result;
+}
+
+void journal_cache_put(journal_cache* cache, cache_flight* flight, const buffer* key, uint64_t generation, const char* data, size_t size)
+{
+    /* The result is cached before the flight leaves the list, so no identical query executes it meanwhile. */
+    cache_store(cache, key, generation, data, size);
+
+    if(flight == NULL)
+        return;
+
+    cache_flight** link = &cache->flights;
+    char* shared = NULL;
+
+    /* Once it leaves the list no query joins the flight, the result is only copied if some are waiting. */
+    pthread_mutex_lock(&cache->lock);
+    while(*link != flight)
+        link = &(*link)->next;
+    *link = flight->next;
+    int waiting = flight->refs > 1;
+    pthread_mutex_unlock(&cache->lock);
+
+    if(waiting && data != NULL)
+        shared = result_copy(data, size);
+
+    pthread_mutex_lock(&cache->lock);
+    flight->data = shared;
+    flight->size = size;
+    flight->done = 1;
+    pthread_cond_broadcast(&cache->flight_cond);
+    flight_release(flight);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void journal_cache_close(journal_cache* cache)
+{
+    cache_clear(cache);
+
+    if(cache->journal != NULL)
+        sd_journal_close(cache->journal);
+
+    cache->journal = NULL;
+    pthread_cond_destroy(&cache->flight_cond);
+    pthread_mutex_destroy(&cache->lock);
+}
+
+static uint32_t key_hash(const char* key, size_t size)
+{
+    uint32_t hash = 2166136261u;
+
+    for(size_t i = 0; i < size; i++)
+    {
+        hash ^= (uint8_t)key[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static cache_entry* cache_find(journal_cache* cache, const buffer* key, uint32_t hash)
+{
+    cache_entry* entry = cache->buckets[hash % JOURNAL_CACHE_BUCKETS];
+
+    while(entry != NULL && (entry->hash != hash || entry->key_size != key->len || memcmp(entry->key, key->data, key->len) != 0))
+        entry = entry->chain;
+
+    return entry;
+}
+
+static void cache_unlink(journal_cache* cache, cache_entry* entry)
+{
+    if(entry->prev != NULL)
+        entry->prev->next = entry->next;
+    else
+        cache->head = entry->next;
+
+    if(entry->next != NULL)
+        entry->next->prev = entry->prev;
+    else
+        cache->tail = entry->prev;
+
+    entry->prev = entry->next = NULL;
+}
+
+static void cache_remove(journal_cache* cache, cache_entry* entry)
+{
+    cache_entry** link = &cache->buckets[entry->hash % JOURNAL_CACHE_BUCKETS];
+
+    while(*link != entry)
+        link = &(*link)->chain;
+    *link = entry->chain;
+
+    cache_unlink(cache, entry);
+    cache->bytes -= entry->key_size + entry->size;
+
+    free(entry->key);
+    free(entry->data);
+    free(entry);
+}
+
+static void cache_clear(journal_cache* cache)
+{
+    while(cache->head != NULL)
+        cache_remove(cache, cache->head);
+}
+
+static int entry_expired(const cache_entry* entry, const struct timespec* now)
+{
+    return now->tv_sec - entry->stored.tv_sec > JOURNAL_CACHE_TTL ||
+           (now->tv_sec - entry->stored.tv_sec == JOURNAL_CACHE_TTL && now->tv_nsec >= entry->stored.tv_nsec);
+}
+
+static void cache_store(journal_cache* cache, const buffer* key, uint64_t generation, const char* data, size_t size)
+{
+    uint32_t hash = key_hash(key->data, key->len);
+    size_t bytes = key->len + size;
+
+    if(cache->max_bytes == 0 || data == NULL || bytes > cache->max_bytes / JOURNAL_CACHE_ENTRY_FRACTION)
+        return;
+
+    cache_entry* entry = calloc(1, sizeof(cache_entry));
+    if(entry == NULL)
+    {
+        printf("Error: no se pudo asignar memoria para la caché.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    entry->key = malloc(key->len + 1);
+    entry->data = malloc(size + 1);
+    if(entry->key == NULL || entry->data == NULL)
+    {
+        printf("Error: no se pudo asignar memoria para la caché.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(entry->key, key->data, key->len);
+    memcpy(entry->data, data, size);
+    entry->key_size = key->len;
+    entry->size = size;
+    entry->hash = hash;
+    entry->generation = generation;
+    clock_gettime(CLOCK_MONOTONIC, &entry->stored);
+
+    pthread_mutex_lock(&cache->lock);
+
+    cache_entry* old = cache_find(cache, key, hash);
+
+    /* The journal advanced while the command was executed, the result may be missing entries. */
+    if(generation != cache->generation)
+    {
+        pthread_mutex_unlock(&cache->lock);
+        free(entry->key);
+        free(entry->data);
+        free(entry);
+        return;
+    }
+
+    if(old != NULL)
+        cache_remove(cache, old);
+
+    while(cache->bytes + bytes > cache->max_bytes && cache->tail != NULL)
+    {
+        cache_remove(cache, cache->tail);
+        cache->evictions++;
+    }
+
+    entry->next = cache->head;
+    if(cache->head != NULL)
+        cache->head->prev = entry;
+    cache->head = entry;
+    if(cache->tail == NULL)
+        cache->tail = entry;
+
+    entry->chain = cache->buckets[hash % JOURNAL_CACHE_BUCKETS];
+    cache->buckets[hash % JOURNAL_CACHE_BUCKETS] = entry;
+    cache->bytes += bytes;
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+static char* result_copy(const char* data, size_t size)
+{
+    char* result = malloc(size + 1);
+    if(result == NULL)
+    {
+        printf("Error: no se pudo asignar memoria para el resultado.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(result, data, size);
+    result[size] = '\0';
+
+    return result;
+}
+
+static cache_flight* flight_find(journal_cache* cache, const buffer* key, uint32_t hash)
+{
+    cache_flight* flight = cache->flights;
+
+    while(flight != NULL && (flight->hash != hash || flight->key_size != key->len || memcmp(flight->key, key->data, key->len) != 0))
+        flight = flight->next;
+
+    return flight;
+}
+
+static cache_flight* flight_start(journal_cache* cache, const buffer* key, uint32_t hash)
+{
+    cache_flight* flight = calloc(1, sizeof(cache_flight));
+    if(flight == NULL)
+    {
+        printf("Error: no se pudo asignar memoria para la caché.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    flight->key = result_copy(key->data, key->len);
+    flight->key_size = key->len;
+    flight->hash = hash;
+    flight->refs = 1;
+    flight->next = cache->flights;
+    cache->flights = flight;
+
+    return flight;
+}
+
+static void flight_release(cache_flight* flight)
+{
+    if(--flight->refs > 0)
+        return;
+
+    free(flight->key);
+    free(flight->data);
+    free(flight);
+}
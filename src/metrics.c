@@ -0,0 +1,168 @@
+/**
+ * @file metrics.c
+ *
+ * @brief Source file for the metrics of the connections and their Prometheus text format.
+ *
+ * @details The durations are kept in fixed buckets from 100 microseconds to 2.5 seconds. The buckets
+ * are not cumulative while they are updated, they are added up when the report is written.
+ *
+ * @author Robledo, Valentín
+ * @date Mayo 2023
+ * @version 1.0
+ *
+ * @copyright Copyright (c) 2023
+ */
+
+#include <stdarg.h>
+#include "../inc/metrics.h"
+#include "../inc/server.h"
+
+/* Upper bound of each bucket but the last one, in microseconds. */
+static const uint64_t bucket_bounds_us[METRICS_BUCKETS - 1] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000
+};
+
+/* Name and description of each counter, indexed by counter_t. */
+static const char* counter_names[NUM_COUNTERS][2] = {
+    {"requests_total", "Peticiones recibidas."},
+    {"received_bytes_total", "Bytes recibidos del cliente."},
+    {"sent_bytes_total", "Bytes enviados al cliente."},
+    {"payload_bytes_total", "Bytes de las respuestas antes de codificarlas."},
+    {"encoded_payload_bytes_total", "Bytes de las respuestas codificadas en paquetes, comprimidas para el cliente B."},
+    {"retransmits_total", "Paquetes reenviados tras un CHECKSUM_FAIL del cliente."}
+};
+
+/* Name and description of each histogram, indexed by duration_t. */
+static const char* duration_names[NUM_DURATIONS][2] = {
+    {"command_duration_seconds", "Tiempo de ejecución de los comandos en el pool de hilos."},
+    {"send_duration_seconds", "Tiempo desde que empieza el envío de una respuesta hasta que se confirma su último paquete."}
+};
+
+static void format_line(buffer* out, const char* format, ...);
+
+void histogram_observe(histogram* hist, uint64_t ns)
+{
+    size_t bucket = 0;
+
+    while(bucket < METRICS_BUCKETS - 1 && ns > bucket_bounds_us[bucket] * 1000)
+        bucket++;
+
+    atomic_fetch_add_explicit(&hist->buckets[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->sum_ns, ns, memory_order_relaxed);
+}
+
+void histogram_collect(histogram_counts* counts, histogram* hist)
+{
+    for(size_t i = 0; i < METRICS_BUCKETS; i++)
+    {
+        size_t value = atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+
+        counts->buckets[i] += value;
+        counts->count += value;
+    }
+
+    counts->sum_ns += atomic_load_explicit(&hist->sum_ns, memory_order_relaxed);
+}
+
+void metrics_report_conn(metrics_report* report, int fd, conn_stats* stats)
+{
+    int client_type = atomic_load_explicit(&stats->client_type, memory_order_relaxed);
+
+    if(client_type < 0 || client_type >= NUM_CLIENT_TYPES)
+        return;
+
+    if(report->num_conns == report->conns_cap)
+    {
+        size_t cap = report->conns_cap ? report->conns_cap * 2 : 64;
+        conn_report* conns = realloc(report->conns, cap * sizeof(conn_report));
+
+        if(conns == NULL)
+        {
+            printf("Error: no se pudo asignar memoria para las métricas.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        report->conns = conns;
+        report->conns_cap = cap;
+    }
+
+    conn_report* conn = &report->conns[report->num_conns++];
+
+    conn->fd = fd;
+    conn->client_type = client_type;
+
+    for(int i = 0; i < NUM_COUNTERS; i++)
+    {
+        conn->counters[i] = atomic_load_explicit(&stats->counters[i], memory_order_relaxed);
+        report->counters[client_type][i] += conn->counters[i];
+    }
+
+    report->connections[client_type]++;
+}
+
+void metrics_format(const metrics_report* report, buffer* out)
+{
+    format_line(out, "# HELP server_connections Conexiones abiertas.\n# TYPE server_connections gauge\n");
+    for(int type = 0; type < NUM_CLIENT_TYPES; type++)
+        format_line(out, "server_connections{client=\"%c\"} %zu\n", GET_CLIENT_TYPE_LETTER(type), report->connections[type]);
+
+    for(int i = 0; i < NUM_COUNTERS; i++)
+    {
+        format_line(out, "# HELP server_%s %s\n# TYPE server_%s counter\n", counter_names[i][0], counter_names[i][1], counter_names[i][0]);
+        for(int type = 0; type < NUM_CLIENT_TYPES; type++)
+            format_line(out, "server_%s{client=\"%c\"} %zu\n", counter_names[i][0], GET_CLIENT_TYPE_LETTER(type), report->counters[type][i]);
+    }
+
+    for(int i = 0; i < NUM_DURATIONS; i++)
+    {
+        const char* name = duration_names[i][0];
+
+        format_line(out, "# HELP server_%s %s\n# TYPE server_%s histogram\n", name, duration_names[i][1], name);
+
+        for(int type = 0; type < NUM_CLIENT_TYPES; type++)
+        {
+            const histogram_counts* counts = &report->durations[type][i];
+            char letter = (char)GET_CLIENT_TYPE_LETTER(type);
+            size_t cumulative = 0;
+
+            for(size_t bucket = 0; bucket < METRICS_BUCKETS - 1; bucket++)
+            {
+                cumulative += counts->buckets[bucket];
+                format_line(out, "server_%s_bucket{client=\"%c\",le=\"%g\"} %zu\n", name, letter, (double)bucket_bounds_us[bucket] / 1e6, cumulative);
+            }
+
+            format_line(out, "server_%s_bucket{client=\"%c\",le=\"+Inf\"} %zu\n", name, letter, counts->count);
+            format_line(out, "server_%s_sum{client=\"%c\"} %.6f\n", name, letter, (double)counts->sum_ns / 1e9);
+            format_line(out, "server_%s_count{client=\"%c\"} %zu\n", name, letter, counts->count);
+        }
+    }
+
+    /* The counters of each open connection, labeled with its file descriptor. */
+    for(int i = 0; i < NUM_COUNTERS; i++)
+    {
+        format_line(out, "# HELP server_connection_%s %s\n# TYPE server_connection_%s counter\n", counter_names[i][0], counter_names[i][1], counter_names[i][0]);
+        for(size_t c = 0; c < report->num_conns; c++)
+            format_line(out, "server_connection_%s{client=\"%c\",fd=\"%d\"} %zu\n", counter_names[i][0],
+                        GET_CLIENT_TYPE_LETTER(report->conns[c].client_type), report->conns[c].fd, report->conns[c].counters[i]);
+    }
+}
+
+void metrics_report_free(metrics_report* report)
+{
+    free(report->conns);
+    report->conns = NULL;
+    report->num_conns = report->conns_cap = 0;
+}
+
+static void format_line(buffer* out, const char* format, ...)
+{
+    char line[512];
+    va_list args;
+
+    va_start(args, format);
+    int size = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    if(size > 0)
+        buffer_append(out, line, (size_t)size < sizeof(line) ? (size_t)size : sizeof(line) - 1);
+}
@@ -15,277 +15,601 @@
 
 #include "../inc/middle.h"
 
-void send_data(int client_socket, char* data, client_t client_type, msg_t msg_type)
+void send_data(int client_socket, char* data, client_t client_type, msg_t msg_type, const handshake* options, compressor* compression)
 {     
     size_t data_size = strlen(data);
-    size_t num_packets = data_size / PACKET_SIZE + (data_size % PACKET_SIZE == 0 ? 0 : 1);
+    size_t num_packets = packet_count(data_size, options);
+    compressor* packer = client_type == CLIENT_B && msg_type == SERVER_MESSAGE ? compression : NULL;
 
-    data_packet* first_packet = data_packing(data, data_size, num_packets);
-    data_packet* current_packet = first_packet;
+    packet_slice* slices = data_packing(data, data_size, num_packets, options);
     
     if(send(client_socket, &num_packets, sizeof(num_packets), 0) == -1)
         send_error_handler("Error: No se pudo enviar el número de paquetes");
 
-    for(size_t i = 0; i < num_packets; i++)
+    uint32_t window = window_size(options);
+
+    if(window > 1)
     {
-        char* data_packet_json_string = json_format(current_packet);
+        encoded_packet* packets = calloc(num_packets ? num_packets : 1, sizeof(encoded_packet));
 
-        if(client_type == CLIENT_B && msg_type == SERVER_MESSAGE)
-            send_compress_data(client_socket, data_packet_json_string);
-        else
-            send_raw_data(client_socket, data_packet_json_string);
+        for(size_t i = 0; i < num_packets; i++)
+            packets[i] = encode_packet(&slices[i], options, packer);
 
-        current_packet = current_packet->next;
+        send_window(client_socket, packets, num_packets, window);
 
-        free(data_packet_json_string);
+        for(size_t i = 0; i < num_packets; i++)
+            free(packets[i].data);
+
+        free(packets);
+    }
+    else
+    {
+        for(size_t i = 0; i < num_packets; i++)
+        {
+            encoded_packet packet = encode_packet(&slices[i], options, packer);
+
+            send_packet(client_socket, &packet);
+
+            free(packet.data);
+        }
     }
 
     if(msg_type == SERVER_MESSAGE)
         printf("Mensaje enviado al cliente %d de tamaño %ld[Kb].\n", client_socket, data_size);
 
-    free_package_list(first_packet);
+    free(slices);
 }
 
-void send_raw_data(int client_socket, char* data_packet_json_string)
+void send_packet(int client_socket, const encoded_packet* packet)
 {
     checksum_status checksum_status;
-
-    size_t json_size = strlen(data_packet_json_string);
-
-    if(send(client_socket, &json_size, sizeof(json_size), 0) == -1)
-        send_error_handler("Error: No se pudo enviar el tamaño del paquete");
+    size_t offset = 0;
 
     do{
-        if(send(client_socket, data_packet_json_string, json_size, 0) == -1)
+        if(send_encoded(client_socket, packet, offset) == -1)
             send_error_handler("Error: No se pudo enviar el paquete");
         
-        if(recv(client_socket, &checksum_status, sizeof(checksum_status), 0) == -1)
-            recv_error_handler("Error: No se pudo recibir el estado del checksum (paquete sin comprimir)");
+        if(recv(client_socket, &checksum_status, sizeof(checksum_status), MSG_WAITALL) == -1)
+            recv_error_handler("Error: No se pudo recibir el estado del checksum");
+
+        offset = packet->resend_offset;
     }while(checksum_status == CHECKSUM_FAIL);
 }
 
-void send_compress_data(int client_socket, char* data_packet_json_string)
+void send_window(int client_socket, const encoded_packet* packets, size_t num_packets, uint32_t window)
 {
-    checksum_status checksum_status;
+    u_int8_t* acked = calloc(num_packets ? num_packets : 1, sizeof(u_int8_t));
+    size_t base = 0;
+    size_t next = 0;
+
+    while(base < num_packets)
+    {
+        for(; next < num_packets && next < base + window; next++)
+            if(send_encoded(client_socket, &packets[next], 0) == -1)
+                send_error_handler("Error: No se pudo enviar el paquete");
+
+        window_ack ack;
+
+        if(recv(client_socket, &ack, sizeof(ack), MSG_WAITALL) != (ssize_t)sizeof(ack))
+            recv_error_handler("Error: No se pudo recibir el estado del checksum");
+
+        size_t next_sequence = ntohl(ack.next_sequence);
+        size_t sequence = ntohl(ack.sequence);
+
+        if(sequence >= next)
+        {
+            printf("Error: confirmación de un paquete no enviado.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        if(ntohl(ack.status) == CHECKSUM_FAIL)
+        {
+            if(send_encoded(client_socket, &packets[sequence], packets[sequence].resend_offset) == -1)
+                send_error_handler("Error: No se pudo enviar el paquete");
+
+            continue;
+        }
+
+        acked[sequence] = 1;
+
+        for(; base < num_packets && (base < next_sequence || acked[base]); base++)
+            acked[base] = 1;
+    }
+
+    free(acked);
+}
+
+ssize_t send_encoded(int client_socket, const encoded_packet* packet, size_t offset)
+{
+    struct iovec iov[2];
+    struct msghdr msg;
+    int iovcnt = 0;
+
+    if(offset < packet->size)
+    {
+        iov[iovcnt].iov_base = packet->data + offset;
+        iov[iovcnt++].iov_len = packet->size - offset;
+    }
+
+    if(packet->payload_size > 0)
+    {
+        iov[iovcnt].iov_base = (char*)packet->payload;
+        iov[iovcnt++].iov_len = packet->payload_size;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = (size_t)iovcnt;
+
+    return sendmsg(client_socket, &msg, MSG_NOSIGNAL);
+}
+
+ssize_t send_record(int client_socket, const record_header* record, const void* data, size_t size, const void* payload, size_t payload_size)
+{
+    struct iovec iov[3];
+    struct msghdr msg;
+
+    iov[0].iov_base = (void*)record;
+    iov[0].iov_len = sizeof(*record);
+    iov[1].iov_base = (void*)data;
+    iov[1].iov_len = size;
+    iov[2].iov_base = (void*)payload;
+    iov[2].iov_len = payload_size;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = payload_size > 0 ? 3 : 2;
+
+    return sendmsg(client_socket, &msg, MSG_NOSIGNAL);
+}
+
+void record_format(record_header* record, record_type type, uint32_t request_id)
+{
+    memset(record, 0, sizeof(*record));
+    record->type = (uint8_t)type;
+    record->request_id = htonl(request_id);
+}
+
+encoded_packet encode_packet(const packet_slice* packet, const handshake* options, compressor* compression)
+{
+    encoded_packet encoded;
+    buffer out;
+
+    memset(&encoded, 0, sizeof(encoded));
+    memset(&out, 0, sizeof(out));
+
+    if(options->wire_format == WIRE_BINARY)
+    {
+        frame_header header;
+        uint8_t flags = packet->flag_last ? FRAME_LAST : 0;
+        size_t payload_size = packet->length;
+
+        buffer_reserve(&out, sizeof(header));
+        out.len = sizeof(header);
+
+        /* The payload is only copied when it is compressed, otherwise it is sent from the message. */
+        if(compression != NULL)
+        {
+            payload_size = compress_packet(compression, packet->data, packet->length, &out);
+            flags |= FRAME_COMPRESSED;
+        }
+        else
+        {
+            encoded.payload = packet->data;
+            encoded.payload_size = packet->length;
+        }
+
+        frame_format(&header, flags, (uint32_t)payload_size, packet->sequence, (uint32_t)packet->crc_checksum);
+        memcpy(out.data, &header, sizeof(header));
+
+        encoded.data = out.data;
+        encoded.size = out.len;
+
+        return encoded;
+    }
+
+    char* data_packet_json_string = json_format(packet);
     size_t json_size = strlen(data_packet_json_string);
 
-    create_file(data_packet_json_string);
+    if(compression != NULL)
+    {
+        long file_size;
+        size_t header_size = sizeof(file_size) + sizeof(json_size);
+
+        buffer_reserve(&out, header_size + json_size);
+        out.len = header_size;
+
+        file_size = (long)compress_packet(compression, data_packet_json_string, json_size, &out);
 
-    FILE *file = fopen("../files/data.json.gz", "rb");
-    if (file == NULL) {
-        perror("Error al abrir archivo");
+        memcpy(out.data, &file_size, sizeof(file_size));
+        memcpy(out.data + sizeof(file_size), &json_size, sizeof(json_size));
+    }
+    else
+    {
+        buffer_append(&out, &json_size, sizeof(json_size));
+        buffer_append(&out, data_packet_json_string, json_size);
+        encoded.resend_offset = sizeof(json_size);
+    }
+
+    encoded.data = out.data;
+    encoded.size = out.len;
+
+    free(data_packet_json_string);
+
+    return encoded;
+}
+
+size_t compress_packet(compressor* compression, const char* data, size_t size, buffer* out)
+{
+    z_stream* stream = &compression->deflate;
+
+    if(!compression->deflating)
+    {
+        if(deflateInit2(stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            printf("Error: no se pudo inicializar la compresión.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        compression->deflating = 1;
+    }
+    else
+        deflateReset(stream);
+
+    size_t bound = deflateBound(stream, (uLong)size);
+    buffer_reserve(out, bound);
+
+    stream->next_in = (Bytef*)data;
+    stream->avail_in = (uInt)size;
+    stream->next_out = (Bytef*)(out->data + out->len);
+    stream->avail_out = (uInt)bound;
+
+    if(deflate(stream, Z_FINISH) != Z_STREAM_END)
+    {
+        printf("Error: no se pudo comprimir el paquete.\n");
         exit(EXIT_FAILURE);
     }
-    
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    rewind(file);
-    
-    char* buffer = (char*) malloc(sizeof(char) * (size_t)file_size);
-    fread(buffer, sizeof(char), (size_t)file_size, file);
-    fclose(file);
-    
-    if(send(client_socket, &file_size, sizeof(file_size), 0) == -1)
-        send_error_handler("Error: No se pudo enviar el tamaño del paquete comprimido");
 
-    if(send(client_socket, &json_size, sizeof(json_size), 0) == -1)
-        send_error_handler("Error: No se pudo enviar el tamaño del paquete");
+    size_t compressed_size = bound - stream->avail_out;
+    out->len += compressed_size;
 
-    do
+    return compressed_size;
+}
+
+size_t decompress_packet(compressor* compression, const char* compressed, long file_size, char* data, size_t size)
+{
+    z_stream* stream = &compression->inflate;
+
+    if(!compression->inflating)
     {
-        if(send(client_socket, buffer, (sizeof(char) * (size_t)file_size), 0) == -1)
-            send_error_handler("Error: No se pudo enviar el paquete comprimido");
+        if(inflateInit2(stream, 15 + 16) != Z_OK)
+        {
+            printf("Error: no se pudo inicializar la descompresión.\n");
+            exit(EXIT_FAILURE);
+        }
 
-        if(recv(client_socket, &checksum_status, sizeof(checksum_status), 0) == -1)
-            recv_error_handler("Error: No se pudo recibir el estado del checksum (paquete comprimido)");
-    }while(checksum_status == CHECKSUM_FAIL);
+        compression->inflating = 1;
+    }
+    else
+        inflateReset(stream);
 
-    free(buffer);
+    stream->next_in = (Bytef*)compressed;
+    stream->avail_in = (uInt)file_size;
+    stream->next_out = (Bytef*)data;
+    stream->avail_out = (uInt)size;
+
+    /* A corrupted packet is detected by its checksum and requested again. */
+    inflate(stream, Z_FINISH);
+
+    return size - stream->avail_out;
 }
 
-char* receive_data(int client_socket, client_t client_type, msg_t message_type)
+void compressor_free(compressor* compression)
+{
+    if(compression->deflating)
+        deflateEnd(&compression->deflate);
+
+    if(compression->inflating)
+        inflateEnd(&compression->inflate);
+
+    compression->deflating = 0;
+    compression->inflating = 0;
+}
+
+char* receive_data(int client_socket, client_t client_type, msg_t message_type, const handshake* options, compressor* compression, FILE* stream)
 {   
-    data_packet* first_packet = NULL;
-    data_packet* prev_packet = NULL;
-    data_packet* current_packet = NULL;
-    checksum_status checksum_status;
+    compressor* unpacker = client_type == CLIENT_B && message_type == SERVER_MESSAGE ? compression : NULL;
+    buffer message;
 
     size_t num_packets = 0;
 
-    ssize_t rec = recv(client_socket, &num_packets, sizeof(num_packets), 0);
+    ssize_t rec = recv(client_socket, &num_packets, sizeof(num_packets), MSG_WAITALL);
     if(rec == (ssize_t)-1)
         recv_error_handler("Error: No se pudo recibir el número de paquetes");
     else if(rec == (ssize_t)0) //Retorna 0 si el cliente se desconecta.
         return NULL;
 
-    for(size_t i = 0; i < num_packets; i++)
-    {  
-        size_t json_size = 0;
-        char* data_packet_json_string;
+    memset(&message, 0, sizeof(message));
+
+    if(num_packets == STREAM_PACKETS)
+        receive_stream(client_socket, options, unpacker, stream);
+    else if(window_size(options) > 1)
+        receive_window_data(client_socket, num_packets, options, unpacker, &message);
+    else
+    {
+        data_packet packet;
+
+        data_packet_init(&packet, options->packet_size);
+
+        for(size_t i = 0; i < num_packets; i++)
+        {  
+            receive_packet(client_socket, options, unpacker, &packet);
+            buffer_write_at(&message, i * options->packet_size, packet.data, packet.length);
+
+            if(packet.flag_last)
+                break;
+        }
+
+        data_packet_free(&packet);
+    }
+
+    buffer_append(&message, "", 1);
+
+    return message.data;
+}
+
+void receive_stream(int client_socket, const handshake* options, compressor* compression, FILE* stream)
+{
+    uint32_t window = window_size(options);
+    receive_window receiving;
+    data_packet packet;
+    buffer ring;
+    uint32_t last = UINT32_MAX;
+
+    data_packet_init(&packet, options->packet_size);
+
+    if(window == 1)
+    {
+        do{
+            receive_packet(client_socket, options, compression, &packet);
+            fwrite(packet.data, sizeof(char), packet.length, stream);
+        }while(!packet.flag_last);
 
-        if(client_type == CLIENT_A || client_type == CLIENT_C || (client_type == CLIENT_B && message_type == CLIENT_MESSAGE))
+        data_packet_free(&packet);
+        return;
+    }
+
+    memset(&ring, 0, sizeof(ring));
+    receive_window_init(&receiving, window, options);
+
+    receiving.lengths = calloc(window, sizeof(uint32_t));
+    if(receiving.lengths == NULL)
+    {
+        printf("Error: no se pudo asignar memoria para la ventana.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    while(last == UINT32_MAX || receiving.next_sequence <= last)
+    {
+        window_ack ack;
+
+        receive_frame(client_socket, compression, &packet);
+
+        checksum_status status = receive_window_store(&receiving, &packet, &ring);
+
+        if(status == CHECKSUM_OK && packet.flag_last)
+            last = packet.sequence;
+
+        for(uint32_t slot = receiving.next_sequence % window; receiving.filled[slot]; slot = receiving.next_sequence % window)
         {
-            if(recv(client_socket, &json_size, sizeof(json_size), 0) == -1)
-                recv_error_handler("Error: No se pudo recibir el tamaño del paquete");
+            fwrite(ring.data + (size_t)slot * receiving.packet_size, sizeof(char), receiving.lengths[slot], stream);
+            receiving.filled[slot] = 0;
+            receiving.next_sequence++;
+        }
+
+        window_ack_format(&ack, receiving.next_sequence, packet.sequence, status);
+
+        if(send(client_socket, &ack, sizeof(ack), 0) == -1)
+            send_error_handler("Error: No se pudo enviar el estado del checksum");
+    }
+
+    receive_window_free(&receiving);
+    buffer_free(&ring);
+    data_packet_free(&packet);
+}
+
+void receive_packet(int client_socket, const handshake* options, compressor* compression, data_packet* packet)
+{
+    size_t json_size = 0;
+
+    if(options->wire_format == WIRE_JSON && compression == NULL)
+        if(recv(client_socket, &json_size, sizeof(json_size), MSG_WAITALL) == -1)
+            recv_error_handler("Error: No se pudo recibir el tamaño del paquete");
 
-            data_packet_json_string = calloc(json_size, sizeof(char));
+    do{
+        if(options->wire_format == WIRE_BINARY)
+        {
+            receive_frame(client_socket, compression, packet);
+            continue;
         }
-        
-        while (1)
+
+        char* data_packet_json_string;
+
+        if(compression != NULL)
+            data_packet_json_string = receive_compress_data(client_socket, compression);
+        else
         {
-            if(client_type == CLIENT_B && message_type == SERVER_MESSAGE)
-                data_packet_json_string = receive_compress_data(client_socket);
-            else
-                if(recv(client_socket, data_packet_json_string, json_size, 0) == -1)
-                    send_error_handler("Error: No se pudo recibir el paquete");
-
-            current_packet = calloc(1, sizeof(data_packet));
-
-            json_unformat(data_packet_json_string, current_packet);
-
-            if(first_packet == NULL)
-                first_packet = current_packet;
-            else
-                prev_packet->next = current_packet;
-
-            checksum_status = checksum_check(current_packet, client_socket);
-
-            if(checksum_status == CHECKSUM_FAIL)
-            {
-                if(prev_packet != NULL)
-                    prev_packet->next = NULL;
-                else
-                    first_packet = NULL;
-            }
-            else
-                break;
+            data_packet_json_string = calloc(json_size + 1, sizeof(char));
+
+            if(recv(client_socket, data_packet_json_string, json_size, MSG_WAITALL) == -1)
+                recv_error_handler("Error: No se pudo recibir el paquete");
         }
 
+        json_unformat(data_packet_json_string, packet);
+
         free(data_packet_json_string);
+    }while(checksum_check(packet, client_socket, (checksum_algorithm)options->checksum) == CHECKSUM_FAIL);
+}
 
-        if(current_packet->flag_last)
-            break;
-        
-        prev_packet = current_packet;
-    }
+void receive_window_data(int client_socket, size_t num_packets, const handshake* options, compressor* compression, buffer* message)
+{
+    uint32_t window = window_size(options);
+    receive_window receiving;
+    data_packet packet;
+    size_t delivered = 0;
+
+    data_packet_init(&packet, options->packet_size);
+    receive_window_init(&receiving, num_packets < window ? (uint32_t)num_packets : window, options);
+
+    while(delivered < num_packets)
+    {
+        window_ack ack;
+
+        receive_frame(client_socket, compression, &packet);
 
-    char* unpacked_data = data_unpacking(first_packet, num_packets);
+        checksum_status status = receive_window_store(&receiving, &packet, message);
+        delivered += receive_window_advance(&receiving);
 
-    free_package_list(first_packet);
+        window_ack_format(&ack, receiving.next_sequence, packet.sequence, status);
 
-    return unpacked_data;
+        if(send(client_socket, &ack, sizeof(ack), 0) == -1)
+            send_error_handler("Error: No se pudo enviar el estado del checksum");
+    }
+
+    receive_window_free(&receiving);
+    data_packet_free(&packet);
 }
 
-void free_package_list(data_packet* first_packet)
+void receive_frame(int client_socket, compressor* compression, data_packet* packet)
 {
-    data_packet* current_packet = first_packet;
-    data_packet* aux;
+    frame_header header;
+
+    if(recv(client_socket, &header, sizeof(header), MSG_WAITALL) == -1)
+        recv_error_handler("Error: No se pudo recibir la cabecera del paquete");
 
-    while(current_packet != NULL)
+    int compressed = header.flags & FRAME_COMPRESSED;
+
+    if(frame_unformat(&header) == -1 || (compressed && compression == NULL) || header.length > (compressed ? 2 * (packet->size + 1) : packet->size))
     {
-        aux = current_packet;
-        current_packet = current_packet->next;
-        free(aux);
+        printf("Error: Cabecera de paquete inválida.\n");
+        exit(EXIT_FAILURE);
     }
+
+    if(compressed)
+    {
+        char* payload = malloc(header.length);
+
+        if(recv(client_socket, payload, header.length, MSG_WAITALL) == -1)
+            recv_error_handler("Error: No se pudo recibir el paquete comprimido");
+
+        packet->length = decompress_packet(compression, payload, (long)header.length, packet->data, packet->size);
+        packet->data[packet->length] = '\0';
+
+        free(payload);
+    }
+    else
+    {
+        if(recv(client_socket, packet->data, header.length, MSG_WAITALL) == -1)
+            recv_error_handler("Error: No se pudo recibir el paquete");
+
+        packet->length = header.length;
+        packet->data[packet->length] = '\0';
+    }
+
+    packet->crc_checksum = header.crc_checksum;
+    packet->flag_last = (u_int8_t)(header.flags & FRAME_LAST);
+    packet->sequence = header.sequence;
 }
 
-char* receive_compress_data(int client_socket)
+char* receive_compress_data(int client_socket, compressor* compression)
 {
     long file_size;
     size_t json_size;
 
-    if(recv(client_socket, &file_size, sizeof(file_size), 0) == -1)
+    if(recv(client_socket, &file_size, sizeof(file_size), MSG_WAITALL) == -1)
         recv_error_handler("Error: No se pudo recibir el tamaño del paquete comprimido");
     
-    if(recv(client_socket, &json_size, sizeof(json_size), 0) == -1)
+    if(recv(client_socket, &json_size, sizeof(json_size), MSG_WAITALL) == -1)
         recv_error_handler("Error: No se pudo recibir el tamaño del paquete");
 
     char *buffer = (char*) malloc(sizeof(char) * (size_t)file_size);
 
-    if(recv(client_socket, buffer, (sizeof(char) * (size_t)file_size), 0) == -1)
+    if(recv(client_socket, buffer, (sizeof(char) * (size_t)file_size), MSG_WAITALL) == -1)
         recv_error_handler("Error: No se pudo recibir el paquete comprimido");
 
-    FILE *fp = fopen("../files/data_received.json.gz", "wb");
-    if (fp == NULL) {
-        perror("Error al abrir archivo");
-        exit(EXIT_FAILURE);
-    }
-    fwrite(buffer, sizeof(char), (size_t)file_size, fp);
-    
-    fclose(fp);
-    free(buffer);
-
-    gzFile gzfp = gzopen("../files/data_received.json.gz", "rb");
-    if (gzfp == NULL) {
-        perror("Error al abrir archivo gz");
-        exit(EXIT_FAILURE);
-    }
+    char* data_json = calloc(json_size + 1, sizeof(char));
+    decompress_packet(compression, buffer, file_size, data_json, json_size);
 
-    char* data_json = malloc(json_size);
-    gzread(gzfp, data_json, (uInt)json_size);
-    gzclose(gzfp);
+    free(buffer);
 
     return data_json;
 }
 
-data_packet* data_packing(char* data, size_t data_size, size_t num_packets)
+packet_slice* data_packing(const char* data, size_t data_size, size_t num_packets, const handshake* options)
 {
-    data_packet* first_packet = calloc(1, sizeof(data_packet));
-    data_packet* last_packet = first_packet;
-    first_packet->next = NULL;
-    last_packet->flag_last = 0;
+    packet_slice* slices = calloc(num_packets ? num_packets : 1, sizeof(packet_slice));
+
+    if(slices == NULL)
+    {
+        printf("Error: no se pudo asignar memoria para los paquetes.\n");
+        exit(EXIT_FAILURE);
+    }
     
     for(size_t i = 0; i < num_packets; i++)
     {
-        size_t remaining_bytes = data_size - i * PACKET_SIZE;
-        size_t packet_bytes = remaining_bytes < PACKET_SIZE - 1 ? remaining_bytes : PACKET_SIZE - 1;
-
-        memcpy(last_packet->data, data + i * PACKET_SIZE, packet_bytes);
-        last_packet->data[packet_bytes] = '\0';
+        size_t offset = i * options->packet_size;
 
-        uLong crc_checksum = crc32(0L, Z_NULL, 0);
-        last_packet->crc_checksum = crc32(crc_checksum, (const Bytef *)last_packet->data, (uInt)strlen(last_packet->data));
-        
-        if(remaining_bytes > 0)
-        {
-            data_packet* new_packet = calloc(1, sizeof(data_packet));
-            new_packet->next = NULL;
-            last_packet->next = new_packet;
-            last_packet = new_packet;
-        }
+        slices[i].data = data + offset;
+        slices[i].length = data_size - offset < options->packet_size ? data_size - offset : options->packet_size;
+        slices[i].sequence = (uint32_t)i;
+        slices[i].flag_last = i == num_packets - 1;
+        slices[i].crc_checksum = checksum_compute((checksum_algorithm)options->checksum, slices[i].data, slices[i].length);
     }
 
-    last_packet->flag_last = 1;
+    return slices;
+}
 
-    return first_packet;
+size_t packet_count(size_t data_size, const handshake* options)
+{
+    return data_size / options->packet_size + (data_size % options->packet_size == 0 ? 0 : 1);
 }
 
-char* data_unpacking(data_packet* first_packet, size_t num_packets)
-{   
-    data_packet* current_packet = first_packet;
+void data_packet_init(data_packet* packet, size_t size)
+{
+    memset(packet, 0, sizeof(*packet));
 
-    char* data = calloc(PACKET_SIZE * num_packets, sizeof(char));
+    packet->data = malloc(size + 1);
+    packet->size = size;
 
-    for(size_t i = 0; i < num_packets; i++)
+    if(packet->data == NULL)
     {
-        strcat(data, current_packet->data);
-        current_packet = current_packet->next;
+        printf("Error: no se pudo asignar memoria para el paquete.\n");
+        exit(EXIT_FAILURE);
     }
+}
 
-    return data;
+void data_packet_free(data_packet* packet)
+{
+    free(packet->data);
+    packet->data = NULL;
 }
 
-char* json_format(data_packet* data_packet)
+char* json_format(const packet_slice* packet)
 {
+    char* message = malloc(packet->length + 1);
     cJSON *data_packet_json = cJSON_CreateObject();
 
-    cJSON_AddStringToObject(data_packet_json, "message", data_packet->data);
-    cJSON_AddNumberToObject(data_packet_json, "crc_checksum", (double)data_packet->crc_checksum);
-    cJSON_AddNumberToObject(data_packet_json, "flag_last", (double)data_packet->flag_last);
+    memcpy(message, packet->data, packet->length);
+    message[packet->length] = '\0';
+
+    cJSON_AddStringToObject(data_packet_json, "message", message);
+    cJSON_AddNumberToObject(data_packet_json, "crc_checksum", (double)packet->crc_checksum);
+    cJSON_AddNumberToObject(data_packet_json, "flag_last", (double)packet->flag_last);
     
     char* data_packet_json_string = cJSON_Print(data_packet_json);
     
     cJSON_Delete(data_packet_json);
+    free(message);
 
     return data_packet_json_string;
 }
@@ -294,44 +618,195 @@ void json_unformat(char* data_packet_json_string, data_packet* packet)
 {
     cJSON *data_packet_json = cJSON_Parse(data_packet_json_string);
 
-    strcpy(packet->data, cJSON_GetObjectItem(data_packet_json, "message")->valuestring);
+    const char* message = cJSON_GetObjectItem(data_packet_json, "message")->valuestring;
+
+    packet->length = strnlen(message, packet->size);
+    memcpy(packet->data, message, packet->length);
+    packet->data[packet->length] = '\0';
     packet->crc_checksum = (uLong)cJSON_GetObjectItem(data_packet_json, "crc_checksum")->valuedouble;
     packet->flag_last = (u_int8_t)cJSON_GetObjectItem(data_packet_json, "flag_last")->valuedouble;
 
     cJSON_Delete(data_packet_json);
 }
 
-void create_file(char* data_packet_json_string)
+void frame_format(frame_header* header, uint8_t flags, uint32_t length, uint32_t sequence, uint32_t crc_checksum)
 {
-    FILE *fp = fopen("../files/data.json.gz", "wb");
-    if (fp == NULL) {
-        perror("Error al abrir archivo");
-        exit(EXIT_FAILURE);
+    header->magic = htons(FRAME_MAGIC);
+    header->version = PROTOCOL_VERSION;
+    header->flags = flags;
+    header->length = htonl(length);
+    header->sequence = htonl(sequence);
+    header->crc_checksum = htonl(crc_checksum);
+}
+
+int frame_unformat(frame_header* header)
+{
+    header->magic = ntohs(header->magic);
+    header->length = ntohl(header->length);
+    header->sequence = ntohl(header->sequence);
+    header->crc_checksum = ntohl(header->crc_checksum);
+
+    if(header->magic != FRAME_MAGIC || header->version != PROTOCOL_VERSION)
+        return -1;
+
+    return 0;
+}
+
+int handshake_send(int client_socket, client_t client_type, const handshake* offer, handshake* options)
+{
+    int hello = (int)client_type | CLIENT_NEGOTIATE;
+    handshake request = *offer;
+
+    request.magic = HANDSHAKE_MAGIC;
+    request.version = PROTOCOL_VERSION;
+
+    if(send(client_socket, &hello, sizeof(hello), 0) == -1 || send(client_socket, &request, sizeof(request), 0) == -1)
+        return -1;
+
+    if(recv(client_socket, options, sizeof(*options), MSG_WAITALL) != (ssize_t)sizeof(*options))
+        return -1;
+
+    if(options->magic != HANDSHAKE_MAGIC || !(options->wire_format & offer->wire_format) || options->window > offer->window)
+        return -1;
+
+    if(!(options->checksum & offer->checksum) || (options->checksum & (options->checksum - 1)))
+        return -1;
+
+    if(options->packet_size < PACKET_DATA_SIZE || options->packet_size > offer->packet_size)
+        return -1;
+
+    if(options->flags & ~offer->flags)
+        return -1;
+
+    return 0;
+}
+
+int handshake_select(const handshake* offer, const handshake* limits, handshake* reply)
+{
+    handshake_default(reply);
+
+    if(offer->magic != HANDSHAKE_MAGIC || offer->version < PROTOCOL_VERSION)
+        return -1;
+
+    if(offer->wire_format & limits->wire_format & WIRE_BINARY)
+    {
+        reply->wire_format = WIRE_BINARY;
+        reply->window = offer->window < limits->window ? offer->window : limits->window;
     }
 
-    gzFile gzfp = gzopen("../files/data.json.gz", "wb");
-    if (gzfp == NULL) {
-        perror("Error al abrir archivo gz");
+    if(offer->checksum & limits->checksum)
+        reply->checksum = (uint8_t)checksum_select(offer->checksum & limits->checksum);
+
+    reply->flags = offer->flags & limits->flags & (reply->wire_format == WIRE_BINARY ? HANDSHAKE_PIPELINE | HANDSHAKE_STREAM : HANDSHAKE_STREAM);
+
+    if(offer->packet_size > PACKET_DATA_SIZE)
+        reply->packet_size = offer->packet_size < limits->packet_size ? offer->packet_size : limits->packet_size;
+
+    return 0;
+}
+
+void handshake_default(handshake* options)
+{
+    memset(options, 0, sizeof(*options));
+    options->magic = HANDSHAKE_MAGIC;
+    options->version = PROTOCOL_VERSION;
+    options->wire_format = WIRE_JSON;
+    options->checksum = CHECKSUM_CRC32;
+    options->packet_size = PACKET_DATA_SIZE;
+}
+
+uint32_t window_size(const handshake* options)
+{
+    if(options->wire_format != WIRE_BINARY || options->window <= 1)
+        return 1;
+
+    return options->window;
+}
+
+void window_ack_format(window_ack* ack, uint32_t next_sequence, uint32_t sequence, checksum_status status)
+{
+    ack->next_sequence = htonl(next_sequence);
+    ack->sequence = htonl(sequence);
+    ack->status = htonl((uint32_t)status);
+}
+
+void receive_window_init(receive_window* window, uint32_t size, const handshake* options)
+{
+    if(size == 0)
+        size = 1;
+
+    window->filled = calloc(size, sizeof(u_int8_t));
+    window->size = size;
+    window->next_sequence = 0;
+    window->algorithm = (checksum_algorithm)options->checksum;
+    window->packet_size = options->packet_size;
+    window->lengths = NULL;
+
+    if(window->filled == NULL)
+    {
+        printf("Error: no se pudo asignar memoria para la ventana.\n");
         exit(EXIT_FAILURE);
     }
-
-    gzwrite(gzfp, data_packet_json_string, (uInt)strlen(data_packet_json_string));
-    
-    gzclose(gzfp);
-    fclose(fp);
 }
 
-u_int8_t checksum_check(data_packet *aux, int client_socket)
+checksum_status receive_window_store(receive_window* window, data_packet* packet, buffer* message)
 {
-    checksum_status checksum_status;
+    if(packet->sequence < window->next_sequence)
+        return CHECKSUM_OK;
+
+    if(packet->sequence - window->next_sequence >= window->size)
+        return CHECKSUM_FAIL;
 
-    uLong crc_checksum = crc32(0L, Z_NULL, 0);
-    crc_checksum = crc32(crc_checksum, (const Bytef *)aux->data, (uInt)strlen(aux->data));
+    if(checksum_verify(packet, window->algorithm) == CHECKSUM_FAIL)
+        return CHECKSUM_FAIL;
 
-    if(crc_checksum != aux->crc_checksum)
-        checksum_status = CHECKSUM_FAIL;
+    uint32_t slot = packet->sequence % window->size;
+
+    if(window->lengths != NULL)
+    {
+        buffer_write_at(message, (size_t)slot * window->packet_size, packet->data, packet->length);
+        window->lengths[slot] = (uint32_t)packet->length;
+    }
     else
-        checksum_status = CHECKSUM_OK;
+        buffer_write_at(message, (size_t)packet->sequence * window->packet_size, packet->data, packet->length);
+
+    window->filled[slot] = 1;
+
+    return CHECKSUM_OK;
+}
+
+uint32_t receive_window_advance(receive_window* window)
+{
+    uint32_t delivered = 0;
+
+    while(window->filled[window->next_sequence % window->size])
+    {
+        window->filled[window->next_sequence % window->size] = 0;
+        window->next_sequence++;
+        delivered++;
+    }
+
+    return delivered;
+}
+
+void receive_window_free(receive_window* window)
+{
+    free(window->filled);
+    free(window->lengths);
+    window->filled = NULL;
+    window->lengths = NULL;
+}
+
+checksum_status checksum_verify(data_packet* packet, checksum_algorithm algorithm)
+{
+    uLong crc_checksum = checksum_compute(algorithm, packet->data, packet->length);
+
+    return crc_checksum == packet->crc_checksum ? CHECKSUM_OK : CHECKSUM_FAIL;
+}
+
+u_int8_t checksum_check(data_packet *aux, int client_socket, checksum_algorithm algorithm)
+{
+    checksum_status checksum_status = checksum_verify(aux, algorithm);
 
     if(send(client_socket, &checksum_status, sizeof(checksum_status), 0) == -1)
         send_error_handler("Error: No se pudo enviar el estado del checksum");
@@ -339,6 +814,61 @@ u_int8_t checksum_check(data_packet *aux, int client_socket)
     return checksum_status;
 }
 
+void buffer_reserve(buffer* buf, size_t size)
+{
+    if(buf->off > 0 && buf->off == buf->len)
+        buf->off = buf->len = 0;
+
+    if(buf->len + size <= buf->cap)
+        return;
+
+    size_t new_cap = buf->cap ? buf->cap : PACKET_SIZE;
+    while(new_cap < buf->len + size)
+        new_cap *= 2;
+
+    char* data = realloc(buf->data, new_cap);
+    if(data == NULL)
+    {
+        printf("Error: no se pudo asignar memoria para el buffer.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    buf->data = data;
+    buf->cap = new_cap;
+}
+
+void buffer_append(buffer* buf, const void* data, size_t size)
+{
+    buffer_reserve(buf, size);
+    memcpy(buf->data + buf->len, data, size);
+    buf->len += size;
+}
+
+void buffer_write_at(buffer* buf, size_t offset, const void* data, size_t size)
+{
+    if(offset + size > buf->len)
+        buffer_reserve(buf, offset + size - buf->len);
+
+    memcpy(buf->data + offset, data, size);
+
+    if(offset + size > buf->len)
+        buf->len = offset + size;
+}
+
+void buffer_consume(buffer* buf, size_t size)
+{
+    buf->off += size;
+
+    if(buf->off == buf->len)
+        buf->off = buf->len = 0;
+}
+
+void buffer_free(buffer* buf)
+{
+    free(buf->data);
+    memset(buf, 0, sizeof(*buf));
+}
+
 void send_error_handler(const char* error_message)
 {
     perror(error_message);
@@ -12,40 +12,206 @@
  * @copyright Copyright (c) 2023
  */
 
+#define _GNU_SOURCE
+
 #include "../inc/server.h"
 
-int main() 
+struct server server;
+struct server_config server_config;
+volatile sig_atomic_t server_flag;
+
+static struct shard shards[MAX_SHARDS];
+static int num_shards;
+static thread_pool pool;
+static journal_cache cache;
+static sysinfo_sampler sampler;
+
+static int stream_sink(void* arg, const char* data, size_t size);
+static int stream_spill(struct stream_fill* fill);
+static int buffer_sink(void* arg, const char* data, size_t size);
+static int spawn_error(journal_sink sink, void* arg, int error);
+static void* shard_run(void* arg);
+static void* metrics_run(void* arg);
+static void metrics_serve(int client_fd);
+static void metrics_close(void);
+
+int main(int argc, char* argv[]) 
 { 
+    parse_arguments(argc, argv);
+
     server_init();
 
-    while(1)
-        wait_client();
+    event_loop_run(&shards[0].loop);
+
+    close_server();
      
     return 0;
 }
 
+void parse_arguments(int argc, char* argv[])
+{
+    int opt;
+    int window;
+    int checksum;
+    long packet_size;
+    long cache_size;
+    long interval;
+    int shard_count;
+
+    memset(&server_config, 0, sizeof(server_config));
+    server_config.wire_formats = WIRE_JSON | WIRE_BINARY;
+    server_config.window = DEFAULT_WINDOW_SIZE;
+    server_config.checksums = CHECKSUMS_SUPPORTED;
+    server_config.cache_size = JOURNAL_CACHE_SIZE;
+    server_config.sysinfo_interval = SYSINFO_INTERVAL;
+    server_config.shards = 1;
+    server_config.backlog = LISTEN_BACKLOG;
+    server_config.metrics_path = METRICS_SOCKET_PATH;
+
+    while((opt = getopt(argc, argv, "w:jW:c:P:C:s:S:B:M:")) != -1)
+    {
+        switch(opt)
+        {
+        case 'w':
+            server_config.workers = atoi(optarg);
+            break;
+
+        case 'j':
+            server_config.wire_formats = WIRE_JSON;
+            break;
+
+        case 'W':
+            window = atoi(optarg);
+            server_config.window = (uint16_t)(window < 1 ? 1 : window > MAX_WINDOW_SIZE ? MAX_WINDOW_SIZE : window);
+            break;
+
+        case 'c':
+            checksum = checksum_parse(optarg);
+            if(checksum == -1)
+            {
+                printf("Error: algoritmo de checksum no soportado: %s.\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            server_config.checksums = (uint8_t)checksum;
+            break;
+
+        case 'P':
+            packet_size = atol(optarg);
+            server_config.packet_size = (uint32_t)(packet_size < PACKET_DATA_SIZE ? PACKET_DATA_SIZE : packet_size > MAX_PACKET_DATA_SIZE ? MAX_PACKET_DATA_SIZE : packet_size);
+            break;
+
+        case 'C':
+            cache_size = atol(optarg);
+            server_config.cache_size = cache_size > 0 ? (size_t)cache_size * 1024 * 1024 : 0;
+            break;
+
+        case 's':
+            interval = atol(optarg);
+            server_config.sysinfo_interval = interval > 0 ? (unsigned long)interval : 0;
+            break;
+
+        case 'S':
+            shard_count = atoi(optarg);
+            if(shard_count <= 0)
+                shard_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+            server_config.shards = shard_count < 1 ? 1 : shard_count > MAX_SHARDS ? MAX_SHARDS : shard_count;
+            break;
+
+        case 'B':
+            server_config.backlog = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+
+        case 'M':
+            if(strlen(optarg) >= sizeof(((struct sockaddr_un*)NULL)->sun_path))
+            {
+                printf("Error: la ruta del socket de métricas es demasiado larga: %s.\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            server_config.metrics_path = optarg;
+            break;
+
+        default:
+            printf("Uso: %s [-w <hilos de trabajo>] [-j] [-W <paquetes en vuelo>] [-c <crc32|crc32c|xxh3>] [-P <bytes por paquete>] [-C <megabytes de caché>] [-s <milisegundos entre muestras>] [-S <bucles de eventos>] [-B <conexiones pendientes>] [-M <socket de métricas>]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
 void server_init()
 {   
     struct sigaction sa;
     server_flag = SERVER_UP;
-
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 300;
-
-    pthread_mutex_init(&lock, NULL);
+    server.metrics_socket_fd = -1;
 
     if(create_unix_socket(SOCKET_PATH) == -1)
         close_server();
-    
-    if(create_ipv4_socket(SOCKET_PORT_IPV4) == -1)
+
+    if(thread_pool_init(&pool, server_config.workers) == -1)
         close_server();
-    
-    if(create_ipv6_socket(SOCKET_PORT_IPV6) == -1)
+
+    journal_cache_init(&cache, server_config.cache_size);
+    sysinfo_sampler_init(&sampler, server_config.sysinfo_interval);
+
+    /* Every shard accepts from the shared unix socket and from its own ipv4 and ipv6 sockets. */
+    for(int i = 0; i < server_config.shards; i++)
+    {
+        struct shard* shard = &shards[i];
+
+        if((shard->ipv4_socket_fd = create_ipv4_socket(SOCKET_PORT_IPV4)) == -1)
+            close_server();
+
+        if((shard->ipv6_socket_fd = create_ipv6_socket(SOCKET_PORT_IPV6)) == -1)
+            close_server();
+
+        int listen_fds[] = {server.unix_socket_fd, shard->ipv4_socket_fd, shard->ipv6_socket_fd};
+
+        if(event_loop_init(&shard->loop, listen_fds, 3, &pool) == -1)
+            close_server();
+
+        num_shards++;
+
+        if(event_loop_publish(&shard->loop, &sampler) == -1)
+            close_server();
+    }
+
+    /* The journal of the cache is read by a single thread, the first shard. */
+    if(journal_cache_fd(&cache) != -1 && event_loop_watch(&shards[0].loop, &cache) == -1)
         close_server();
     
     memset(&sa, 0, sizeof(sa));
     sa.sa_handler = sigint_handler;
     sigaction(SIGINT, &sa, NULL);
+
+    /* The first shard is run by the main thread. */
+    for(int i = 1; i < num_shards; i++)
+    {
+        pthread_t tid;
+
+        if(pthread_create(&tid, NULL, shard_run, &shards[i]) != 0)
+        {
+            perror("Error al crear el hilo del bucle de eventos.\n");
+            close_server();
+        }
+
+        add_thread(tid);
+    }
+
+    /* The metrics are served by their own thread, a slow scrape never holds an event loop. They are optional,
+       the server keeps running without them. */
+    if(server_config.metrics_path[0] != '\0')
+    {
+        pthread_t tid;
+
+        if(create_metrics_socket(server_config.metrics_path) == -1)
+            printf("Advertencia: no se sirven las métricas en %s.\n", server_config.metrics_path);
+        else if(pthread_create(&tid, NULL, metrics_run, NULL) != 0)
+        {
+            perror("Advertencia: no se pudo crear el hilo de métricas");
+            metrics_close();
+        }
+        else
+            add_thread(tid);
+    }
 }
 
 int create_unix_socket(const char *socket_path)
@@ -53,7 +219,7 @@ int create_unix_socket(const char *socket_path)
     struct sockaddr_un server_address;
 
     server.unix_socket_path = strdup(socket_path);
-    server.unix_socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    server.unix_socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
 
     if(server.unix_socket_fd < 0) 
     {
@@ -73,7 +239,7 @@ int create_unix_socket(const char *socket_path)
         return -1;
     }
 
-    if(listen(server.unix_socket_fd, 1) < 0) 
+    if(listen(server.unix_socket_fd, server_config.backlog) < 0) 
     {
         perror("listen() unix failed");
         return -1;
@@ -82,313 +248,563 @@ int create_unix_socket(const char *socket_path)
     return 0;
 }
 
+int create_metrics_socket(const char *socket_path)
+{
+    struct sockaddr_un server_address;
+
+    int socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if(socket_fd < 0)
+    {
+        perror("socket() metrics failed");
+        return -1;
+    }
+
+    memset(&server_address, 0, sizeof(server_address));
+
+    server_address.sun_family = AF_UNIX;
+
+    strcpy(server_address.sun_path, socket_path);
+
+    /* The path may belong to another server, or to one that crashed, it is left as it is. */
+    if(bind(socket_fd, (struct sockaddr *)&server_address, sizeof(server_address)) < 0)
+    {
+        perror("bind() metrics failed");
+        close(socket_fd);
+        return -1;
+    }
+
+    /* From here on the path is this server's, it is unlinked when the socket is closed. */
+    server.metrics_socket_fd = socket_fd;
+    server.metrics_socket_path = strdup(socket_path);
+
+    if(listen(socket_fd, server_config.backlog) < 0)
+    {
+        perror("listen() metrics failed");
+        metrics_close();
+        return -1;
+    }
+
+    return 0;
+}
+
 int create_ipv4_socket(const uint16_t socket_port)
 {
     struct sockaddr_in server_address;
+    int reuse = 1;
 
-    server.ipv4_socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int socket_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
 
-    if(server.ipv4_socket_fd < 0) 
+    if(socket_fd < 0) 
     {
         perror("socket() ipv4 failed");
         return -1;
     }
 
+    if(setsockopt(socket_fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0)
+    {
+        perror("setsockopt() ipv4 failed");
+        close(socket_fd);
+        return -1;
+    }
+
     memset(&server_address, 0, sizeof(server_address));
 
     server_address.sin_family = AF_INET;
     server_address.sin_addr.s_addr = INADDR_ANY;
     server_address.sin_port = htons(socket_port);
 
-    if(bind(server.ipv4_socket_fd, (struct sockaddr *)&server_address, sizeof(server_address)) < 0) 
+    if(bind(socket_fd, (struct sockaddr *)&server_address, sizeof(server_address)) < 0) 
     {
         perror("bind() ipv4 failed");
+        close(socket_fd);
         return -1;
     }
 
-    if(listen(server.ipv4_socket_fd, 1) < 0) 
+    if(listen(socket_fd, server_config.backlog) < 0) 
     {
         perror("listen() ipv4 failed");
+        close(socket_fd);
         return -1;
     }
 
-    return 0;
+    return socket_fd;
 }
 
 int create_ipv6_socket(const uint16_t socket_port)
 {
     struct sockaddr_in6 server_address;
+    int reuse = 1;
 
-    server.ipv6_socket_fd = socket(AF_INET6, SOCK_STREAM, 0);
+    int socket_fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK, 0);
 
-    if(server.ipv6_socket_fd < 0) 
+    if(socket_fd < 0) 
     {
         perror("socket() ipv6 failed");
         return -1;
     }
 
+    if(setsockopt(socket_fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0)
+    {
+        perror("setsockopt() ipv6 failed");
+        close(socket_fd);
+        return -1;
+    }
+
     memset(&server_address, 0, sizeof(server_address));
 
     server_address.sin6_family = AF_INET6;
     server_address.sin6_addr = in6addr_any;
     server_address.sin6_port = htons(socket_port);
 
-    if(bind(server.ipv6_socket_fd, (struct sockaddr *)&server_address, sizeof(server_address)) < 0) 
+    if(bind(socket_fd, (struct sockaddr *)&server_address, sizeof(server_address)) < 0) 
     {
         perror("bind() ipv6 failed");
+        close(socket_fd);
         return -1;
     }
 
-    if(listen(server.ipv6_socket_fd, 1) < 0) 
+    if(listen(socket_fd, server_config.backlog) < 0) 
     {
         perror("listen() ipv6 failed");
+        close(socket_fd);
         return -1;
     }
 
-    return 0;
+    return socket_fd;
 }
 
-void wait_client()
+char* client_select(client_t client_type, char* command)
 {
-    int client_socket;
-    
-    while(1)
+    char* result = NULL;
+
+    if((client_type == CLIENT_A || client_type == CLIENT_B) && IS_FOLLOW_COMMAND(command))
+        result = strdup(FOLLOW_PIPELINE_ERROR);
+    else if(client_type == CLIENT_A || client_type == CLIENT_B)
+        result = journalctl_execute(command);
+    else if(client_type == CLIENT_C)
+        result = sysinfo_execute(command);
+    else
+        result = strdup("Error: cliente no válido.");
+
+    if(result == NULL)
+        result = calloc(1, sizeof(char));
+
+    return result;
+}
+
+void client_stream(struct job* job)
+{
+    struct stream_fill fill;
+    cache_flight* flight = NULL;
+    uint64_t generation = 0;
+    buffer key;
+    size_t size;
+    char* result;
+    int keyed;
+
+    if(IS_FOLLOW_COMMAND(job->command))
+    {
+        job_stream_write(job, FOLLOW_PIPELINE_ERROR, strlen(FOLLOW_PIPELINE_ERROR));
+        job_stream_end(job);
+        return;
+    }
+
+    memset(&key, 0, sizeof(key));
+    keyed = journal_cache_key(job->command, &key) == 0;
+
+    if(keyed && (result = journal_cache_get(&cache, &key, &size, &generation, &flight)) != NULL)
     {
-        fd_set socket_set;
-        int max_socket;
+        job_stream_write(job, result, size);
+        job_stream_end(job);
+        free(result);
+        buffer_free(&key);
+        return;
+    }
 
-        FD_ZERO(&socket_set);
+    memset(&fill, 0, sizeof(fill));
+    fill.job = job;
+    fill.cacheable = keyed && cache.max_bytes > 0;
+    fill.flight = flight;
+    fill.key = &key;
+    fill.generation = generation;
 
-        FD_SET(server.ipv4_socket_fd, &socket_set);
-        FD_SET(server.ipv6_socket_fd, &socket_set);
-        FD_SET(server.unix_socket_fd, &socket_set);
+    if(journal_query_stream(job->command, stream_sink, &fill) == -1)
+        journalctl_spawn(job->command, stream_sink, &fill);
 
-        max_socket = (server.ipv4_socket_fd > server.ipv6_socket_fd) ? server.ipv4_socket_fd : server.ipv6_socket_fd;
-        max_socket = (server.unix_socket_fd > max_socket) ? server.unix_socket_fd : max_socket;
+    /* The whole output fit, it is shared and cached before the client receives the part held back. */
+    if(fill.cacheable)
+    {
+        journal_cache_put(&cache, fill.flight, &key, generation, fill.data.len > 0 ? fill.data.data : "", fill.data.len);
+        fill.flight = NULL;
+        stream_spill(&fill);
+    }
+    else if(keyed)
+        journal_cache_put(&cache, fill.flight, &key, generation, NULL, 0);
 
-        int ret = select(max_socket + 1, &socket_set, NULL, NULL, &timeout);
-        
-        if(ret == -1)
-        {
-            perror("Error en select, espera de conexión de cliente.\n");
-            exit(EXIT_FAILURE);
-        }
-        else if(ret == 0)
+    job_stream_end(job);
+
+    buffer_free(&fill.data);
+    buffer_free(&key);
+}
+
+static int stream_sink(void* arg, const char* data, size_t size)
+{
+    struct stream_fill* fill = arg;
+
+    /* The output is only gathered while it may still fit in the cache. */
+    if(fill->cacheable && fill->data.len + size <= cache.max_bytes / JOURNAL_CACHE_ENTRY_FRACTION)
+    {
+        size_t room = job_stream_room(fill->job);
+
+        buffer_append(&fill->data, data, size);
+
+        /* Only what fits in the window is handed over, the worker never waits here for the client. */
+        if(room > fill->data.len - fill->sent)
+            room = fill->data.len - fill->sent;
+
+        if(room > 0)
         {
-            if(server_flag == SERVER_DOWN)
-            {
-                close_server();
-                return;
-            }
+            job_stream_write(fill->job, fill->data.data + fill->sent, room);
+            fill->sent += room;
         }
-        else if(ret > 0)
-        {
-            if(FD_ISSET(server.ipv4_socket_fd, &socket_set))
-                client_socket = accept(server.ipv4_socket_fd, NULL, NULL);
 
-            if(FD_ISSET(server.ipv6_socket_fd, &socket_set))
-                client_socket = accept(server.ipv6_socket_fd, NULL, NULL);
+        return 0;
+    }
 
-            if(FD_ISSET(server.unix_socket_fd, &socket_set))
-                client_socket = accept(server.unix_socket_fd, NULL, NULL);
+    /* Too large to be shared, the waiting queries are released right away to execute it on their own. */
+    if(fill->cacheable)
+    {
+        fill->cacheable = 0;
+        journal_cache_put(&cache, fill->flight, fill->key, fill->generation, NULL, 0);
+        fill->flight = NULL;
 
-            if(client_socket == -1)
-            {
-                perror("Error al aceptar la conexión del cliente.\n");
-                exit(EXIT_FAILURE);
-            }
-            else if(client_socket > 0)
-            {
-                create_thread(client_socket);
-                break;
-            }
-        }
+        if(stream_spill(fill) == -1)
+            return -1;
     }
+
+    return job_stream_write(fill->job, data, size);
 }
 
-void create_thread(int client_socket)
+static int stream_spill(struct stream_fill* fill)
 {
-    pthread_t tid;
-    int *client_tsocket = malloc(sizeof(int));
-    *client_tsocket = client_socket;
+    int ret = fill->data.len > fill->sent ? job_stream_write(fill->job, fill->data.data + fill->sent, fill->data.len - fill->sent) : 0;
 
-    if(pthread_create(&tid, NULL, &thread_client_handler, (void *)client_tsocket) != 0)
-    {
-        printf("Error al crear el hilo.\n");
-        exit(EXIT_FAILURE);
-    }
+    buffer_free(&fill->data);
+    fill->sent = 0;
+
+    return ret;
 }
 
-void *thread_client_handler(void *arg)
-{  
-    int client_tsocket = *(int *)arg;
-    free(arg);
+char* journalctl_execute(char* command)
+{
+    cache_flight* flight = NULL;
+    uint64_t generation = 0;
+    char* result;
+    buffer key;
+    size_t size;
+    buffer out;
+    int keyed;
+
+    memset(&key, 0, sizeof(key));
+    keyed = journal_cache_key(command, &key) == 0;
 
-    client_t client_type;
-    if(recv(client_tsocket, &client_type, sizeof(client_type), 0) == -1)
+    if(keyed && (result = journal_cache_get(&cache, &key, &size, &generation, &flight)) != NULL)
     {
-        perror("Error al recibir el tipo de cliente.\n");
-        exit(EXIT_FAILURE);
+        buffer_free(&key);
+        return result;
     }
-    printf("Cliente %d tipo %c conectado.\n", client_tsocket, GET_CLIENT_TYPE_LETTER(client_type));
 
-    fd_set read_fds;
+    if((result = journal_query(command)) == NULL)
+    {
+        memset(&out, 0, sizeof(out));
 
-    pthread_mutex_lock(&lock);
-    add_thread(pthread_self());
-    pthread_mutex_unlock(&lock);
+        journalctl_spawn(command, buffer_sink, &out);
+        buffer_append(&out, "", 1);
 
-    FD_ZERO(&read_fds);
-    
-    server_logic(client_tsocket, read_fds, client_type);
-    
-    close(client_tsocket);
+        result = out.data;
+    }
 
-    return NULL;
+    if(keyed)
+        journal_cache_put(&cache, flight, &key, generation, result, strlen(result));
+
+    buffer_free(&key);
+
+    return result;
 }
 
-void server_logic(int client_tsocket, fd_set read_fds, client_t client_type)
+void journalctl_spawn(char* command, journal_sink sink, void* arg)
 {
-    while(1){
-        FD_SET(client_tsocket, &read_fds);
-        
-        int ret = select(client_tsocket + 1, &read_fds, NULL, NULL, &timeout);
-        if(ret == -1){
-            perror("Error en select, espera de mensaje por parte del cliente.\n");
-            exit(EXIT_FAILURE);
-        }
-        else if(ret == 0)
+    char* tokens[JOURNAL_MAX_TOKENS];
+    char* argv[JOURNAL_MAX_TOKENS + 2];
+    char* line = strdup(command);
+    int count = journal_split(line, tokens);
+    int out[2];
+    int err[2];
+    posix_spawn_file_actions_t actions;
+    pid_t pid;
+    int r;
+
+    if(count < 0)
+    {
+        free(line);
+        spawn_error(sink, arg, EINVAL);
+        return;
+    }
+
+    argv[0] = "journalctl";
+    memcpy(argv + 1, tokens, (size_t)count * sizeof(char*));
+    argv[count + 1] = NULL;
+
+    /* The pipes are closed on exec, so a journalctl started by another worker does not keep them open. */
+    if(pipe2(out, O_CLOEXEC) == -1)
+    {
+        free(line);
+        spawn_error(sink, arg, errno);
+        return;
+    }
+
+    if(pipe2(err, O_CLOEXEC) == -1)
+    {
+        r = errno;
+        close(out[0]);
+        close(out[1]);
+        free(line);
+        spawn_error(sink, arg, r);
+        return;
+    }
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, err[1], STDERR_FILENO);
+
+    r = posix_spawnp(&pid, "journalctl", &actions, NULL, argv, environ);
+
+    posix_spawn_file_actions_destroy(&actions);
+    close(out[1]);
+    close(err[1]);
+    free(line);
+
+    if(r != 0)
+    {
+        close(out[0]);
+        close(err[0]);
+        spawn_error(sink, arg, r);
+        return;
+    }
+
+    struct pollfd fds[2] = {{out[0], POLLIN, 0}, {err[0], POLLIN, 0}};
+    char block[JOURNAL_STREAM_BLOCK + 1];
+    size_t held = 0;
+    int written = 0;
+    buffer errors;
+
+    memset(&errors, 0, sizeof(errors));
+
+    /* The last byte read is held back, so the newline at the end of the output is not sent. */
+    while(fds[0].fd != -1 || fds[1].fd != -1)
+    {
+        if(poll(fds, 2, -1) == -1)
         {
-            if(server_flag == SERVER_DOWN)
-                break;
+            if(errno == EINTR)
+                continue;
+
+            break;
         }
-        else if(ret > 0)
+
+        if(fds[0].revents)
         {
-            char* command = receive_data(client_tsocket, client_type, CLIENT_MESSAGE);
+            ssize_t n = read(fds[0].fd, block + held, JOURNAL_STREAM_BLOCK + 1 - held);
 
-            if(command == NULL)
+            if(n <= 0)
             {
-                printf("Cliente %d tipo %c desconectado.\n", client_tsocket, GET_CLIENT_TYPE_LETTER(client_type));
-
-                pthread_mutex_lock(&lock);
-                rmv_thread(pthread_self());
-                pthread_mutex_unlock(&lock);
+                close(fds[0].fd);
+                fds[0].fd = -1;
+            }
+            else if(held + (size_t)n > 1)
+            {
+                if(sink(arg, block, held + (size_t)n - 1) == -1)
+                    break;
 
-                break;
+                block[0] = block[held + (size_t)n - 1];
+                held = 1;
+                written = 1;
             }
-            printf("Cliente %d tipo %c envió: %s\n", client_tsocket, GET_CLIENT_TYPE_LETTER(client_type), command);
-            
-            client_select(client_tsocket, client_type, command);
+            else
+                held = 1;
+        }
 
-            free(command);
-        }            
+        if(fds[1].revents)
+        {
+            char chunk[4096];
+            ssize_t n = read(fds[1].fd, chunk, sizeof(chunk));
+
+            if(n <= 0)
+            {
+                close(fds[1].fd);
+                fds[1].fd = -1;
+            }
+            else
+                buffer_append(&errors, chunk, (size_t)n);
+        }
     }
 
-    return;
-}
+    /* The client is gone, journalctl is not waited for until it finishes on its own. */
+    if(fds[0].fd != -1 || fds[1].fd != -1)
+        kill(pid, SIGTERM);
 
-void client_select(int client_tsocket, client_t client_type, char* command)
-{
-    if(send(client_tsocket, &(u_int8_t){SERVER_MESSAGE}, sizeof(u_int8_t), 0) == -1)
-    {
-        perror("Error al enviar mensaje de aviso al cliente\n");
-        exit(EXIT_FAILURE);
-    }
+    for(int i = 0; i < 2; i++)
+        if(fds[i].fd != -1)
+            close(fds[i].fd);
 
-    char* result;
+    while(waitpid(pid, NULL, 0) == -1 && errno == EINTR);
 
-    if(client_type == CLIENT_A || client_type == CLIENT_B)
-        result = journalctl_execute(command, client_tsocket);
-    else if(client_type == CLIENT_C)
-        result = sysinfo_execute(command);
-    else
-    {       
-        printf("Error: cliente no válido.\n");
-        close_server();
+    if(held == 1 && block[0] != '\n')
+        sink(arg, block, 1);
+    else if(!written && held == 0 && errors.len > 0)
+    {
+        /* journalctl only wrote an error, it is shown instead of an empty response. */
+        if(errors.data[errors.len - 1] == '\n')
+            errors.len--;
 
+        sink(arg, errors.data, errors.len);
     }
-    
-    send_data(client_tsocket, result, client_type, SERVER_MESSAGE);
-    
-    free(result);
 
-    return;
+    buffer_free(&errors);
 }
 
-char* journalctl_execute(char* command, int client_fd)
+static int buffer_sink(void* arg, const char* data, size_t size)
 {
-    FILE *fp;
-    char* result;
-
-    char prompt[1024];
-    char file_output[128];
-    char file_err[128];
-       
-    sprintf(file_output, "%s_%d.log", JOURNAL_TMP_OUTPUT, client_fd);
-    sprintf(file_err, "%s_%d.log", JOURNAL_TMP_ERROR, client_fd);
+    buffer_append((buffer*)arg, data, size);
 
-    sprintf(prompt, "journalctl %s > %s 2> %s", command, file_output, file_err);
-    
-    fp = popen(prompt, "r");
-
-    if(fp == NULL) 
-    {
-        result = calloc(strlen(strerror(errno)) + 27, sizeof(char));
-        sprintf(result, "Failed to run command: %s", strerror(errno));
-        return result;
-    }
+    return 0;
+}
 
-    pclose(fp);
+static int spawn_error(journal_sink sink, void* arg, int error)
+{
+    size_t size = strlen(strerror(error)) + 27;
+    char* result = calloc(size, sizeof(char));
 
-    if((result = read_file(file_err)) == NULL)
-        if((result = read_file(file_output)) == NULL)
-            result = NULL;
-    
-    remove(file_err);
-    remove(file_output);
+    snprintf(result, size, "Failed to run command: %s", strerror(error));
+    sink(arg, result, strlen(result));
+    free(result);
 
-    return result;
+    return 0;
 }
 
 char* sysinfo_execute(char* command)
 {
-    struct sysinfo info;
-    if(sysinfo(&info) == -1)
+    sysinfo_snapshot snapshot;
+    char* result;
+
+    sysinfo_sampler_read(&sampler, &snapshot);
+
+    if(!strcmp(command, "freeram"))
+        result = strdup(snapshot.freeram);
+    else if(!strcmp(command, "loads"))
+        result = strdup(snapshot.loads);
+    else if(!strcmp(command, "sampling"))
     {
-        perror("Error al obtener información del sistema.\n");
-        exit(EXIT_FAILURE);
+        result = calloc(SYSINFO_RESULT_SIZE, sizeof(char));
+        if(result != NULL)
+            snprintf(result, SYSINFO_RESULT_SIZE, "Intervalo de muestreo: %lu[ms], antigüedad: %.3f[ms]",
+                     server_config.sysinfo_interval, (double)(monotonic_ns() - snapshot.taken_ns) / 1e6);
     }
-    char* result = calloc(60, sizeof(char));
+    else if(!strncmp(command, "subscribe", 9) || !strncmp(command, "unsubscribe", 11))
+        result = strdup("Error: las suscripciones requieren una conexión con pipelining (-p).");
+    else
+        result = strdup("Comando no válido.\nComandos disponibles: <freeram> <loads> <sampling> <subscribe> <unsubscribe>");
+
     if (result == NULL) {
         printf("Error: no se pudo asignar memoria para el buffer.\n");
         exit(EXIT_FAILURE);
     }
 
-    if(!strcmp(command, "freeram"))
-        snprintf(result, 60, "Memoria ram libre: %lu %s", info.freeram/1024, "KB");
-    else if(!strcmp(command, "loads"))
-        snprintf(result, 60, "Carga promedio en el último minuto: %lu", info.loads[0]/65536);
-    else
-        snprintf(result, 60, "Comando no válido.\nComandos disponibles: <freeram> <loads>");
-   
     return result;
 }
 
 void close_server()
 {
+    struct pool_stats stats;
+    size_t pushes = 0, push_encodes = 0, push_drops = 0;
+    size_t follow_entries = 0, follow_pushes = 0, follow_drops = 0;
+    size_t send_calls = 0;
+    const char* engine = "send()";
+
     printf("\nCerrando servidor...\n");
 
+    /* The other shards are stopped and joined before their connections are closed. */
+    for(int i = 0; i < num_shards; i++)
+        event_loop_stop(&shards[i].loop);
+
+    /* The blocked accept() of the metrics thread returns once its socket is shut down. */
+    if(server.metrics_socket_fd != -1)
+        shutdown(server.metrics_socket_fd, SHUT_RDWR);
+
     end_threads();
 
-    pthread_mutex_destroy(&lock);
+    thread_pool_stats(&pool, &stats);
+
+    for(int i = 0; i < num_shards; i++)
+        event_loop_cancel(&shards[i].loop);
+
+    thread_pool_close(&pool);
+
+    for(int i = 0; i < num_shards; i++)
+    {
+        event_loop* shard_loop = &shards[i].loop;
+
+        event_loop_close(shard_loop);
+
+        pushes += shard_loop->pushes;
+        push_encodes += shard_loop->push_encodes;
+        push_drops += shard_loop->push_drops;
+        follow_entries += shard_loop->follow_entries;
+        follow_pushes += shard_loop->follow_pushes;
+        follow_drops += shard_loop->follow_drops;
+        send_calls += shard_loop->send_calls;
+
+#ifdef HAVE_IO_URING
+        if(shard_loop->ring.fd != -1)
+            engine = "io_uring";
+#endif
+
+        close(shards[i].ipv4_socket_fd);
+        close(shards[i].ipv6_socket_fd);
+    }
+
+    printf("Comandos ejecutados: %zu, hilos: %d, cola máxima: %zu, espera promedio: %.3f[ms], espera máxima: %.3f[ms].\n",
+           stats.jobs_completed, stats.workers, stats.max_queue_depth,
+           stats.jobs_completed ? (double)stats.total_wait_ns / (double)stats.jobs_completed / 1e6 : 0.0,
+           (double)stats.max_wait_ns / 1e6);
+
+    if(cache.max_bytes > 0)
+        printf("Caché: aciertos: %zu, agrupadas: %zu, fallos: %zu, invalidaciones: %zu, desalojos: %zu.\n",
+               cache.hits, cache.coalesced, cache.misses, cache.invalidations, cache.evictions);
+
+    journal_cache_close(&cache);
+
+    printf("Sysinfo: muestras: %zu, consultas: %zu, intervalo: %lu[ms].\n",
+           atomic_load(&sampler.samples), atomic_load(&sampler.reads), server_config.sysinfo_interval);
+
+    printf("Suscripciones: actualizaciones enviadas: %zu, codificadas: %zu, descartadas: %zu.\n",
+           pushes, push_encodes, push_drops);
+
+    printf("Seguimientos: entradas leídas: %zu, envíos: %zu, entradas descartadas: %zu.\n",
+           follow_entries, follow_pushes, follow_drops);
+
+    printf("Envíos: llamadas al sistema: %zu, %.2f por comando, motor: %s.\n",
+           send_calls, stats.jobs_completed ? (double)send_calls / (double)stats.jobs_completed : 0.0, engine);
+
+    sysinfo_sampler_close(&sampler);
 
     close(server.unix_socket_fd);
-    close(server.ipv4_socket_fd);
-    close(server.ipv6_socket_fd);
 
     unlink(server.unix_socket_path);
     free(server.unix_socket_path);
 
+    metrics_close();
+
     printf("Servidor cerrado\n");
     exit(EXIT_SUCCESS);
 }
@@ -396,7 +812,117 @@ void close_server()
 void sigint_handler(int signum)
 {
     if(signum == SIGINT)
+    {
         server_flag = SERVER_DOWN;
 
-    close_server();
-}
\ No newline at end of file
+        for(int i = 0; i < num_shards; i++)
+            event_loop_stop(&shards[i].loop);
+    }
+}
+static void* shard_run(void* arg)
+{
+    struct shard* shard = arg;
+
+    event_loop_run(&shard->loop);
+
+    return NULL;
+}
+
+static void* metrics_run(void* arg)
+{
+    (void)arg;
+
+    while(1)
+    {
+        int client_fd = accept4(server.metrics_socket_fd, NULL, NULL, SOCK_CLOEXEC);
+
+        if(client_fd == -1)
+        {
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            /* The socket was shut down by close_server(). */
+            break;
+        }
+
+        metrics_serve(client_fd);
+        close(client_fd);
+    }
+
+    return NULL;
+}
+
+static void metrics_close(void)
+{
+    if(server.metrics_socket_fd == -1)
+        return;
+
+    close(server.metrics_socket_fd);
+    server.metrics_socket_fd = -1;
+
+    unlink(server.metrics_socket_path);
+    free(server.metrics_socket_path);
+    server.metrics_socket_path = NULL;
+}
+
+static void metrics_serve(int client_fd)
+{
+    struct timeval timeout = {METRICS_TIMEOUT, 0};
+    char request[METRICS_REQUEST_SIZE + 1];
+    size_t received = 0;
+    metrics_report report;
+    buffer body, out;
+    char header[256];
+
+    setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    /* The request is read up to the blank line that ends its headers, whatever path it asks for. */
+    while(received < METRICS_REQUEST_SIZE)
+    {
+        ssize_t rec = recv(client_fd, request + received, METRICS_REQUEST_SIZE - received, 0);
+
+        if(rec == -1 && errno == EINTR)
+            continue;
+
+        if(rec <= 0)
+            break;
+
+        received += (size_t)rec;
+        request[received] = '\0';
+
+        if(strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL)
+            break;
+    }
+
+    memset(&report, 0, sizeof(report));
+    memset(&body, 0, sizeof(body));
+    memset(&out, 0, sizeof(out));
+
+    for(int i = 0; i < num_shards; i++)
+        event_loop_metrics(&shards[i].loop, &report);
+
+    metrics_format(&report, &body);
+    metrics_report_free(&report);
+
+    int size = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", body.len);
+
+    buffer_append(&out, header, (size_t)size);
+    buffer_append(&out, body.data, body.len);
+
+    while(out.off < out.len)
+    {
+        ssize_t sent = send(client_fd, out.data + out.off, out.len - out.off, MSG_NOSIGNAL);
+
+        if(sent == -1 && errno == EINTR)
+            continue;
+
+        if(sent <= 0)
+            break;
+
+        buffer_consume(&out, (size_t)sent);
+    }
+
+    buffer_free(&body);
+    buffer_free(&out);
+}
@@ -16,41 +16,15 @@
 
 static struct thread_list thread_list;
 
-char* read_file(const char* file)
+void add_thread(pthread_t tid)
 {
-    FILE *fp = fopen(file, "r");
-    unsigned long size;
-    char* result;
-
-    if (fp == NULL)
-        return NULL;
-
-    fseek(fp, 0, SEEK_END);
-
-    size = (unsigned long) ftell(fp);
-
-    if(size < 1)
+    struct node* new_node = (struct node*)malloc(sizeof(struct node));
+    if(new_node == NULL)
     {
-        fclose(fp);
-        return NULL;
+        printf("Error: no se pudo asignar memoria para la lista de hilos.\n");
+        exit(EXIT_FAILURE);
     }
 
-    rewind(fp);
-
-    result = calloc(size, sizeof(char));
-
-    fread(result, 1, size, fp);
-
-    result[size - 1] = '\0';
-
-    fclose(fp);
-
-    return result;
-}
-
-void add_thread(pthread_t tid)
-{
-    struct node* new_node = (struct node*)malloc(sizeof(struct node));
     new_node->tid = tid;
     new_node->next = NULL;
 
@@ -80,6 +54,9 @@ void rmv_thread(pthread_t tid)
             else
                 prev->next = aux->next;
 
+            if(thread_list.last == aux)
+                thread_list.last = prev;
+
             free(aux);
             break;
         }
@@ -95,7 +72,21 @@ void end_threads()
 
     while(aux != NULL)
     {
+        struct node* next = aux->next;
+
         pthread_join(aux->tid, NULL);
-        aux = aux->next;
+        free(aux);
+        aux = next;
     }
-}
\ No newline at end of file
+
+    thread_list.head = thread_list.last = NULL;
+}
+
+uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
@@ -0,0 +1,85 @@
+/**
+ * @file sysinfo_sampler.c
+ *
+ * @brief Source file for the shared sysinfo snapshot.
+ *
+ * @details The snapshot is protected by a sequence lock: the writer makes the counter odd, writes the
+ * snapshot and makes it even again, and a reader copies the snapshot and retries if the counter
+ * changed or was odd meanwhile.
+ *
+ * @author Robledo, Valentín
+ * @date Mayo 2023
+ * @version 1.0
+ *
+ * @copyright Copyright (c) 2023
+ */
+
+#include "../inc/sysinfo_sampler.h"
+
+static void sampler_refresh(sysinfo_sampler* sampler);
+
+void sysinfo_sampler_init(sysinfo_sampler* sampler, unsigned long interval_ms)
+{
+    memset(sampler, 0, sizeof(*sampler));
+    pthread_mutex_init(&sampler->refresh_lock, NULL);
+
+    sampler->interval_ns = (uint64_t)interval_ms * 1000000;
+
+    sampler_refresh(sampler);
+}
+
+void sysinfo_sampler_read(sysinfo_sampler* sampler, sysinfo_snapshot* snapshot)
+{
+    unsigned int start;
+
+    do{
+        start = atomic_load_explicit(&sampler->sequence, memory_order_acquire);
+
+        memcpy(snapshot, &sampler->snapshot, sizeof(*snapshot));
+
+        atomic_thread_fence(memory_order_acquire);
+    }while((start & 1) || atomic_load_explicit(&sampler->sequence, memory_order_relaxed) != start);
+
+    /* A request arriving while the snapshot is refreshed does not wait, it keeps the previous sample. */
+    if(monotonic_ns() - snapshot->taken_ns >= sampler->interval_ns && pthread_mutex_trylock(&sampler->refresh_lock) == 0)
+    {
+        if(sampler->snapshot.taken_ns == snapshot->taken_ns)
+            sampler_refresh(sampler);
+
+        memcpy(snapshot, &sampler->snapshot, sizeof(*snapshot));
+
+        pthread_mutex_unlock(&sampler->refresh_lock);
+    }
+
+    atomic_fetch_add_explicit(&sampler->reads, 1, memory_order_relaxed);
+}
+
+void sysinfo_sampler_close(sysinfo_sampler* sampler)
+{
+    pthread_mutex_destroy(&sampler->refresh_lock);
+}
+
+static void sampler_refresh(sysinfo_sampler* sampler)
+{
+    sysinfo_snapshot sample;
+    struct sysinfo info;
+
+    if(sysinfo(&info) == -1)
+    {
+        perror("Error al obtener información del sistema.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    snprintf(sample.freeram, SYSINFO_RESULT_SIZE, "Memoria ram libre: %lu %s", info.freeram/1024, "KB");
+    snprintf(sample.loads, SYSINFO_RESULT_SIZE, "Carga promedio en el último minuto: %lu", info.loads[0]/65536);
+    sample.taken_ns = monotonic_ns();
+
+    /* Only the holder of refresh_lock, or init, writes the snapshot. */
+    atomic_fetch_add_explicit(&sampler->sequence, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    memcpy(&sampler->snapshot, &sample, sizeof(sample));
+
+    atomic_fetch_add_explicit(&sampler->sequence, 1, memory_order_release);
+    atomic_fetch_add_explicit(&sampler->samples, 1, memory_order_relaxed);
+}
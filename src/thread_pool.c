@@ -0,0 +1,305 @@
+/**
+ * @file thread_pool.c
+ *
+ * @brief Source file for the implementation of the worker thread pool.
+ *
+ * @details Contains the functions that queue the commands sent by the clients and the
+ * worker threads that execute them.
+ *
+ * @author Robledo, Valentín
+ * @date Mayo 2023
+ * @version 1.0
+ *
+ * @copyright Copyright (c) 2023
+ */
+
+#include "../inc/thread_pool.h"
+#include "../inc/server.h"
+
+static void* worker_function(void* arg);
+static int job_stream_push(struct job* job, int last);
+static uint64_t elapsed_ns(const struct timespec* start, const struct timespec* end);
+
+int thread_pool_init(thread_pool* pool, int workers)
+{
+    sigset_t all_signals, old_signals;
+
+    memset(pool, 0, sizeof(*pool));
+
+    if(workers <= 0)
+        workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    if(workers <= 0)
+        workers = 1;
+
+    pool->threads = calloc((size_t)workers, sizeof(pthread_t));
+    if(pool->threads == NULL)
+    {
+        printf("Error: no se pudo asignar memoria para los hilos.\n");
+        return -1;
+    }
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_BLOCK, &all_signals, &old_signals);
+
+    for(int i = 0; i < workers; i++)
+    {
+        if(pthread_create(&pool->threads[i], NULL, &worker_function, pool) != 0)
+        {
+            printf("Error al crear el hilo.\n");
+            pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+            return -1;
+        }
+
+        pool->stats.workers++;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+    return 0;
+}
+
+void thread_pool_submit(thread_pool* pool, struct job* job)
+{
+    clock_gettime(CLOCK_MONOTONIC, &job->enqueued);
+    job->next = NULL;
+
+    pthread_mutex_lock(&pool->mutex);
+
+    if(pool->head == NULL)
+        pool->head = job;
+    else
+        pool->last->next = job;
+
+    pool->last = job;
+
+    if(++pool->stats.queue_depth > pool->stats.max_queue_depth)
+        pool->stats.max_queue_depth = pool->stats.queue_depth;
+
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void thread_pool_stats(thread_pool* pool, struct pool_stats* stats)
+{
+    pthread_mutex_lock(&pool->mutex);
+    *stats = pool->stats;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void thread_pool_close(thread_pool* pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for(int i = 0; i < pool->stats.workers; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    while(pool->head != NULL)
+    {
+        struct job* job = pool->head;
+        pool->head = job->next;
+        event_loop_complete(job->loop, job);
+    }
+
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->threads);
+    pool->threads = NULL;
+}
+
+void job_stream_init(struct job* job, size_t chunk_size, size_t max_chunks)
+{
+    job->stream = 1;
+    job->chunk_size = chunk_size;
+    job->max_chunks = max_chunks ? max_chunks : 1;
+    pthread_mutex_init(&job->stream_lock, NULL);
+
+    /* The stall deadline is monotonic, a change of the wall clock does not cut a stream short. */
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&job->stream_cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+int job_stream_write(struct job* job, const char* data, size_t size)
+{
+    while(size > 0)
+    {
+        size_t length = job->chunk_size - job->pending.len;
+
+        if(length > size)
+            length = size;
+
+        buffer_append(&job->pending, data, length);
+        data += length;
+        size -= length;
+
+        if(job->pending.len == job->chunk_size && job_stream_push(job, 0) == -1)
+            return -1;
+    }
+
+    return 0;
+}
+
+size_t job_stream_room(struct job* job)
+{
+    size_t room = 0;
+
+    pthread_mutex_lock(&job->stream_lock);
+    if(!job->cancelled && job->chunks_in_flight < job->max_chunks)
+        room = (job->max_chunks - job->chunks_in_flight) * job->chunk_size - job->pending.len;
+    pthread_mutex_unlock(&job->stream_lock);
+
+    return room;
+}
+
+void job_stream_end(struct job* job)
+{
+    job_stream_push(job, 1);
+}
+
+void job_stream_release(struct job* job)
+{
+    pthread_mutex_lock(&job->stream_lock);
+    job->chunks_in_flight--;
+    pthread_cond_signal(&job->stream_cond);
+    pthread_mutex_unlock(&job->stream_lock);
+}
+
+void job_stream_cancel(struct job* job)
+{
+    pthread_mutex_lock(&job->stream_lock);
+    job->cancelled = 1;
+    pthread_cond_signal(&job->stream_cond);
+    pthread_mutex_unlock(&job->stream_lock);
+}
+
+void free_job(struct job* job)
+{
+    if(job->stream)
+    {
+        pthread_cond_destroy(&job->stream_cond);
+        pthread_mutex_destroy(&job->stream_lock);
+        buffer_free(&job->pending);
+    }
+
+    free(job->command);
+    free(job->result);
+    free(job);
+}
+
+static int job_stream_push(struct job* job, int last)
+{
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += STREAM_STALL_TIMEOUT;
+
+    pthread_mutex_lock(&job->stream_lock);
+
+    /* A client that keeps its socket open without acknowledging would hold the worker, and the journalctl child, forever. */
+    while(job->chunks_in_flight >= job->max_chunks && !job->cancelled)
+    {
+        if(pthread_cond_timedwait(&job->stream_cond, &job->stream_lock, &deadline) == ETIMEDOUT)
+        {
+            job->cancelled = 1;
+            job->stalled = 1;
+        }
+    }
+
+    if(job->cancelled)
+    {
+        pthread_mutex_unlock(&job->stream_lock);
+        job->pending.len = job->pending.off = 0;
+        return -1;
+    }
+
+    job->chunks_in_flight++;
+    pthread_mutex_unlock(&job->stream_lock);
+
+    struct chunk* chunk = malloc(sizeof(struct chunk));
+    if(chunk == NULL)
+    {
+        printf("Error: no se pudo asignar memoria para el fragmento.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(job->pending.data == NULL)
+        buffer_reserve(&job->pending, 1);
+
+    /* The chunk takes the memory of the pending bytes, the next ones go to a new buffer. */
+    chunk->job = job;
+    chunk->data = job->pending.data;
+    chunk->size = job->pending.len;
+    chunk->last = last;
+    memset(&job->pending, 0, sizeof(job->pending));
+
+    event_loop_stream(job->loop, chunk);
+
+    return 0;
+}
+
+static void* worker_function(void* arg)
+{
+    thread_pool* pool = (thread_pool*)arg;
+
+    while(1)
+    {
+        struct timespec start, end;
+
+        pthread_mutex_lock(&pool->mutex);
+
+        while(pool->head == NULL && !pool->stop)
+            pthread_cond_wait(&pool->cond, &pool->mutex);
+
+        if(pool->stop)
+        {
+            pthread_mutex_unlock(&pool->mutex);
+            break;
+        }
+
+        struct job* job = pool->head;
+        pool->head = job->next;
+        if(pool->head == NULL)
+            pool->last = NULL;
+
+        pool->stats.queue_depth--;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        uint64_t wait_ns = elapsed_ns(&job->enqueued, &start);
+        pool->stats.total_wait_ns += wait_ns;
+        if(wait_ns > pool->stats.max_wait_ns)
+            pool->stats.max_wait_ns = wait_ns;
+
+        pthread_mutex_unlock(&pool->mutex);
+
+        if(job->stream)
+            client_stream(job);
+        else
+            job->result = client_select(job->client_type, job->command);
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        job->exec_ns = elapsed_ns(&start, &end);
+
+        pthread_mutex_lock(&pool->mutex);
+        pool->stats.jobs_completed++;
+        pool->stats.total_exec_ns += job->exec_ns;
+        pthread_mutex_unlock(&pool->mutex);
+
+        event_loop_complete(job->loop, job);
+    }
+
+    return NULL;
+}
+
+static uint64_t elapsed_ns(const struct timespec* start, const struct timespec* end)
+{
+    return (uint64_t)(end->tv_sec - start->tv_sec) * 1000000000ULL + (uint64_t)end->tv_nsec - (uint64_t)start->tv_nsec;
+}